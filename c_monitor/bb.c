@@ -3,9 +3,10 @@
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdbool.h>
 
 #define LINE_SZ  (1024)
-#define BBS_SZ   (1024 * sizeof(basic_block_t))
+#define BBS_N    (1024)
 
 
 ssize_t basic_blocks_find(const char *r2bb_script, const char *bin, basic_block_t **bbs)
@@ -22,12 +23,17 @@ ssize_t basic_blocks_find(const char *r2bb_script, const char *bin, basic_block_
     assert(stream != NULL);
 
     char line[LINE_SZ];
-    *bbs = malloc(BBS_SZ);
+    size_t bbs_cap = BBS_N;
+    *bbs = calloc(bbs_cap, sizeof(basic_block_t));
     assert(*bbs != NULL);
-    memset(*bbs, 0, BBS_SZ);
     size_t bbs_n = 0;
     while (fgets(line, LINE_SZ, stream) != NULL) {
-        assert(bbs_n < BBS_SZ);
+        if (bbs_n == bbs_cap) {
+            bbs_cap *= 2;
+            *bbs = realloc(*bbs, bbs_cap * sizeof(basic_block_t));
+            assert(*bbs != NULL);
+        }
+        (*bbs)[bbs_n] = (basic_block_t) { 0, 0 };
         char *col = strtok(line, " ");
         uint8_t col_idx = 0;
         while (col != NULL) {
@@ -56,3 +62,81 @@ ssize_t basic_blocks_find(const char *r2bb_script, const char *bin, basic_block_
 
     return bbs_n;
 }
+
+
+static int cmp_basic_block(const void *bb1, const void *bb2)
+{
+    const basic_block_t *_bb1 = (const basic_block_t *) bb1;
+    const basic_block_t *_bb2 = (const basic_block_t *) bb2;
+    // by start, enclosing blocks before the ones they contain
+    if (_bb1->from != _bb2->from)
+        return _bb1->from > _bb2->from ? 1 : -1;
+    if (_bb1->to != _bb2->to)
+        return _bb1->to < _bb2->to ? 1 : -1;
+    return 0;
+}
+
+
+static void bb_index_add(bb_index_t *index, uint64_t start, uint64_t end, uint64_t block)
+{
+    index->starts[index->n] = start;
+    index->ends[index->n] = end;
+    index->blocks[index->n] = block;
+    index->n++;
+}
+
+
+bb_index_t *bb_index_new(const basic_block_t *bbs, size_t bbs_n)
+{
+    basic_block_t *sorted = malloc((bbs_n + 1) * sizeof(basic_block_t));
+    assert(sorted != NULL);
+    memcpy(sorted, bbs, bbs_n * sizeof(basic_block_t));
+    qsort(sorted, bbs_n, sizeof(basic_block_t), cmp_basic_block);
+
+    // every block start and end cuts a range at most once
+    bb_index_t *index = malloc(sizeof(bb_index_t));
+    assert(index != NULL);
+    index->starts = malloc((2 * bbs_n + 1) * sizeof(uint64_t));
+    index->ends = malloc((2 * bbs_n + 1) * sizeof(uint64_t));
+    index->blocks = malloc((2 * bbs_n + 1) * sizeof(uint64_t));
+    assert(index->starts != NULL && index->ends != NULL && index->blocks != NULL);
+    index->n = 0;
+
+    // sweep over the sorted blocks keeping the ones still open on a stack,
+    // the innermost (latest started) one owns the addresses
+    basic_block_t *stack = malloc((bbs_n + 1) * sizeof(basic_block_t));
+    assert(stack != NULL);
+    size_t sp = 0;
+    uint64_t cur = 0;
+    for (size_t i = 0; i <= bbs_n; i++) {
+        const bool last = i == bbs_n;
+        while (sp > 0 && (last || stack[sp-1].to <= sorted[i].from)) {
+            basic_block_t top = stack[--sp];
+            if (cur < top.to) {
+                bb_index_add(index, cur, top.to, top.from);
+                cur = top.to;
+            }
+        }
+        if (last)
+            break;
+        if (sorted[i].to <= sorted[i].from)
+            continue;
+        if (sp > 0 && cur < sorted[i].from)
+            bb_index_add(index, cur, sorted[i].from, stack[sp-1].from);
+        stack[sp++] = sorted[i];
+        cur = sorted[i].from;
+    }
+
+    free(stack);
+    free(sorted);
+    return index;
+}
+
+
+void bb_index_destroy(bb_index_t *index)
+{
+    free(index->starts);
+    free(index->ends);
+    free(index->blocks);
+    free(index);
+}
@@ -10,6 +10,36 @@ typedef struct basic_block {
     uint64_t to;
 } basic_block_t;
 
+// disjoint, sorted address ranges, each mapped to the start of the
+// innermost basic block covering it
+typedef struct bb_index {
+    uint64_t *starts;
+    uint64_t *ends;
+    uint64_t *blocks;
+    size_t n;
+} bb_index_t;
+
 ssize_t basic_blocks_find(const char *r2bb_script, const char *bin, basic_block_t **bbs);
 
+bb_index_t *bb_index_new(const basic_block_t *bbs, size_t bbs_n);
+void        bb_index_destroy(bb_index_t *index);
+
+static inline uint64_t bb_index_find(const bb_index_t *index, uint64_t addr)
+{
+    if (index->n == 0 || addr < index->starts[0])
+        return 0;
+
+    // branchless lower bound on the last range starting at or before addr
+    const uint64_t *base = index->starts;
+    size_t len = index->n;
+    while (len > 1) {
+        const size_t half = len / 2;
+        base = (base[half] <= addr) ? base + half : base;
+        len -= half;
+    }
+
+    const size_t i = base - index->starts;
+    return addr < index->ends[i] ? index->blocks[i] : 0;
+}
+
 #endif
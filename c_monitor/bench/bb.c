@@ -0,0 +1,90 @@
+#include "bench.h"
+#include <c_monitor/bb.h>
+#include <assert.h>
+#include <stdlib.h>
+
+/*
+ * Mapping branch addresses to their basic block: the scan over every block
+ * process_branches used to do, against the interval index, for binaries
+ * of a few to many blocks. Addresses are spread over the code, some fall
+ * between blocks.
+ *
+ * usage: bb [lookups]
+ */
+
+#define LOOKUPS_N       (1000 * 1000)
+
+
+// what process_branches did per address before the index
+static uint64_t find_scan(const basic_block_t *bbs, size_t bbs_n, uint64_t addr)
+{
+    uint64_t block = 0;
+    for (size_t j = 0; j < bbs_n; j++) {
+        if (addr >= bbs[j].from && addr < bbs[j].to) {
+            block = bbs[j].from;
+            break;
+        }
+    }
+    return block;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const size_t lookups_n = argc > 1 ? strtoul(argv[1], NULL, 10) : LOOKUPS_N;
+    static const size_t blocks_n[] = { 100, 1000, 10000, 100000 };
+
+    for (size_t b = 0; b < sizeof(blocks_n) / sizeof(blocks_n[0]); b++) {
+        // disjoint blocks of 4 to 64 bytes, every eighth followed by a gap,
+        // listed in the order r2 could give them in
+        const size_t bbs_n = blocks_n[b];
+        basic_block_t *bbs = malloc(bbs_n * sizeof(basic_block_t));
+        assert(bbs != NULL);
+        uint64_t state = bbs_n;
+        uint64_t addr = 0x401000;
+        for (size_t i = 0; i < bbs_n; i++) {
+            bbs[i].from = addr;
+            bbs[i].to = addr + 4 + bench_rand(&state) % 61;
+            addr = bbs[i].to + (i % 8 == 7 ? 16 : 0);
+        }
+        for (size_t i = bbs_n - 1; i > 0; i--) {
+            const size_t j = bench_rand(&state) % (i + 1);
+            const basic_block_t swap = bbs[i];
+            bbs[i] = bbs[j];
+            bbs[j] = swap;
+        }
+        uint64_t *addrs = malloc(lookups_n * sizeof(uint64_t));
+        assert(addrs != NULL);
+        for (size_t i = 0; i < lookups_n; i++)
+            addrs[i] = 0x401000 + bench_rand(&state) % (addr - 0x401000);
+
+        bb_index_t *index = bb_index_new(bbs, bbs_n);
+        uint64_t start_ns = bench_now_ns();
+        uint64_t sum_index = 0;
+        for (size_t i = 0; i < lookups_n; i++)
+            sum_index += bb_index_find(index, addrs[i]);
+        const uint64_t index_ns = bench_now_ns() - start_ns;
+
+        // the scan is slow enough that a sample of the lookups will do
+        const size_t scan_n = lookups_n / (bbs_n >= 10000 ? 100 : 1);
+        uint64_t sum_scan = 0, sum_check = 0;
+        start_ns = bench_now_ns();
+        for (size_t i = 0; i < scan_n; i++)
+            sum_scan += find_scan(bbs, bbs_n, addrs[i]);
+        const uint64_t scan_ns = bench_now_ns() - start_ns;
+        for (size_t i = 0; i < scan_n; i++)
+            sum_check += bb_index_find(index, addrs[i]);
+        bench_keep(sum_index);
+
+        printf("bb: %6zu blocks, %6zu ranges: scan %9.1f ns/lookup, index %5.1f ns/lookup\n",
+               bbs_n, index->n, (double) scan_ns / scan_n, (double) index_ns / lookups_n);
+        if (sum_scan != sum_check) {
+            fprintf(stderr, "bb: the index and the scan disagree on %zu blocks\n", bbs_n);
+            return EXIT_FAILURE;
+        }
+        bb_index_destroy(index);
+        free(addrs);
+        free(bbs);
+    }
+    return EXIT_SUCCESS;
+}
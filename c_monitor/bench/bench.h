@@ -0,0 +1,36 @@
+#ifndef _H_BENCH_
+#define _H_BENCH_
+
+#define _GNU_SOURCE
+#include <inttypes.h>
+#include <stdio.h>
+#include <time.h>
+
+/*
+ * Timing for the benchmarks under bench/, each a program of its own that
+ * prints one line per variant it measures.
+ */
+
+static inline uint64_t bench_now_ns(void)
+{
+    struct timespec spec;
+    clock_gettime(CLOCK_MONOTONIC, &spec);
+    return (uint64_t) spec.tv_sec * 1000000000ULL + spec.tv_nsec;
+}
+
+// keeps the compiler from dropping work whose result goes unused
+static inline void bench_keep(uint64_t value)
+{
+    __asm__ volatile("" : : "r"(value) : "memory");
+}
+
+// a deterministic stream of pseudo-random numbers
+static inline uint64_t bench_rand(uint64_t *state)
+{
+    uint64_t x = (*state += 0x9e3779b97f4a7c15ULL);
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+#endif
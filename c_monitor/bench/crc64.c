@@ -0,0 +1,58 @@
+#include "bench.h"
+#include <c_monitor/util_impl.h>
+#include <assert.h>
+#include <stdlib.h>
+
+/*
+ * Hashing inputs: the byte-wise table loop util_CRC64 used to be, against
+ * slice-by-8 and, where the CPU has it, CLMUL folding, from small inputs
+ * to large ones, over the same bytes each.
+ *
+ * usage: crc64 [megabytes]
+ */
+
+#define MEGABYTES       256
+
+
+int main(int argc, char *argv[])
+{
+    const size_t total = (argc > 1 ? strtoul(argv[1], NULL, 10) : MEGABYTES) << 20;
+    static const size_t sizes[] = { 64, 256, 1024, 4096, 65536, 1 << 20 };
+    assert(total > 0);
+
+    uint8_t *buf = malloc(sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]);
+    assert(buf != NULL);
+    uint64_t state = 42;
+    for (size_t i = 0; i < sizes[sizeof(sizes) / sizeof(sizes[0]) - 1]; i++)
+        buf[i] = (uint8_t) bench_rand(&state);
+
+    const util_crc64_impl_t *variants;
+    const size_t variants_n = util_CRC64Impls(&variants);
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const size_t rounds = total / sizes[s] > 0 ? total / sizes[s] : 1;
+        uint64_t expected = 0;
+        for (size_t v = 0; v < variants_n; v++) {
+            // chained, so that no round can be skipped or overlapped
+            uint64_t crc = 0;
+            const uint64_t start_ns = bench_now_ns();
+            for (size_t r = 0; r < rounds; r++)
+                crc = variants[v].crc(crc, buf, sizes[s]);
+            const uint64_t elapsed_ns = bench_now_ns() - start_ns;
+            bench_keep(crc);
+
+            printf("crc64: %-10s %8zu bytes: %9.1f MB/s\n", variants[v].name, sizes[s],
+                   (double) rounds * sizes[s] / (1 << 20) / (elapsed_ns / 1e9));
+            if (v == 0)
+                expected = crc;
+            if (crc != expected) {
+                fprintf(stderr, "crc64: %s differs from the table on %zu bytes\n",
+                        variants[v].name, sizes[s]);
+                return EXIT_FAILURE;
+            }
+        }
+    }
+
+    free(buf);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,130 @@
+#include "bench.h"
+#include <c_monitor/coverage.h>
+#include <c_monitor/edges.h>
+#include <hashtable.h>
+#include <assert.h>
+#include <stdlib.h>
+
+/*
+ * Counting branch hits: the string-keyed Collections-C hashtable the
+ * monitor used to keep, against the EdgeMap a worker keeps per input and
+ * the CoverageMap shared by all of them, over the same skewed stream of
+ * branches, most of them hits on edges seen before.
+ *
+ * usage: edges [branches [edges]]
+ */
+
+#define BRANCHES_N      (4 * 1000 * 1000)
+#define EDGES_N         50000
+#define HASH_KEY_SEP    "/"
+#define HASH_KEY_SZ     64
+
+
+typedef struct branch {
+    uint64_t from;
+    uint64_t to;
+} branch_t;
+
+
+// what process_branches did per branch with the old hashtable
+static uint64_t count_hashtable(const branch_t *branches, size_t n)
+{
+    HashTable *table;
+    assert(hashtable_new(&table) == CC_OK);
+    uint64_t new_edges = 0;
+    for (size_t i = 0; i < n; i++) {
+        char *key = malloc(HASH_KEY_SZ);
+        assert(key != NULL);
+        snprintf(key, HASH_KEY_SZ, "%" PRIu64 HASH_KEY_SEP "%" PRIu64, branches[i].from, branches[i].to);
+        uint64_t *value = NULL;
+        if (hashtable_get(table, key, (void **) &value) == CC_OK) {
+            (*value)++;
+            free(key);
+        } else {
+            value = malloc(sizeof(uint64_t));
+            assert(value != NULL);
+            *value = 1;
+            assert(hashtable_add(table, key, value) == CC_OK);
+            new_edges++;
+        }
+    }
+
+    HashTableIter iter;
+    TableEntry *entry;
+    hashtable_iter_init(&iter, table);
+    while (hashtable_iter_next(&iter, &entry) != CC_ITER_END) {
+        free(entry->key);
+        free(entry->value);
+    }
+    hashtable_destroy(table);
+    return new_edges;
+}
+
+
+static uint64_t count_edge_map(const branch_t *branches, size_t n)
+{
+    EdgeMap *map = edge_map_new(0);
+    assert(map != NULL);
+    uint64_t new_edges = 0;
+    for (size_t i = 0; i < n; i++)
+        new_edges += edge_map_hit(map, branches[i].from, branches[i].to);
+    edge_map_destroy(map);
+    return new_edges;
+}
+
+
+static uint64_t count_coverage_map(const branch_t *branches, size_t n)
+{
+    CoverageMap *map = coverage_map_new(0);
+    assert(map != NULL);
+    uint64_t new_edges = 0;
+    for (size_t i = 0; i < n; i++)
+        new_edges += coverage_map_hit(map, branches[i].from, branches[i].to, 1);
+    coverage_map_destroy(map);
+    return new_edges;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const size_t branches_n = argc > 1 ? strtoul(argv[1], NULL, 10) : BRANCHES_N;
+    const size_t edges_n = argc > 2 ? strtoul(argv[2], NULL, 10) : EDGES_N;
+    assert(branches_n > 0 && edges_n > 0);
+
+    // low edge numbers come up far more often, as hot loops do
+    branch_t *branches = malloc(branches_n * sizeof(branch_t));
+    assert(branches != NULL);
+    uint64_t state = 42;
+    for (size_t i = 0; i < branches_n; i++) {
+        const uint64_t edge = bench_rand(&state) % (1 + bench_rand(&state) % edges_n);
+        branches[i].from = 0x400000 + edge * 16;
+        branches[i].to = 0x400000 + (edge * 7919) % edges_n * 16;
+    }
+
+    static const struct {
+        const char *name;
+        uint64_t (*count)(const branch_t *, size_t);
+    } variants[] = {
+        { "hashtable", count_hashtable },
+        { "edge map", count_edge_map },
+        { "coverage map", count_coverage_map },
+    };
+    uint64_t expected = 0;
+    for (size_t v = 0; v < sizeof(variants) / sizeof(variants[0]); v++) {
+        const uint64_t start_ns = bench_now_ns();
+        const uint64_t new_edges = variants[v].count(branches, branches_n);
+        const uint64_t elapsed_ns = bench_now_ns() - start_ns;
+        printf("edges: %-12s %10zu branches, %7" PRIu64 " edges, %7.1f ns/branch\n",
+               variants[v].name, branches_n, new_edges, (double) elapsed_ns / branches_n);
+        if (v == 0)
+            expected = new_edges;
+        if (new_edges != expected) {
+            fprintf(stderr, "edges: %s found %" PRIu64 " edges, not %" PRIu64 "\n",
+                    variants[v].name, new_edges, expected);
+            return EXIT_FAILURE;
+        }
+    }
+
+    free(branches);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,189 @@
+#include "bench.h"
+#include <c_monitor/ring.h>
+#include <assert.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+
+/*
+ * Inputs through the rings: producer threads put them the way the preload
+ * does, each into a ring of its own, while this thread reads them through
+ * a RingSet as the monitor does, asleep on the doorbell whenever the rings
+ * are empty. The preload drops an input that doesn't fit; here the
+ * producer tries again, so that the rate is what the rings sustain, and
+ * counts how often it found its ring full. Every input carries its number
+ * and size, so that one read torn or lost fails the run.
+ *
+ * usage: ring [inputs [threads]]
+ */
+
+#define INPUTS_N        (1000 * 1000)   // per producer
+#define BYTES_MAX       (256 * 1024 * 1024) // per producer, fewer large inputs
+#define THREADS_N       4
+#define RING_SZ         (4 * 1024 * 1024)
+#define RING_POLL_MS    1
+
+
+typedef struct producer {
+    pthread_t thread;
+    size_t inputs_n;
+    size_t size;
+    uint64_t full;
+} producer_t;
+
+static int bell_fd = -1;
+static struct sockaddr_un bell_addr;
+static socklen_t bell_addr_len;
+static size_t producers_left;
+
+
+// as the preload sets up the ring of a thread
+static ring_t *ring_create(void)
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/" RING_SHM_PREFIX "%d.%d", getpid(), gettid());
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    assert(fd != -1);
+    assert(ftruncate(fd, sizeof(ring_t) + RING_SZ) == 0);
+    ring_t *ring = mmap(NULL, sizeof(ring_t) + RING_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    assert(ring != MAP_FAILED);
+    ring->size = RING_SZ;
+    ring->pid = getpid();
+    ring->tid = gettid();
+    __atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    return ring;
+}
+
+
+// the preload's ring_put
+static bool ring_put(ring_t *ring, const void *buf, size_t count)
+{
+    const uint64_t need = RING_RECORD(count);
+    const uint64_t start = ring->head;
+    const uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = start;
+    uint64_t off = head & (RING_SZ - 1);
+    const uint64_t pad = off + need > RING_SZ ? RING_SZ - off : 0;
+    if (need + pad > RING_SZ - (head - tail)) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint8_t *data = ring_data(ring);
+    if (pad > 0) {
+        *(uint32_t *) (data + off) = RING_WRAP;
+        head += pad;
+        off = 0;
+    }
+    *(uint32_t *) (data + off) = count;
+    memcpy(data + off + sizeof(uint32_t), buf, count);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->sent, ring->sent + 1, __ATOMIC_RELAXED);
+
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == start && bell_fd != -1)
+        sendto(bell_fd, &ring->tid, sizeof(ring->tid), MSG_DONTWAIT | MSG_NOSIGNAL,
+               (struct sockaddr *) &bell_addr, bell_addr_len);
+    return true;
+}
+
+
+// inputs of the same size, numbered in their first and last bytes, in order
+static void *produce(void *data)
+{
+    producer_t *producer = (producer_t *) data;
+    ring_t *ring = ring_create();
+    uint8_t *input = malloc(producer->size);
+    assert(input != NULL);
+    memset(input, 0xAA, producer->size);
+    for (uint64_t i = 0; i < producer->inputs_n; i++) {
+        memcpy(input, &i, sizeof(i));
+        input[producer->size - 1] = (uint8_t) i;
+        while (!ring_put(ring, input, producer->size))
+            producer->full++;
+    }
+    free(input);
+
+    char name[64];
+    snprintf(name, sizeof(name), "/" RING_SHM_PREFIX "%d.%d", ring->pid, ring->tid);
+    __atomic_store_n(&ring->closed, 1, __ATOMIC_RELEASE);
+    munmap(ring, sizeof(ring_t) + RING_SZ);
+    shm_unlink(name);
+    __atomic_fetch_sub(&producers_left, 1, __ATOMIC_SEQ_CST);
+    return NULL;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const size_t inputs_n = argc > 1 ? strtoul(argv[1], NULL, 10) : INPUTS_N;
+    const size_t threads_n = argc > 2 ? strtoul(argv[2], NULL, 10) : THREADS_N;
+    static const size_t sizes[] = { 16, 256, 4096, 65536 };
+    assert(inputs_n > 0 && threads_n > 0);
+
+    RingSet *set = ring_set_new();
+    assert(set != NULL);
+    bell_addr_len = ring_bell_addr(&bell_addr);
+    bell_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    struct pollfd bell = { ring_set_bell(set), POLLIN, 0 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        const size_t per_thread = inputs_n < BYTES_MAX / sizes[s] ? inputs_n : BYTES_MAX / sizes[s];
+        producer_t producers[threads_n];
+        producers_left = threads_n;
+        const uint64_t start_ns = bench_now_ns();
+        for (size_t t = 0; t < threads_n; t++) {
+            producers[t] = (producer_t) { .inputs_n = per_thread, .size = sizes[s] };
+            assert(pthread_create(&producers[t].thread, NULL, produce, &producers[t]) == 0);
+        }
+
+        uint64_t received = 0, bytes = 0, sleeps = 0;
+        for (;;) {
+            const uint8_t *data;
+            size_t size;
+            if (ring_set_next(set, &data, &size)) {
+                uint64_t number;
+                memcpy(&number, data, sizeof(number));
+                if (size != sizes[s] || data[size - 1] != (uint8_t) number || number >= per_thread) {
+                    fprintf(stderr, "ring: input of %zu bytes torn, %zu expected\n", size, sizes[s]);
+                    return EXIT_FAILURE;
+                }
+                received++;
+                bytes += size;
+                ring_set_release(set);
+                continue;
+            }
+            if (__atomic_load_n(&producers_left, __ATOMIC_SEQ_CST) == 0 && received >= threads_n * per_thread)
+                break;
+            // empty, as the monitor waits
+            sleeps++;
+            if (poll(&bell, bell.fd != -1, RING_POLL_MS) <= 0 || bell.fd == -1)
+                ring_set_scan(set);
+            else
+                ring_set_wake(set);
+        }
+        const uint64_t elapsed_ns = bench_now_ns() - start_ns;
+
+        uint64_t full = 0;
+        for (size_t t = 0; t < threads_n; t++) {
+            pthread_join(producers[t].thread, NULL);
+            full += producers[t].full;
+        }
+        ring_set_scan(set);
+        printf("ring: %zu threads, %6zu bytes: %10.0f inputs/s, %8.1f MB/s, %" PRIu64 " puts on a full ring, "
+               "%" PRIu64 " sleeps\n", threads_n, sizes[s], received / (elapsed_ns / 1e9),
+               bytes / (1024.0 * 1024.0) / (elapsed_ns / 1e9), full, sleeps);
+        if (received != threads_n * per_thread) {
+            fprintf(stderr, "ring: %" PRIu64 " inputs read, %zu put\n", received, threads_n * per_thread);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (bell_fd != -1)
+        close(bell_fd);
+    ring_set_destroy(set);
+    return EXIT_SUCCESS;
+}
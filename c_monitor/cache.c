@@ -0,0 +1,153 @@
+#include "cache.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+
+
+#define CACHE_WAYS      8
+#define CACHE_LOCKS     64      // sets are locked in stripes
+
+#define STAT_GET(x)     __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_ADD(x, y)  __atomic_fetch_add(&(x), y, __ATOMIC_RELAXED)
+
+
+typedef struct cache_entry {
+    uint64_t hash;
+    uint64_t stamp;             // of the last use or the insert, 0 when empty
+    trace_result_t result;
+} cache_entry_t;
+
+struct trace_cache_s {
+    cache_entry_t *entries;     // sets of CACHE_WAYS entries
+    size_t sets;                // always a power of two
+    trace_cache_policy_t policy;
+    uint64_t clock;
+    size_t entries_n;
+    pthread_mutex_t locks[CACHE_LOCKS];
+    trace_cache_stats_t stats;
+};
+
+
+static inline uint64_t cache_mix(uint64_t value)
+{
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
+}
+
+
+TraceCache *trace_cache_new(size_t bytes, trace_cache_policy_t policy)
+{
+    TraceCache *cache = malloc(sizeof(TraceCache));
+    if (cache == NULL)
+        return NULL;
+    memset(cache, 0, sizeof(TraceCache));
+
+    // the largest power of two number of sets within the cap
+    cache->sets = 1;
+    while (cache->sets * 2 * CACHE_WAYS * sizeof(cache_entry_t) <= bytes)
+        cache->sets *= 2;
+    cache->entries = calloc(cache->sets * CACHE_WAYS, sizeof(cache_entry_t));
+    if (cache->entries == NULL) {
+        free(cache);
+        return NULL;
+    }
+    cache->policy = policy;
+    cache->stats.capacity = cache->sets * CACHE_WAYS;
+    for (size_t i = 0; i < CACHE_LOCKS; i++)
+        pthread_mutex_init(&cache->locks[i], NULL);
+    return cache;
+}
+
+
+void trace_cache_destroy(TraceCache *cache)
+{
+    for (size_t i = 0; i < CACHE_LOCKS; i++)
+        pthread_mutex_destroy(&cache->locks[i]);
+    free(cache->entries);
+    free(cache);
+}
+
+
+static inline size_t cache_set(TraceCache *cache, uint64_t hash)
+{
+    return cache_mix(hash) & (cache->sets - 1);
+}
+
+
+bool trace_cache_get(TraceCache *cache, uint64_t hash, trace_result_t *result)
+{
+    const size_t set = cache_set(cache, hash);
+    cache_entry_t *entries = &cache->entries[set * CACHE_WAYS];
+    bool found = false;
+
+    STAT_ADD(cache->stats.lookups, 1);
+    pthread_mutex_lock(&cache->locks[set % CACHE_LOCKS]);
+    for (size_t i = 0; i < CACHE_WAYS; i++) {
+        if (entries[i].stamp == 0 || entries[i].hash != hash)
+            continue;
+        if (cache->policy == TRACE_CACHE_LRU)
+            entries[i].stamp = __atomic_add_fetch(&cache->clock, 1, __ATOMIC_RELAXED);
+        *result = entries[i].result;
+        found = true;
+        break;
+    }
+    pthread_mutex_unlock(&cache->locks[set % CACHE_LOCKS]);
+
+    if (found)
+        STAT_ADD(cache->stats.hits, 1);
+    return found;
+}
+
+
+void trace_cache_put(TraceCache *cache, uint64_t hash, const trace_result_t *result)
+{
+    const size_t set = cache_set(cache, hash);
+    cache_entry_t *entries = &cache->entries[set * CACHE_WAYS];
+
+    pthread_mutex_lock(&cache->locks[set % CACHE_LOCKS]);
+    // the entry of the same input, else an empty one, else the oldest
+    cache_entry_t *victim = &entries[0];
+    for (size_t i = 0; i < CACHE_WAYS; i++) {
+        if (entries[i].stamp != 0 && entries[i].hash == hash) {
+            victim = &entries[i];
+            break;
+        }
+        if (entries[i].stamp < victim->stamp)
+            victim = &entries[i];
+    }
+
+    if (victim->stamp == 0) {
+        STAT_ADD(cache->entries_n, 1);
+    } else if (victim->hash != hash) {
+        STAT_ADD(cache->stats.evictions, 1);
+    } else if (victim->result.fingerprint != result->fingerprint) {
+        STAT_ADD(cache->stats.unstable, 1);
+    }
+    victim->hash = hash;
+    victim->result = *result;
+    victim->stamp = __atomic_add_fetch(&cache->clock, 1, __ATOMIC_RELAXED);
+    pthread_mutex_unlock(&cache->locks[set % CACHE_LOCKS]);
+}
+
+
+void trace_cache_stats(TraceCache *cache, trace_cache_stats_t *stats)
+{
+    stats->lookups = STAT_GET(cache->stats.lookups);
+    stats->hits = STAT_GET(cache->stats.hits);
+    stats->evictions = STAT_GET(cache->stats.evictions);
+    stats->unstable = STAT_GET(cache->stats.unstable);
+    stats->entries = STAT_GET(cache->entries_n);
+    stats->capacity = cache->stats.capacity;
+}
+
+
+// adds an edge to a fingerprint, in any order
+uint64_t trace_fingerprint(uint64_t fingerprint, uint64_t from, uint64_t to)
+{
+    return fingerprint + cache_mix(cache_mix(from) ^ to);
+}
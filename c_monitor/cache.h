@@ -0,0 +1,44 @@
+#ifndef _H_CACHE_
+#define _H_CACHE_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+
+/*
+ * What tracing an input gave, by input hash, so that an input traced
+ * before is not run again. Set associative within a fixed memory cap;
+ * a full set evicts its least recently used entry, or its oldest one.
+ * Workers insert while the dispatcher looks up.
+ */
+typedef struct trace_cache_s TraceCache;
+
+typedef enum trace_cache_policy {
+    TRACE_CACHE_LRU = 0,
+    TRACE_CACHE_FIFO,
+} trace_cache_policy_t;
+
+typedef struct trace_result {
+    uint64_t fingerprint;       // of the set of edges, not their hits
+    uint32_t edges_n;
+    uint32_t depth;
+} trace_result_t;
+
+typedef struct trace_cache_stats {
+    uint64_t lookups;
+    uint64_t hits;
+    uint64_t evictions;
+    uint64_t unstable;          // inputs that traced to another edge set
+    size_t entries;
+    size_t capacity;
+} trace_cache_stats_t;
+
+TraceCache *trace_cache_new(size_t bytes, trace_cache_policy_t policy);
+void     trace_cache_destroy(TraceCache *cache);
+bool     trace_cache_get(TraceCache *cache, uint64_t hash, trace_result_t *result);
+void     trace_cache_put(TraceCache *cache, uint64_t hash, const trace_result_t *result);
+void     trace_cache_stats(TraceCache *cache, trace_cache_stats_t *stats);
+uint64_t trace_fingerprint(uint64_t fingerprint, uint64_t from, uint64_t to);
+
+#endif
@@ -0,0 +1,252 @@
+#define _GNU_SOURCE
+#include "corpus.h"
+#include <perf/log.h>
+#include <hashtable.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/limits.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define CORPUS_EVENTS_SZ    (64 * 1024)     // inotify events taken per read
+#define CORPUS_NAMES_MIN    64
+#define CORPUS_PREFETCH     8               // files mapped ahead of the one dispatched
+
+
+struct corpus_s {
+    char *path;
+    int inotify_fd;
+    int wd;
+    size_t input_max;           // longer files are cut here
+    char *events;
+    char **names;               // FIFO of names not loaded yet, a ring
+    size_t names_head;
+    size_t names_n;
+    size_t names_cap;           // always a power of two
+    HashTable *queued;          // names in the FIFO
+    corpus_file_t ahead[CORPUS_PREFETCH];   // loaded, a ring too
+    size_t ahead_head;
+    size_t ahead_n;
+};
+
+
+Corpus *corpus_new(const char *path, int inotify_fd, int wd, size_t input_max)
+{
+    Corpus *corpus = malloc(sizeof(Corpus));
+    if (corpus == NULL)
+        return NULL;
+    memset(corpus, 0, sizeof(Corpus));
+
+    corpus->path = strdup(path);
+    corpus->inotify_fd = inotify_fd;
+    corpus->wd = wd;
+    corpus->input_max = input_max;
+    corpus->events = aligned_alloc(__alignof__(struct inotify_event), CORPUS_EVENTS_SZ);
+    corpus->names_cap = CORPUS_NAMES_MIN;
+    corpus->names = malloc(corpus->names_cap * sizeof(char *));
+    if (corpus->path == NULL || corpus->events == NULL || corpus->names == NULL
+        || hashtable_new(&corpus->queued) != CC_OK) {
+        free(corpus->path);
+        free(corpus->events);
+        free(corpus->names);
+        free(corpus);
+        return NULL;
+    }
+    return corpus;
+}
+
+
+void corpus_destroy(Corpus *corpus)
+{
+    while (corpus->ahead_n > 0) {
+        corpus_file_release(&corpus->ahead[corpus->ahead_head]);
+        corpus->ahead_head = (corpus->ahead_head + 1) % CORPUS_PREFETCH;
+        corpus->ahead_n--;
+    }
+    for (size_t i = 0; i < corpus->names_n; i++)
+        free(corpus->names[(corpus->names_head + i) & (corpus->names_cap - 1)]);
+    hashtable_destroy(corpus->queued);
+    free(corpus->names);
+    free(corpus->events);
+    free(corpus->path);
+    free(corpus);
+}
+
+
+// queues a file of the corpus directory, unless it is queued already
+void corpus_add(Corpus *corpus, const char *name)
+{
+    if (hashtable_contains_key(corpus->queued, (void *) name))
+        return;
+
+    if (corpus->names_n == corpus->names_cap) {
+        const size_t names_cap = corpus->names_cap * 2;
+        char **names = malloc(names_cap * sizeof(char *));
+        assert(names != NULL);
+        for (size_t i = 0; i < corpus->names_n; i++)
+            names[i] = corpus->names[(corpus->names_head + i) & (corpus->names_cap - 1)];
+        free(corpus->names);
+        corpus->names = names;
+        corpus->names_cap = names_cap;
+        corpus->names_head = 0;
+    }
+
+    char *queued = strdup(name);
+    assert(queued != NULL);
+    corpus->names[(corpus->names_head + corpus->names_n++) & (corpus->names_cap - 1)] = queued;
+    assert(hashtable_add(corpus->queued, queued, queued) == CC_OK);
+}
+
+
+// skips what fuzzers keep next to the corpus, .state, .cur_input and the like
+static int corpus_scan_filter(const struct dirent *entry)
+{
+    return entry->d_name[0] != '.' && (entry->d_type == DT_REG || entry->d_type == DT_UNKNOWN);
+}
+
+
+// queues the files already in the directory, in name order (for AFL that
+// is the order they were found in); returns how many or -1
+int corpus_scan(Corpus *corpus)
+{
+    struct dirent **entries;
+    int n = scandir(corpus->path, &entries, corpus_scan_filter, alphasort);
+    if (n == -1) {
+        PLOG_F("failed to scan %s", corpus->path);
+        return -1;
+    }
+    for (int i = 0; i < n; i++) {
+        corpus_add(corpus, entries[i]->d_name);
+        free(entries[i]);
+    }
+    free(entries);
+    return n;
+}
+
+
+// queues everything inotify has, returns how many events were read or -1
+// once the directory is gone
+int corpus_poll(Corpus *corpus)
+{
+    int events_n = 0;
+    for (;;) {
+        ssize_t len = read(corpus->inotify_fd, corpus->events, CORPUS_EVENTS_SZ);
+        if (len == -1) {
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                return events_n;
+            if (errno == EINTR)
+                continue;
+            PLOG_F("failed reading inotify events");
+            return -1;
+        }
+
+        for (char *p = corpus->events; p < corpus->events + len; ) {
+            const struct inotify_event *in_event = (const struct inotify_event *) p;
+            p += sizeof(struct inotify_event) + in_event->len;
+            events_n++;
+
+            if (in_event->mask & IN_Q_OVERFLOW) {
+                LOG_W("inotify queue overflow, corpus files were missed");
+                continue;
+            }
+            if (in_event->wd != corpus->wd)
+                continue;
+            if (in_event->mask & IN_DELETE_SELF) {
+                LOG_E("corpus directory %s deleted", corpus->path);
+                return -1;
+            }
+            if (in_event->len == 0) {
+                LOG_W("inotify event name len is zero (%" PRIx32 ")", in_event->mask);
+                continue;
+            }
+            corpus_add(corpus, in_event->name);
+        }
+    }
+}
+
+
+static bool corpus_load(Corpus *corpus, char *name, corpus_file_t *file)
+{
+    char file_path[PATH_MAX];
+    snprintf(file_path, PATH_MAX, "%s/%s", corpus->path, name);
+    file->name = name;
+    file->data = NULL;
+    file->size = 0;
+
+    int fd = open(file_path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        PLOG_W("failed to open %s", file_path);
+        if (fd != -1)
+            close(fd);
+        return false;
+    }
+
+    file->size = st.st_size;
+    if (file->size > corpus->input_max) {
+        LOG_W("%s is %zu bytes, only the first %zu are traced", file_path, file->size, corpus->input_max);
+        file->size = corpus->input_max;
+    }
+    if (file->size > 0) {
+        file->data = mmap(NULL, file->size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (file->data == MAP_FAILED) {
+            PLOG_W("failed mmap %s, sz=%zu", file_path, file->size);
+            file->data = NULL;
+            close(fd);
+            return false;
+        }
+        // read in the background, by the time it is dispatched it's there
+        madvise(file->data, file->size, MADV_WILLNEED);
+    }
+    close(fd);
+    return true;
+}
+
+
+// hands out the oldest queued file that could be loaded, release it after use
+bool corpus_next(Corpus *corpus, corpus_file_t *file)
+{
+    while (corpus->names_n > 0 && corpus->ahead_n < CORPUS_PREFETCH) {
+        char *name = corpus->names[corpus->names_head];
+        corpus->names_head = (corpus->names_head + 1) & (corpus->names_cap - 1);
+        corpus->names_n--;
+        hashtable_remove(corpus->queued, name, NULL);
+
+        corpus_file_t *ahead = &corpus->ahead[(corpus->ahead_head + corpus->ahead_n) % CORPUS_PREFETCH];
+        if (corpus_load(corpus, name, ahead)) {
+            corpus->ahead_n++;
+        } else {
+            free(name);
+        }
+    }
+
+    if (corpus->ahead_n == 0)
+        return false;
+    *file = corpus->ahead[corpus->ahead_head];
+    corpus->ahead_head = (corpus->ahead_head + 1) % CORPUS_PREFETCH;
+    corpus->ahead_n--;
+    return true;
+}
+
+
+void corpus_file_release(corpus_file_t *file)
+{
+    if (file->data != NULL)
+        munmap(file->data, file->size);
+    free(file->name);
+    file->data = NULL;
+    file->name = NULL;
+}
+
+
+size_t corpus_pending(Corpus *corpus)
+{
+    return corpus->names_n + corpus->ahead_n;
+}
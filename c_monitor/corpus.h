@@ -0,0 +1,32 @@
+#ifndef _H_CORPUS_
+#define _H_CORPUS_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+
+/*
+ * Files landing in the corpus directory, in the order they were written.
+ * Names are queued from inotify in bulk, a name queued twice is loaded
+ * once, and the next few files are mapped ahead so that their pages are
+ * read in while the current one is dispatched.
+ */
+typedef struct corpus_s Corpus;
+
+typedef struct corpus_file {
+    char *name;
+    uint8_t *data;              // mapped read-only, NULL when empty
+    size_t size;
+} corpus_file_t;
+
+Corpus *corpus_new(const char *path, int inotify_fd, int wd, size_t input_max);
+void    corpus_destroy(Corpus *corpus);
+int     corpus_poll(Corpus *corpus);
+int     corpus_scan(Corpus *corpus);
+void    corpus_add(Corpus *corpus, const char *name);
+bool    corpus_next(Corpus *corpus, corpus_file_t *file);
+void    corpus_file_release(corpus_file_t *file);
+size_t  corpus_pending(Corpus *corpus);
+
+#endif
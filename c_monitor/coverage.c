@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include "coverage.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
+
+
+#define COVERAGE_SHARDS_BITS    6
+#define COVERAGE_SHARDS         (1 << COVERAGE_SHARDS_BITS)
+#define COVERAGE_MIN_CAP        64
+
+// the hits word of a slot carries its state in the top bits
+#define SLOT_FROZEN             (1ULL << 63)    // shard grew, look in the new table
+#define SLOT_READY              (1ULL << 62)    // from and to are valid
+#define SLOT_BUSY               (1ULL << 61)    // claimed, from and to being written
+#define SLOT_HITS(h)            ((h) & (SLOT_BUSY - 1))
+
+#define ATOMIC_GET(x)           __atomic_load_n(&(x), __ATOMIC_ACQUIRE)
+#define ATOMIC_SET(x, y)        __atomic_store_n(&(x), y, __ATOMIC_RELEASE)
+
+
+typedef struct coverage_slot {
+    uint64_t from;
+    uint64_t to;
+    uint64_t hits;
+} coverage_slot_t;
+
+typedef struct coverage_table {
+    coverage_slot_t *slots;
+    size_t capacity;                // always a power of two
+    size_t size;
+    struct coverage_table *retired; // older tables, lock-free readers may still be in them
+} coverage_table_t;
+
+typedef struct coverage_shard {
+    coverage_table_t *table;
+    pthread_mutex_t grow_lock;
+    char pad[64];                   // keeps shards off each other's cache lines
+} coverage_shard_t;
+
+struct coverage_map_s {
+    coverage_shard_t shards[COVERAGE_SHARDS];
+};
+
+
+static inline uint64_t coverage_hash(uint64_t from, uint64_t to)
+{
+    // same mix as the EdgeMap
+    uint64_t h = from ^ (to * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static coverage_table_t *coverage_table_new(size_t capacity)
+{
+    coverage_table_t *table = malloc(sizeof(coverage_table_t));
+    assert(table != NULL);
+    table->slots = calloc(capacity, sizeof(coverage_slot_t));
+    assert(table->slots != NULL);
+    table->capacity = capacity;
+    table->size = 0;
+    table->retired = NULL;
+    return table;
+}
+
+
+// waits for the table that replaced a frozen one
+static void coverage_wait_grown(coverage_shard_t *shard, coverage_table_t *table)
+{
+    while (ATOMIC_GET(shard->table) == table)
+        sched_yield();
+}
+
+
+static void coverage_shard_grow(coverage_shard_t *shard, coverage_table_t *table)
+{
+    pthread_mutex_lock(&shard->grow_lock);
+    if (ATOMIC_GET(shard->table) != table) {
+        pthread_mutex_unlock(&shard->grow_lock);
+        return;
+    }
+
+    coverage_table_t *grown = coverage_table_new(table->capacity * 2);
+    const size_t mask = grown->capacity - 1;
+    for (size_t i = 0; i < table->capacity; i++) {
+        coverage_slot_t *slot = &table->slots[i];
+
+        // freezing is atomic with respect to every hit, so none is lost: an
+        // increment either lands before (and is copied) or sees the flag
+        uint64_t h = ATOMIC_GET(slot->hits);
+        for (;;) {
+            if (h == SLOT_BUSY) {
+                sched_yield();
+                h = ATOMIC_GET(slot->hits);
+                continue;
+            }
+            if (__atomic_compare_exchange_n(&slot->hits, &h, h | SLOT_FROZEN, false,
+                                            __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                break;
+        }
+        if (!(h & SLOT_READY))
+            continue;
+
+        size_t j = coverage_hash(slot->from, slot->to) & mask;
+        while (grown->slots[j].hits != 0)
+            j = (j + 1) & mask;
+        grown->slots[j] = (coverage_slot_t) { slot->from, slot->to, h };
+        grown->size++;
+    }
+
+    grown->retired = table;
+    ATOMIC_SET(shard->table, grown);
+    pthread_mutex_unlock(&shard->grow_lock);
+}
+
+
+CoverageMap *coverage_map_new(size_t capacity)
+{
+    CoverageMap *map = malloc(sizeof(CoverageMap));
+    if (map == NULL)
+        return NULL;
+
+    size_t shard_capacity = COVERAGE_MIN_CAP;
+    while (shard_capacity * COVERAGE_SHARDS < capacity)
+        shard_capacity *= 2;
+
+    for (size_t i = 0; i < COVERAGE_SHARDS; i++) {
+        map->shards[i].table = coverage_table_new(shard_capacity);
+        pthread_mutex_init(&map->shards[i].grow_lock, NULL);
+    }
+    return map;
+}
+
+
+// a map that starts out with edges, distinct as a snapshot has them: each
+// shard is sized once for its share and filled with plain stores, nobody
+// else sees the map before it is returned
+CoverageMap *coverage_map_load(size_t capacity, const edge_t *edges, size_t edges_n)
+{
+    CoverageMap *map = coverage_map_new(capacity);
+    if (map == NULL)
+        return NULL;
+
+    size_t counts[COVERAGE_SHARDS] = { 0 };
+    for (size_t i = 0; i < edges_n; i++)
+        counts[coverage_hash(edges[i].from, edges[i].to) >> (64 - COVERAGE_SHARDS_BITS)]++;
+    for (size_t s = 0; s < COVERAGE_SHARDS; s++) {
+        coverage_table_t *table = map->shards[s].table;
+        size_t shard_capacity = table->capacity;
+        while (counts[s] * 2 > shard_capacity)
+            shard_capacity *= 2;
+        if (shard_capacity != table->capacity) {
+            free(table->slots);
+            free(table);
+            map->shards[s].table = coverage_table_new(shard_capacity);
+        }
+    }
+
+    for (size_t i = 0; i < edges_n; i++) {
+        const edge_t *edge = &edges[i];
+        const uint64_t hash = coverage_hash(edge->from, edge->to);
+        coverage_table_t *table = map->shards[hash >> (64 - COVERAGE_SHARDS_BITS)].table;
+        const size_t mask = table->capacity - 1;
+        size_t j = hash & mask;
+        while (table->slots[j].hits != 0
+               && (table->slots[j].from != edge->from || table->slots[j].to != edge->to))
+            j = (j + 1) & mask;
+
+        coverage_slot_t *slot = &table->slots[j];
+        if (slot->hits == 0) {
+            slot->from = edge->from;
+            slot->to = edge->to;
+            slot->hits = SLOT_READY;
+            table->size++;
+        }
+        slot->hits += SLOT_HITS(edge->hits);
+    }
+    return map;
+}
+
+
+void coverage_map_destroy(CoverageMap *map)
+{
+    for (size_t i = 0; i < COVERAGE_SHARDS; i++) {
+        coverage_table_t *table = map->shards[i].table;
+        while (table != NULL) {
+            coverage_table_t *retired = table->retired;
+            free(table->slots);
+            free(table);
+            table = retired;
+        }
+        pthread_mutex_destroy(&map->shards[i].grow_lock);
+    }
+    free(map);
+}
+
+
+// counts hits on from -> to, returns true for exactly one caller: the one
+// that inserted the edge
+bool coverage_map_hit(CoverageMap *map, uint64_t from, uint64_t to, uint64_t hits)
+{
+    const uint64_t hash = coverage_hash(from, to);
+    coverage_shard_t *shard = &map->shards[hash >> (64 - COVERAGE_SHARDS_BITS)];
+
+retry:;
+    coverage_table_t *table = ATOMIC_GET(shard->table);
+    const size_t mask = table->capacity - 1;
+    size_t i = hash & mask;
+
+    for (size_t probes = 0; probes < table->capacity; ) {
+        coverage_slot_t *slot = &table->slots[i];
+        uint64_t h = ATOMIC_GET(slot->hits);
+
+        if (h == 0) {
+            // on failure somebody else claimed or froze it, look again
+            if (!__atomic_compare_exchange_n(&slot->hits, &h, SLOT_BUSY, false,
+                                             __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+                continue;
+            slot->from = from;
+            slot->to = to;
+            ATOMIC_SET(slot->hits, SLOT_READY | hits);
+
+            // grow at half load, probe sequences stay short
+            const size_t size = __atomic_add_fetch(&table->size, 1, __ATOMIC_RELAXED);
+            if (size * 2 > table->capacity)
+                coverage_shard_grow(shard, table);
+            return true;
+        }
+
+        while (h == SLOT_BUSY) {
+            sched_yield();
+            h = ATOMIC_GET(slot->hits);
+        }
+        if (h & SLOT_FROZEN) {
+            coverage_wait_grown(shard, table);
+            goto retry;
+        }
+        if (slot->from != from || slot->to != to) {
+            i = (i + 1) & mask;
+            probes++;
+            continue;
+        }
+
+        if (__atomic_fetch_add(&slot->hits, hits, __ATOMIC_ACQ_REL) & SLOT_FROZEN) {
+            // frozen before our increment, which the new table never saw
+            coverage_wait_grown(shard, table);
+            goto retry;
+        }
+        return false;
+    }
+
+    // every slot taken by concurrent inserts before anyone could grow
+    coverage_shard_grow(shard, table);
+    goto retry;
+}
+
+
+typedef struct coverage_merge {
+    CoverageMap *map;
+    uint64_t new_edges;
+    void *data;
+    void (*fresh)(const edge_t *, void *);
+} coverage_merge_t;
+
+
+static void coverage_merge_edge(const edge_t *edge, void *data)
+{
+    coverage_merge_t *merge = (coverage_merge_t *) data;
+    if (coverage_map_hit(merge->map, edge->from, edge->to, edge->hits)) {
+        merge->new_edges++;
+        if (merge->fresh != NULL)
+            merge->fresh(edge, merge->data);
+    }
+}
+
+
+// adds every edge of a worker-local map, returns how many were new; fresh,
+// unless NULL, gets each of those
+uint64_t coverage_map_merge(CoverageMap *map, EdgeMap *delta,
+                            void *data, void (*fresh)(const edge_t *, void *))
+{
+    coverage_merge_t merge = { map, 0, data, fresh };
+    edge_map_foreach(delta, &merge, coverage_merge_edge);
+    return merge.new_edges;
+}
+
+
+size_t coverage_map_size(CoverageMap *map)
+{
+    size_t size = 0;
+    for (size_t i = 0; i < COVERAGE_SHARDS; i++)
+        size += __atomic_load_n(&ATOMIC_GET(map->shards[i].table)->size, __ATOMIC_RELAXED);
+    return size;
+}
+
+
+// concurrent hits may or may not be seen; a shard growing meanwhile is
+// walked as it was before (tables are only freed on destroy)
+void coverage_map_foreach(CoverageMap *map, void *data, void (*fn)(const edge_t *, void *))
+{
+    for (size_t i = 0; i < COVERAGE_SHARDS; i++) {
+        const coverage_table_t *table = ATOMIC_GET(map->shards[i].table);
+        for (size_t j = 0; j < table->capacity; j++) {
+            const coverage_slot_t *slot = &table->slots[j];
+            const uint64_t h = ATOMIC_GET(slot->hits);
+            if (!(h & SLOT_READY))
+                continue;
+            edge_t edge = { slot->from, slot->to, SLOT_HITS(h) };
+            fn(&edge, data);
+        }
+    }
+}
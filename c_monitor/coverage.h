@@ -0,0 +1,27 @@
+#ifndef _H_COVERAGE_
+#define _H_COVERAGE_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+#include "edges.h"
+
+
+/*
+ * Edge coverage shared by every worker. Edges are sharded by hash; hits on
+ * known edges and first-seen inserts are lock-free, only growing a shard
+ * takes its lock (and briefly holds up whoever touches that shard).
+ */
+typedef struct coverage_map_s CoverageMap;
+
+CoverageMap *coverage_map_new(size_t capacity);
+CoverageMap *coverage_map_load(size_t capacity, const edge_t *edges, size_t edges_n);
+void     coverage_map_destroy(CoverageMap *map);
+bool     coverage_map_hit(CoverageMap *map, uint64_t from, uint64_t to, uint64_t hits);
+uint64_t coverage_map_merge(CoverageMap *map, EdgeMap *delta,
+                            void *data, void (*fresh)(const edge_t *, void *));
+size_t   coverage_map_size(CoverageMap *map);
+void     coverage_map_foreach(CoverageMap *map, void *data, void (*fn)(const edge_t *, void *));
+
+#endif
@@ -0,0 +1,59 @@
+#define _GNU_SOURCE
+#include "credits.h"
+#include <perf/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+
+// a fresh object, preloads still mapping the last one see it go stale
+credits_t *credits_create(uint64_t window)
+{
+    shm_unlink(CREDITS_SHM);
+    int fd = shm_open(CREDITS_SHM, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        PLOG_W("failed to create %s", CREDITS_SHM);
+        return NULL;
+    }
+    if (ftruncate(fd, sizeof(credits_t)) == -1) {
+        PLOG_W("failed to size %s", CREDITS_SHM);
+        close(fd);
+        shm_unlink(CREDITS_SHM);
+        return NULL;
+    }
+    credits_t *credits = mmap(NULL, sizeof(credits_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (credits == MAP_FAILED) {
+        PLOG_W("failed mmap %s", CREDITS_SHM);
+        shm_unlink(CREDITS_SHM);
+        return NULL;
+    }
+
+    credits->granted = window;
+    credits->taken = 0;
+    credits->alive_ms = 0;
+    __atomic_store_n(&credits->magic, CREDITS_MAGIC, __ATOMIC_RELEASE);
+    return credits;
+}
+
+
+void credits_grant(credits_t *credits, uint64_t n)
+{
+    __atomic_fetch_add(&credits->granted, n, __ATOMIC_RELEASE);
+}
+
+
+void credits_alive(credits_t *credits, uint64_t now_ms)
+{
+    __atomic_store_n(&credits->alive_ms, now_ms, __ATOMIC_RELAXED);
+}
+
+
+void credits_destroy(credits_t *credits)
+{
+    __atomic_store_n(&credits->alive_ms, 0, __ATOMIC_RELAXED);
+    munmap(credits, sizeof(credits_t));
+    shm_unlink(CREDITS_SHM);
+}
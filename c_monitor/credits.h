@@ -0,0 +1,35 @@
+#ifndef _H_CREDITS_
+#define _H_CREDITS_
+
+#include <inttypes.h>
+
+/*
+ * Flow control between the monitor and the fuzzer preloads, over a shared
+ * memory object the monitor creates (and recreates on every start):
+ *
+ *   monitor  granted += 1 for every fuzzer input it is done with, starting
+ *            from a window that keeps every worker busy
+ *   preload  taken += 1 for every input it sends, only while taken < granted
+ *
+ * So the preloads send as much as the monitor can trace and never wait
+ * for it. A preload that sees alive_ms go stale drops the mapping and
+ * samples at a fixed rate until a monitor is back.
+ */
+
+#define CREDITS_SHM         "/fuzz-monitor.credits"
+#define CREDITS_MAGIC       0x7374696465726366ULL   // "fcredits"
+#define CREDITS_STALE_MS    1000
+
+typedef struct credits {
+    uint64_t magic;
+    uint64_t alive_ms;          // CLOCK_MONOTONIC, 0 once the monitor is gone
+    uint64_t granted __attribute__((aligned(64)));
+    uint64_t taken __attribute__((aligned(64)));
+} credits_t;
+
+credits_t *credits_create(uint64_t window);
+void       credits_grant(credits_t *credits, uint64_t n);
+void       credits_alive(credits_t *credits, uint64_t now_ms);
+void       credits_destroy(credits_t *credits);
+
+#endif
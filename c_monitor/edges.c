@@ -0,0 +1,137 @@
+#include "edges.h"
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define EDGE_MAP_MIN_CAP    1024
+// grow when more than 7/10 of the slots are taken
+#define EDGE_MAP_FULL(m)    ((m)->size * 10 >= (m)->capacity * 7)
+
+
+struct edge_map_s {
+    edge_t *slots;
+    size_t capacity;    // always a power of two
+    size_t size;
+};
+
+
+static inline uint64_t edge_hash(uint64_t from, uint64_t to)
+{
+    // murmur3 finalizer over both addresses
+    uint64_t h = from ^ (to * 0x9e3779b97f4a7c15ULL);
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+
+static inline edge_t *edge_map_slot(edge_t *slots, size_t capacity, uint64_t from, uint64_t to)
+{
+    const size_t mask = capacity - 1;
+    size_t i = edge_hash(from, to) & mask;
+    while (slots[i].hits != 0 && (slots[i].from != from || slots[i].to != to))
+        i = (i + 1) & mask;
+    return &slots[i];
+}
+
+
+static void edge_map_grow(EdgeMap *map)
+{
+    const size_t capacity = map->capacity * 2;
+    edge_t *slots = calloc(capacity, sizeof(edge_t));
+    assert(slots != NULL);
+
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->slots[i].hits == 0)
+            continue;
+        *edge_map_slot(slots, capacity, map->slots[i].from, map->slots[i].to) = map->slots[i];
+    }
+
+    free(map->slots);
+    map->slots = slots;
+    map->capacity = capacity;
+}
+
+
+EdgeMap *edge_map_new(size_t capacity)
+{
+    EdgeMap *map = malloc(sizeof(EdgeMap));
+    if (map == NULL)
+        return NULL;
+
+    map->capacity = EDGE_MAP_MIN_CAP;
+    while (map->capacity < capacity)
+        map->capacity *= 2;
+    map->size = 0;
+    map->slots = calloc(map->capacity, sizeof(edge_t));
+    if (map->slots == NULL) {
+        free(map);
+        return NULL;
+    }
+    return map;
+}
+
+
+void edge_map_destroy(EdgeMap *map)
+{
+    free(map->slots);
+    free(map);
+}
+
+
+void edge_map_clear(EdgeMap *map)
+{
+    if (map->size == 0)
+        return;
+    memset(map->slots, 0, map->capacity * sizeof(edge_t));
+    map->size = 0;
+}
+
+
+// counts a hit on from -> to, returns true the first time the edge is seen
+bool edge_map_hit(EdgeMap *map, uint64_t from, uint64_t to)
+{
+    return edge_map_add(map, from, to, 1);
+}
+
+
+// counts hits (> 0) on from -> to at once, e.g. when merging another map
+bool edge_map_add(EdgeMap *map, uint64_t from, uint64_t to, uint64_t hits)
+{
+    edge_t *slot = edge_map_slot(map->slots, map->capacity, from, to);
+    if (slot->hits != 0) {
+        slot->hits += hits;
+        return false;
+    }
+
+    *slot = (edge_t) { from, to, hits };
+    map->size++;
+    if (EDGE_MAP_FULL(map))
+        edge_map_grow(map);
+    return true;
+}
+
+
+uint64_t edge_map_get(EdgeMap *map, uint64_t from, uint64_t to)
+{
+    return edge_map_slot(map->slots, map->capacity, from, to)->hits;
+}
+
+
+size_t edge_map_size(EdgeMap *map)
+{
+    return map->size;
+}
+
+
+void edge_map_foreach(EdgeMap *map, void *data, void (*fn)(const edge_t *, void *))
+{
+    for (size_t i = 0; i < map->capacity; i++) {
+        if (map->slots[i].hits != 0)
+            fn(&map->slots[i], data);
+    }
+}
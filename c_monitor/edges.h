@@ -0,0 +1,26 @@
+#ifndef _H_EDGES_
+#define _H_EDGES_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <unistd.h>
+
+
+typedef struct edge {
+    uint64_t from;
+    uint64_t to;
+    uint64_t hits;      // 0 marks an empty slot
+} edge_t;
+
+typedef struct edge_map_s EdgeMap;
+
+EdgeMap *edge_map_new(size_t capacity);
+void     edge_map_destroy(EdgeMap *map);
+void     edge_map_clear(EdgeMap *map);
+bool     edge_map_hit(EdgeMap *map, uint64_t from, uint64_t to);
+bool     edge_map_add(EdgeMap *map, uint64_t from, uint64_t to, uint64_t hits);
+uint64_t edge_map_get(EdgeMap *map, uint64_t from, uint64_t to);
+size_t   edge_map_size(EdgeMap *map);
+void     edge_map_foreach(EdgeMap *map, void *data, void (*fn)(const edge_t *, void *));
+
+#endif
@@ -0,0 +1,388 @@
+#define _GNU_SOURCE
+#include "export.h"
+#include <perf/log.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define EXPORT_BUF_SZ       (4 * 1024 * 1024)
+#define EXPORT_GV_BUF_SZ    (1024 * 1024)
+#define EXPORT_PAD(n)       (((n) + 7) & ~(size_t) 7)
+#define EXPORT_SUFFIX       ".fmg"
+
+
+struct export_writer {
+    int fd;
+    char *path;
+    bool async;
+    bool failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    pthread_t thread;
+    bool closing;
+    uint8_t *buf;               // filled by export_write
+    size_t buf_len;
+    uint8_t *out;               // with the writer thread, NULL when it's idle
+    size_t out_len;
+    uint8_t *spare;             // the other buffer while out is NULL
+};
+
+typedef struct export_total {
+    export_writer_t *writer;
+    uint64_t edges_n;
+} export_total_t;
+
+
+static bool export_out(export_writer_t *writer, const uint8_t *data, size_t len)
+{
+    while (len > 0) {
+        ssize_t n = write(writer->fd, data, len);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            PLOG_F("failed writing graph export %s", writer->path);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+
+// keeps writing full buffers while the workers fill the other one
+static void *export_thread(void *data)
+{
+    export_writer_t *writer = (export_writer_t *) data;
+
+    pthread_mutex_lock(&writer->lock);
+    for (;;) {
+        while (writer->out == NULL && !writer->closing)
+            pthread_cond_wait(&writer->cond, &writer->lock);
+        if (writer->out == NULL)
+            break;
+
+        uint8_t *out = writer->out;
+        const size_t out_len = writer->out_len;
+        pthread_mutex_unlock(&writer->lock);
+        const bool ok = export_out(writer, out, out_len);
+        pthread_mutex_lock(&writer->lock);
+
+        writer->failed |= !ok;
+        writer->spare = out;
+        writer->out = NULL;
+        pthread_cond_broadcast(&writer->cond);
+    }
+    pthread_mutex_unlock(&writer->lock);
+    return NULL;
+}
+
+
+// with the lock held, empties buf
+static void export_flush(export_writer_t *writer)
+{
+    if (writer->buf_len == 0)
+        return;
+    if (!writer->async) {
+        writer->failed |= !export_out(writer, writer->buf, writer->buf_len);
+        writer->buf_len = 0;
+        return;
+    }
+
+    while (writer->out != NULL)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    writer->out = writer->buf;
+    writer->out_len = writer->buf_len;
+    writer->buf = writer->spare;
+    writer->buf_len = 0;
+    writer->spare = NULL;
+    pthread_cond_broadcast(&writer->cond);
+}
+
+
+// with the lock held
+static void export_append(export_writer_t *writer, const void *data, size_t len)
+{
+    if (writer->buf_len + len > EXPORT_BUF_SZ)
+        export_flush(writer);
+    if (len <= EXPORT_BUF_SZ) {
+        memcpy(writer->buf + writer->buf_len, data, len);
+        writer->buf_len += len;
+        return;
+    }
+
+    // larger than a buffer, straight to the file once the thread is done
+    while (writer->out != NULL)
+        pthread_cond_wait(&writer->cond, &writer->lock);
+    writer->failed |= !export_out(writer, data, len);
+}
+
+
+static void export_destroy(export_writer_t *writer)
+{
+    if (writer->fd != -1)
+        close(writer->fd);
+    pthread_cond_destroy(&writer->cond);
+    pthread_mutex_destroy(&writer->lock);
+    free(writer->buf);
+    free(writer->spare);
+    free(writer->path);
+    free(writer);
+}
+
+
+export_writer_t *export_create(const char *path, const char *sut, bool async)
+{
+    export_writer_t *writer = malloc(sizeof(export_writer_t));
+    assert(writer != NULL);
+    memset(writer, 0, sizeof(export_writer_t));
+    writer->path = strdup(path);
+    writer->async = async;
+    writer->buf = malloc(EXPORT_BUF_SZ);
+    writer->spare = async ? malloc(EXPORT_BUF_SZ) : NULL;
+    assert(writer->path != NULL && writer->buf != NULL && (!async || writer->spare != NULL));
+    pthread_mutex_init(&writer->lock, NULL);
+    pthread_cond_init(&writer->cond, NULL);
+
+    if ((writer->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644)) == -1) {
+        PLOG_F("failed to create graph export %s", path);
+        export_destroy(writer);
+        return NULL;
+    }
+
+    export_header_t header;
+    memset(&header, 0, sizeof(export_header_t));
+    memcpy(header.magic, EXPORT_MAGIC, sizeof(header.magic));
+    header.version = EXPORT_VERSION;
+    header.edge_size = sizeof(edge_t);
+    header.sut_len = strlen(sut);
+    const uint64_t pad = 0;
+    export_append(writer, &header, sizeof(export_header_t));
+    export_append(writer, sut, header.sut_len);
+    export_append(writer, &pad, EXPORT_PAD(header.sut_len) - header.sut_len);
+
+    if (async) {
+        int err = pthread_create(&writer->thread, NULL, export_thread, writer);
+        if (err != 0) {
+            LOG_F("failed to start graph export thread (%s)", strerror(err));
+            export_destroy(writer);
+            return NULL;
+        }
+    }
+    return writer;
+}
+
+
+// safe from any worker, records are never interleaved
+int export_write(export_writer_t *writer, const export_record_t *record, const edge_t *edges)
+{
+    pthread_mutex_lock(&writer->lock);
+    export_append(writer, record, sizeof(export_record_t));
+    export_append(writer, edges, record->edges_n * sizeof(edge_t));
+    const int ret = writer->failed ? -1 : 0;
+    pthread_mutex_unlock(&writer->lock);
+    return ret;
+}
+
+
+static void export_total_edge(const edge_t *edge, void *data)
+{
+    export_total_t *total = (export_total_t *) data;
+    export_append(total->writer, edge, sizeof(edge_t));
+    total->edges_n++;
+}
+
+
+// an EXPORT_TOTAL record of map, which nothing may hit meanwhile
+int export_coverage(export_writer_t *writer, CoverageMap *map, uint64_t depth)
+{
+    export_record_t record;
+    memset(&record, 0, sizeof(export_record_t));
+    record.edges_n = coverage_map_size(map);
+    record.depth = depth;
+    record.flags = EXPORT_TOTAL;
+
+    export_total_t total = { writer, 0 };
+    pthread_mutex_lock(&writer->lock);
+    export_append(writer, &record, sizeof(export_record_t));
+    coverage_map_foreach(map, &total, export_total_edge);
+    if (total.edges_n != record.edges_n) {
+        LOG_F("coverage changed while exported to %s", writer->path);
+        writer->failed = true;
+    }
+    const int ret = writer->failed ? -1 : 0;
+    pthread_mutex_unlock(&writer->lock);
+    return ret;
+}
+
+
+// writes out what is buffered and frees the writer, -1 if anything was lost
+int export_close(export_writer_t *writer)
+{
+    pthread_mutex_lock(&writer->lock);
+    export_flush(writer);
+    writer->closing = true;
+    pthread_cond_broadcast(&writer->cond);
+    pthread_mutex_unlock(&writer->lock);
+    if (writer->async)
+        pthread_join(writer->thread, NULL);
+
+    int ret = writer->failed ? -1 : 0;
+    if (close(writer->fd) == -1) {
+        PLOG_F("failed writing graph export %s", writer->path);
+        ret = -1;
+    }
+    writer->fd = -1;
+    export_destroy(writer);
+    return ret;
+}
+
+
+static int export_gv_write(const char *gv_path, const export_record_t *record, const edge_t *edges)
+{
+    FILE *file = fopen(gv_path, "w");
+    if (file == NULL) {
+        PLOG_F("failed to open file %s", gv_path);
+        return -1;
+    }
+    setvbuf(file, NULL, _IOFBF, EXPORT_GV_BUF_SZ);
+
+    fprintf(file, "digraph {\n");
+    for (uint64_t i = 0; i < record->edges_n; i++) {
+        fprintf(file, "\t\"0x%" PRIx64 "\" -> \"0x%" PRIx64 "\" [label=\"%" PRIu64 "\"];\n",
+            edges[i].from, edges[i].to, edges[i].hits);
+    }
+    fprintf(file, "}\n");
+    if (fclose(file) != 0) {
+        PLOG_F("failed writing %s", gv_path);
+        return -1;
+    }
+    return 0;
+}
+
+
+typedef struct export_gv_edges {
+    edge_t *edges;
+    uint64_t n;
+    uint64_t max;
+} export_gv_edges_t;
+
+static void export_gv_edge(const edge_t *edge, void *data)
+{
+    export_gv_edges_t *gv = (export_gv_edges_t *) data;
+    if (gv->n < gv->max)
+        gv->edges[gv->n] = *edge;
+    gv->n++;
+}
+
+
+// Graphviz of map straight to gv_path, which nothing may hit meanwhile
+int export_coverage_gv(const char *gv_path, CoverageMap *map, uint64_t depth)
+{
+    export_record_t record;
+    memset(&record, 0, sizeof(export_record_t));
+    record.edges_n = coverage_map_size(map);
+    record.depth = depth;
+    record.flags = EXPORT_TOTAL;
+
+    export_gv_edges_t gv = { malloc((record.edges_n + 1) * sizeof(edge_t)), 0, record.edges_n };
+    if (gv.edges == NULL) {
+        LOG_F("failed to allocate %" PRIu64 " edges for %s", record.edges_n, gv_path);
+        return -1;
+    }
+    coverage_map_foreach(map, &gv, export_gv_edge);
+    int ret = -1;
+    if (gv.n != record.edges_n) {
+        LOG_F("coverage changed while exported to %s", gv_path);
+    } else {
+        ret = export_gv_write(gv_path, &record, gv.edges);
+    }
+    free(gv.edges);
+    return ret;
+}
+
+
+/*
+ * Graphviz of every record of the export at path: name.N.gv per input and
+ * name.gv for the coverage, next to name.fmg. Returns how many graphs.
+ */
+int export_to_gv(const char *path)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        PLOG_F("failed to open graph export %s", path);
+        if (fd != -1)
+            close(fd);
+        return -1;
+    }
+    const size_t map_size = st.st_size;
+    if (map_size < sizeof(export_header_t)) {
+        LOG_F("%s is not a graph export", path);
+        close(fd);
+        return -1;
+    }
+    const uint8_t *map = mmap(NULL, map_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        PLOG_F("failed mmap %s, sz=%zu", path, map_size);
+        return -1;
+    }
+    madvise((void *) map, map_size, MADV_SEQUENTIAL);
+
+    char prefix[PATH_MAX];
+    snprintf(prefix, PATH_MAX, "%s", path);
+    const size_t prefix_len = strlen(prefix);
+    if (prefix_len > strlen(EXPORT_SUFFIX)
+        && strcmp(prefix + prefix_len - strlen(EXPORT_SUFFIX), EXPORT_SUFFIX) == 0)
+        prefix[prefix_len - strlen(EXPORT_SUFFIX)] = '\0';
+
+    int graphs_n = -1;
+    const export_header_t *header = (const export_header_t *) map;
+    size_t off = sizeof(export_header_t) + EXPORT_PAD(header->sut_len);
+    if (memcmp(header->magic, EXPORT_MAGIC, sizeof(header->magic)) != 0) {
+        LOG_F("%s is not a graph export", path);
+        goto out;
+    }
+    if (header->version != EXPORT_VERSION || header->edge_size != sizeof(edge_t)) {
+        LOG_F("%s has unsupported version %" PRIu32 " (edge size %" PRIu32 ")",
+            path, header->version, header->edge_size);
+        goto out;
+    }
+
+    graphs_n = 0;
+    while (off < map_size) {
+        const export_record_t *record = (const export_record_t *) (map + off);
+        if (map_size - off < sizeof(export_record_t)
+            || record->edges_n > (map_size - off - sizeof(export_record_t)) / sizeof(edge_t)) {
+            LOG_F("%s is truncated", path);
+            graphs_n = -1;
+            break;
+        }
+
+        char gv_path[PATH_MAX];
+        if (record->flags & EXPORT_TOTAL)
+            snprintf(gv_path, PATH_MAX, "%s.gv", prefix);
+        else
+            snprintf(gv_path, PATH_MAX, "%s.%" PRIu64 ".gv", prefix, record->input_n);
+        if (export_gv_write(gv_path, record, (const edge_t *) (record + 1)) == -1) {
+            graphs_n = -1;
+            break;
+        }
+        graphs_n++;
+        off += sizeof(export_record_t) + record->edges_n * sizeof(edge_t);
+    }
+
+out:
+    munmap((void *) map, map_size);
+    return graphs_n;
+}
@@ -0,0 +1,54 @@
+#ifndef _H_EXPORT_
+#define _H_EXPORT_
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "edges.h"
+#include "coverage.h"
+
+/*
+ * Binary export of coverage graphs, in place of a Graphviz file per input.
+ * Little endian, as written by the monitor:
+ *
+ *   export_header_t, SUT path (sut_len bytes, padded to 8)
+ *   per record: export_record_t, edges_n * edge_t
+ *
+ * A record per input that found new edges, with the hits of that input
+ * on each edge (only the new edges with EXPORT_DELTA), and EXPORT_TOTAL
+ * records of the whole coverage. export_to_gv() makes Graphviz of them;
+ * export_coverage_gv() writes the coverage as Graphviz right away.
+ */
+
+#define EXPORT_MAGIC    "FMGRAPH\0"
+#define EXPORT_VERSION  1
+
+#define EXPORT_DELTA    0x1     // only the edges the input found
+#define EXPORT_TOTAL    0x2     // all the coverage, hits of every input
+
+typedef struct export_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t edge_size;         // sizeof(edge_t) at export
+    uint32_t sut_len;
+    uint32_t reserved;
+} export_header_t;
+
+typedef struct export_record {
+    uint64_t input_n;
+    uint64_t edges_n;           // edges that follow
+    uint64_t depth;
+    uint32_t flags;
+    uint32_t reserved;
+} export_record_t;
+
+typedef struct export_writer export_writer_t;
+
+export_writer_t *export_create(const char *path, const char *sut, bool async);
+int     export_write(export_writer_t *writer, const export_record_t *record, const edge_t *edges);
+int     export_coverage(export_writer_t *writer, CoverageMap *map, uint64_t depth);
+int     export_close(export_writer_t *writer);
+int     export_coverage_gv(const char *gv_path, CoverageMap *map, uint64_t depth);
+int     export_to_gv(const char *path);
+
+#endif
@@ -1,158 +1,210 @@
 #include "graph.h"
-#include <list.h>
-#include <array.h>
-#include <queue.h>
+#include "edges.h"
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
 
+#define GRAPH_MIN_CAP       256
+#define GRAPH_ADJ_MIN_CAP   4
+#define NODE_NONE           UINT32_MAX
+#define GRAPH_SCRATCH_N     7
+
+
+typedef struct graph_node {
+    uint64_t value;
+    uint32_t *adj;          // indices of the successors
+    uint32_t adj_n;
+    uint32_t adj_cap;
+} graph_node_t;
+
 struct graph_s {
-    Array *nodes;       // array of nodes
-    Array *edges;       // array of adjacency lists; the i-th list contains
-                        // outgoing edges from i-th node in nodes
-    size_t n_nodes;     // number of vertices
+    graph_node_t *nodes;    // in insertion order; entries past n_nodes keep
+                            // their adjacency buffers for reuse after a clear
+    size_t n_nodes;
+    size_t nodes_cap;
+    size_t n_edges;
+    uint32_t *slots;        // node value -> index in nodes, open addressing
+    size_t slots_cap;       // always a power of two
+    EdgeMap *edge_set;      // edges already in the graph
+    uint64_t *succ;         // successors handed out by graph_foreach
+    uint32_t *scratch;      // GRAPH_SCRATCH_N arrays of scratch_cap entries
+    size_t scratch_cap;     // shared by every depth computation
 };
 
 
-enum cc_stat graph_new(Graph **graph)
+static inline uint64_t node_hash(uint64_t value)
 {
-    *graph = malloc(sizeof(Graph));
-    if (*graph == NULL)
-        return CC_ERR_ALLOC;
-    memset(*graph, 0, sizeof(Graph));
-    enum cc_stat ret = array_new(&(*graph)->nodes);
-    if (ret != CC_OK)
-        return ret;
-    return array_new(&(*graph)->edges);
+    value ^= value >> 33;
+    value *= 0xff51afd7ed558ccdULL;
+    value ^= value >> 33;
+    value *= 0xc4ceb9fe1a85ec53ULL;
+    value ^= value >> 33;
+    return value;
 }
 
 
-void graph_destroy(Graph *graph)
+static inline uint32_t *graph_slot(Graph *graph, uint64_t value)
 {
-    array_destroy(graph->nodes);
-    ArrayIter edges_iter;
-    array_iter_init(&edges_iter, graph->edges);
-    List *edges_list = NULL;
-    while (array_iter_next(&edges_iter, (void **) &edges_list) != CC_ITER_END) {
-        list_destroy(edges_list);
-    }
-    array_destroy(graph->edges);
-    free(graph);
+    const size_t mask = graph->slots_cap - 1;
+    size_t i = node_hash(value) & mask;
+    while (graph->slots[i] != NODE_NONE && graph->nodes[graph->slots[i]].value != value)
+        i = (i + 1) & mask;
+    return &graph->slots[i];
 }
 
 
-enum cc_stat graph_add(Graph *graph, uint64_t *from, uint64_t *to)
+static void graph_slots_grow(Graph *graph)
 {
-    enum cc_stat ret;
-    ArrayIter nodes_iter;
-    array_iter_init(&nodes_iter, graph->nodes);
-    uint64_t *value = NULL;
-    while (array_iter_next(&nodes_iter, (void **) &value) != CC_ITER_END) {
-        if (*value != *from)
-            continue;
-        size_t from_node_idx = array_iter_index(&nodes_iter);
-        List *from_nodes_list = NULL;
-        ret = array_get_at(graph->edges, from_node_idx, (void **) &from_nodes_list);
-        if (ret != CC_OK)
-            return ret;
-
-        ListIter edges_iter;
-        list_iter_init(&edges_iter, from_nodes_list);
-        value = NULL;
-        while (list_iter_next(&edges_iter, (void **) &value) != CC_ITER_END) {
-            if (*value == *to)
-                return CC_GRAPH_BOTH_EXIST;
-        }
+    free(graph->slots);
+    graph->slots_cap *= 2;
+    graph->slots = malloc(graph->slots_cap * sizeof(uint32_t));
+    assert(graph->slots != NULL);
+    memset(graph->slots, 0xFF, graph->slots_cap * sizeof(uint32_t));
+    for (size_t i = 0; i < graph->n_nodes; i++)
+        *graph_slot(graph, graph->nodes[i].value) = i;
+}
+
 
-        ret = list_add(from_nodes_list, to);
-        if (ret != CC_OK)
-            return ret;
-        graph->n_nodes++;
-        return CC_GRAPH_FROM_EXISTS;
+static uint32_t graph_node_index(Graph *graph, uint64_t value)
+{
+    uint32_t *slot = graph_slot(graph, value);
+    if (*slot != NODE_NONE)
+        return *slot;
+
+    if (graph->n_nodes == graph->nodes_cap) {
+        const size_t nodes_cap = graph->nodes_cap * 2;
+        graph->nodes = realloc(graph->nodes, nodes_cap * sizeof(graph_node_t));
+        assert(graph->nodes != NULL);
+        memset(graph->nodes + graph->nodes_cap, 0,
+            (nodes_cap - graph->nodes_cap) * sizeof(graph_node_t));
+        graph->nodes_cap = nodes_cap;
     }
 
-    List *new_edge_list;
-    if ((ret = list_new(&new_edge_list)) != CC_OK)
-        return ret;
-    if ((ret = list_add(new_edge_list, to)) != CC_OK)
-        return ret;
-    if ((ret = array_add(graph->nodes, from)) != CC_OK)
-        return ret;
-    graph->n_nodes++;
-    if ((ret = array_add(graph->edges, new_edge_list)) != CC_OK)
-        return ret;
-    graph->n_nodes++;
-    return CC_OK;
-}
-
-
-void graph_foreach(Graph *graph, void *data, void (*fn)(uint64_t *, uint64_t **, size_t, void*))
-{
-    ArrayIter nodes_iter;
-    array_iter_init(&nodes_iter, graph->nodes);
-    uint64_t *node = NULL;
-    while (array_iter_next(&nodes_iter, (void **) &node) != CC_ITER_END) {
-        size_t from_node_idx = array_iter_index(&nodes_iter);
-        List *from_nodes_list = NULL;
-        assert(array_get_at(graph->edges, from_node_idx, (void **) &from_nodes_list) == CC_OK);
-
-        ListIter edges_iter;
-        list_iter_init(&edges_iter, from_nodes_list);
-
-        size_t connections_size = list_size(from_nodes_list);
-        uint64_t **connections = malloc(sizeof(uint64_t **) * connections_size);
-        uint64_t *edge_value = NULL;
-        uint64_t **connections_ptr = connections;
-        while (list_iter_next(&edges_iter, (void **) &edge_value) != CC_ITER_END) {
-            *connections_ptr = edge_value;
-            connections_ptr++;
-        }
+    const uint32_t idx = graph->n_nodes++;
+    graph->nodes[idx].value = value;
+    graph->nodes[idx].adj_n = 0;
+    *slot = idx;
 
-        fn(node, connections, connections_size, data);
-        free(connections);
-    }
+    // keep the load factor at or below 1/2
+    if (graph->n_nodes * 2 > graph->slots_cap)
+        graph_slots_grow(graph);
+    return idx;
 }
 
 
-size_t graph_nodes(Graph *graph)
+// makes sure per-node scratch buffers can hold every node
+static void graph_scratch_reserve(Graph *graph)
 {
-    return graph->n_nodes;
+    if (graph->scratch_cap >= graph->n_nodes)
+        return;
+    graph->scratch_cap = graph->nodes_cap;
+    graph->succ = realloc(graph->succ, graph->scratch_cap * sizeof(uint64_t));
+    graph->scratch = realloc(graph->scratch,
+        GRAPH_SCRATCH_N * graph->scratch_cap * sizeof(uint32_t));
+    assert(graph->succ != NULL && graph->scratch != NULL);
 }
 
 
-size_t graph_edges(Graph *graph)
+static inline uint32_t *graph_scratch(Graph *graph, size_t i)
+{
+    assert(i < GRAPH_SCRATCH_N);
+    return graph->scratch + i * graph->scratch_cap;
+}
+
+
+Graph *graph_new(void)
 {
-    ArrayIter nodes_iter;
-    array_iter_init(&nodes_iter, graph->nodes);
-    uint64_t *node = NULL;
-    size_t counter = 0;
-    while (array_iter_next(&nodes_iter, (void **) &node) != CC_ITER_END) {
-        size_t from_node_idx = array_iter_index(&nodes_iter);
-        List *from_nodes_list = NULL;
-        assert(array_get_at(graph->edges, from_node_idx, (void **) &from_nodes_list) == CC_OK);
-        counter += list_size(from_nodes_list);
+    Graph *graph = malloc(sizeof(Graph));
+    if (graph == NULL)
+        return NULL;
+    memset(graph, 0, sizeof(Graph));
+
+    graph->nodes_cap = GRAPH_MIN_CAP;
+    graph->nodes = calloc(graph->nodes_cap, sizeof(graph_node_t));
+    graph->slots_cap = GRAPH_MIN_CAP * 2;
+    graph->slots = malloc(graph->slots_cap * sizeof(uint32_t));
+    graph->edge_set = edge_map_new(GRAPH_MIN_CAP);
+    if (graph->nodes == NULL || graph->slots == NULL || graph->edge_set == NULL) {
+        free(graph->nodes);
+        free(graph->slots);
+        if (graph->edge_set != NULL)
+            edge_map_destroy(graph->edge_set);
+        free(graph);
+        return NULL;
     }
-    return counter;
+    memset(graph->slots, 0xFF, graph->slots_cap * sizeof(uint32_t));
+    return graph;
 }
 
 
-typedef struct bfs_queue_elm {
-    size_t depth;
-    size_t index;
-} bfs_queue_elm_t;
+void graph_destroy(Graph *graph)
+{
+    for (size_t i = 0; i < graph->nodes_cap; i++)
+        free(graph->nodes[i].adj);
+    free(graph->nodes);
+    free(graph->slots);
+    edge_map_destroy(graph->edge_set);
+    free(graph->succ);
+    free(graph->scratch);
+    free(graph);
+}
+
 
+void graph_clear(Graph *graph)
+{
+    if (graph->n_nodes == 0)
+        return;
+    memset(graph->slots, 0xFF, graph->slots_cap * sizeof(uint32_t));
+    edge_map_clear(graph->edge_set);
+    graph->n_nodes = 0;
+    graph->n_edges = 0;
+}
 
 
-ssize_t graph_find_node_index(Graph *graph, uint64_t value)
+// adds from -> to, returns false if the edge was already there
+bool graph_add(Graph *graph, uint64_t from, uint64_t to)
 {
-  ArrayIter nodes_iter;
-  array_iter_init(&nodes_iter, graph->nodes);
-  uint64_t *node = NULL;
-  while (array_iter_next(&nodes_iter, (void **) &node) != CC_ITER_END) {
-    if (*node == value) {
-      return array_iter_index(&nodes_iter);
+    if (!edge_map_hit(graph->edge_set, from, to))
+        return false;
+
+    const uint32_t from_idx = graph_node_index(graph, from);
+    const uint32_t to_idx = graph_node_index(graph, to);
+    graph_node_t *node = &graph->nodes[from_idx];
+    if (node->adj_n == node->adj_cap) {
+        node->adj_cap = node->adj_cap ? node->adj_cap * 2 : GRAPH_ADJ_MIN_CAP;
+        node->adj = realloc(node->adj, node->adj_cap * sizeof(uint32_t));
+        assert(node->adj != NULL);
     }
-  }
-  return -1;
+    node->adj[node->adj_n++] = to_idx;
+    graph->n_edges++;
+    return true;
+}
+
+
+void graph_foreach(Graph *graph, void *data, void (*fn)(uint64_t, const uint64_t *, size_t, void *))
+{
+    graph_scratch_reserve(graph);
+    for (size_t i = 0; i < graph->n_nodes; i++) {
+        const graph_node_t *node = &graph->nodes[i];
+        if (node->adj_n == 0)
+            continue;
+        for (uint32_t j = 0; j < node->adj_n; j++)
+            graph->succ[j] = graph->nodes[node->adj[j]].value;
+        fn(node->value, graph->succ, node->adj_n, data);
+    }
+}
+
+
+size_t graph_nodes(Graph *graph)
+{
+    return graph->n_nodes;
+}
+
+
+size_t graph_edges(Graph *graph)
+{
+    return graph->n_edges;
 }
 
 
@@ -161,49 +213,32 @@ size_t graph_depth(Graph *graph, size_t start_idx)
     if (graph->n_nodes == 0)
         return 0;
 
-    assert(array_size(graph->nodes) >= start_idx);
+    assert(start_idx < graph->n_nodes);
+    graph_scratch_reserve(graph);
 
-    Queue *queue = NULL;
-    assert(queue_new(&queue) == CC_OK);
-    bfs_queue_elm_t *q_elm = malloc(sizeof(bfs_queue_elm_t));
-    assert(q_elm != NULL);
-    *q_elm = (bfs_queue_elm_t) { 0, start_idx };
-    assert(queue_enqueue(queue, q_elm) == CC_OK);
+    uint32_t *queue = graph_scratch(graph, 0);
+    uint32_t *depth = graph_scratch(graph, 1);
+    memset(depth, 0xFF, graph->n_nodes * sizeof(uint32_t));
 
-    // actually the size of the nodes array should suffice
-    bool discovered[graph->n_nodes];
-    for (size_t i = 0; i < graph->n_nodes; i++) {
-        discovered[i] = false;
-    }
+    size_t q_head = 0, q_tail = 0;
+    queue[q_tail++] = start_idx;
+    depth[start_idx] = 0;
 
-    size_t max_depth = q_elm->depth;
-    while (queue_size(queue) > 0) {
-        assert(queue_poll(queue, (void **) &q_elm) == CC_OK);
-        List *edge_list = NULL;
-        assert(array_get_at(graph->edges, q_elm->index, (void **) &edge_list) == CC_OK);
-
-        ListIter edges_iter;
-        list_iter_init(&edges_iter, edge_list);
-
-        uint64_t *edge_value = NULL;
-        while (list_iter_next(&edges_iter, (void **) &edge_value) != CC_ITER_END) {
-            ssize_t idx = graph_find_node_index(graph, *edge_value);
-            if (idx != -1 && discovered[idx] == false) {
-                discovered[idx] = true;
-                bfs_queue_elm_t *q_new = malloc(sizeof(bfs_queue_elm_t));
-                assert(q_new != NULL);
-                *q_new = (bfs_queue_elm_t) { q_elm->depth + 1, idx };
-                assert(queue_enqueue(queue, q_new) == CC_OK);
+    size_t max_depth = 0;
+    while (q_head < q_tail) {
+        const uint32_t idx = queue[q_head++];
+        const graph_node_t *node = &graph->nodes[idx];
+        for (uint32_t j = 0; j < node->adj_n; j++) {
+            const uint32_t succ = node->adj[j];
+            if (depth[succ] == NODE_NONE) {
+                depth[succ] = depth[idx] + 1;
+                queue[q_tail++] = succ;
             }
-            if (q_elm->depth + 1 > max_depth)
-                max_depth = q_elm->depth + 1;
+            if (depth[idx] + 1 > max_depth)
+                max_depth = depth[idx] + 1;
         }
-
-        free(q_elm);
     }
 
-    queue_destroy(queue);
-
     return max_depth;
 }
 
@@ -211,8 +246,9 @@ size_t graph_depth(Graph *graph, size_t start_idx)
 size_t graph_depth_conn(Graph *graph)
 {
     size_t max_depth = 0;
-    const size_t from_size = array_size(graph->nodes);
-    for (size_t i = 0; i < from_size; i++) {
+    for (size_t i = 0; i < graph->n_nodes; i++) {
+        if (graph->nodes[i].adj_n == 0)
+            continue;
         size_t d = graph_depth(graph, i);
         if (d > max_depth)
             max_depth = d;
@@ -220,3 +256,102 @@ size_t graph_depth_conn(Graph *graph)
 
     return max_depth;
 }
+
+
+/*
+ * Longest path, in edges, over the condensation of the graph: every
+ * strongly connected component (a loop) counts as a single level.
+ * Iterative Tarjan completes components sinks first, so the depth of a
+ * component is known as soon as it is popped.
+ */
+size_t graph_depth_scc(Graph *graph)
+{
+    const size_t n = graph->n_nodes;
+    if (n == 0)
+        return 0;
+
+    graph_scratch_reserve(graph);
+    uint32_t *index = graph_scratch(graph, 0);
+    uint32_t *low = graph_scratch(graph, 1);
+    uint32_t *comp = graph_scratch(graph, 2);
+    uint32_t *stack = graph_scratch(graph, 3);
+    uint32_t *call_node = graph_scratch(graph, 4);
+    uint32_t *call_edge = graph_scratch(graph, 5);
+    uint32_t *comp_depth = graph_scratch(graph, 6);
+    memset(index, 0xFF, n * sizeof(uint32_t));
+    memset(comp, 0xFF, n * sizeof(uint32_t));
+
+    uint32_t counter = 0, n_comp = 0;
+    size_t sp = 0, csp = 0;
+    size_t max_depth = 0;
+
+    for (uint32_t root = 0; root < n; root++) {
+        if (index[root] != NODE_NONE)
+            continue;
+
+        index[root] = low[root] = counter++;
+        stack[sp++] = root;
+        call_node[csp] = root;
+        call_edge[csp++] = 0;
+
+        while (csp > 0) {
+            const uint32_t v = call_node[csp-1];
+            const graph_node_t *node = &graph->nodes[v];
+
+            if (call_edge[csp-1] < node->adj_n) {
+                const uint32_t w = node->adj[call_edge[csp-1]++];
+                if (index[w] == NODE_NONE) {
+                    index[w] = low[w] = counter++;
+                    stack[sp++] = w;
+                    call_node[csp] = w;
+                    call_edge[csp++] = 0;
+                } else if (comp[w] == NODE_NONE && index[w] < low[v]) {
+                    low[v] = index[w];
+                }
+                continue;
+            }
+
+            csp--;
+            if (csp > 0 && low[v] < low[call_node[csp-1]])
+                low[call_node[csp-1]] = low[v];
+            if (low[v] != index[v])
+                continue;
+
+            // v is the root of a component: everything above it on the stack
+            size_t first = sp;
+            do {
+                comp[stack[--first]] = n_comp;
+            } while (stack[first] != v);
+
+            uint32_t d = 0;
+            for (size_t i = first; i < sp; i++) {
+                const graph_node_t *member = &graph->nodes[stack[i]];
+                for (uint32_t j = 0; j < member->adj_n; j++) {
+                    const uint32_t c = comp[member->adj[j]];
+                    if (c != n_comp && comp_depth[c] + 1 > d)
+                        d = comp_depth[c] + 1;
+                }
+            }
+            comp_depth[n_comp++] = d;
+            if (d > max_depth)
+                max_depth = d;
+            sp = first;
+        }
+    }
+
+    return max_depth;
+}
+
+
+size_t graph_depth_by(Graph *graph, graph_depth_mode_t mode)
+{
+    switch (mode) {
+    case GRAPH_DEPTH_ENTRY:
+        return graph_depth(graph, 0);
+    case GRAPH_DEPTH_BFS:
+        return graph_depth_conn(graph);
+    case GRAPH_DEPTH_SCC:
+    default:
+        return graph_depth_scc(graph);
+    }
+}
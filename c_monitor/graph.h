@@ -2,23 +2,28 @@
 #define _H_GRAPH_
 
 #include <inttypes.h>
+#include <stdbool.h>
 #include <unistd.h>
 
 
-// beware of this...
-#define CC_GRAPH_FROM_EXISTS        CC_ERR_KEY_NOT_FOUND
-#define CC_GRAPH_BOTH_EXIST         CC_ERR_VALUE_NOT_FOUND
-
-
 typedef struct graph_s Graph;
 
-enum cc_stat graph_new(Graph **graph);
-void         graph_destroy(Graph *graph);
-enum cc_stat graph_add(Graph *graph, uint64_t *from, uint64_t *to);
-void         graph_foreach(Graph *graph, void *data, void (*fn)(uint64_t *, uint64_t **, size_t, void*));
-size_t       graph_nodes(Graph *graph);
-size_t       graph_edges(Graph *graph);
-size_t       graph_depth(Graph *graph, size_t start_idx);
-size_t       graph_depth_conn(Graph *graph);
+typedef enum graph_depth_mode {
+    GRAPH_DEPTH_SCC = 0,    // longest path over the SCC condensation, O(V+E)
+    GRAPH_DEPTH_ENTRY,      // BFS from the first node added only, O(V+E)
+    GRAPH_DEPTH_BFS,        // BFS from every node, O(V*(V+E))
+} graph_depth_mode_t;
+
+Graph  *graph_new(void);
+void    graph_destroy(Graph *graph);
+void    graph_clear(Graph *graph);
+bool    graph_add(Graph *graph, uint64_t from, uint64_t to);
+void    graph_foreach(Graph *graph, void *data, void (*fn)(uint64_t, const uint64_t *, size_t, void *));
+size_t  graph_nodes(Graph *graph);
+size_t  graph_edges(Graph *graph);
+size_t  graph_depth(Graph *graph, size_t start_idx);
+size_t  graph_depth_conn(Graph *graph);
+size_t  graph_depth_scc(Graph *graph);
+size_t  graph_depth_by(Graph *graph, graph_depth_mode_t mode);
 
 #endif
@@ -2,6 +2,7 @@
 #include <zmq.h>
 #include <perf/log.h>
 #include <perf/perf.h>
+#include <perf/sections.h>
 #include <inttypes.h>
 #include <time.h>
 #include <math.h>
@@ -10,43 +11,138 @@
 #include <stdbool.h>
 #include <unistd.h>
 #include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 #include <linux/limits.h>
+#include <sys/epoll.h>
 #include <sys/inotify.h>
 #include <sys/fcntl.h>
 
-#include "sections.h"
 #include "graph.h"
+#include "edges.h"
+#include "coverage.h"
+#include "trace.h"
+#include "corpus.h"
+#include "snapshot.h"
+#include "export.h"
+#include "cache.h"
+#include "credits.h"
+#include "ring.h"
 #include "bb.h"
 #include "util.h"
 
 
 #define BUF_SZ              (1024 * 1024)
-#define HASH_KEY_SEP        "/"
-#define HASH_KEY_SZ         64
-#define GRAPH_NO_PRINT      ((void *) -1)
+#define INPUT_MAX           (64 * 1024 * 1024)  // longer inputs are cut, with a warning
+#define EDGES_CAP           (64 * 1024)
+#define TRACE_EDGES_CAP     (4 * 1024)
 
 #define IN_EVENT_SIZE       (sizeof(struct inotify_event) + NAME_MAX + 1)
 
-bool keep_running = true;
+#define WORKERS_ENDPOINT    "inproc://workers"
+#define WORKER_QUEUE        16
+#define WORKER_TIMEOUT_MS   100
+#define CREDITS_PER_WORKER  4       // fuzzer inputs in flight per worker
+#define STATS_INTERVAL_MS   10000
+#define INGEST_BATCH        256     // inputs taken from a source per wakeup
+#define POLL_TIMEOUT_MS     100
+#define RING_POLL_MS        1       // without their doorbell, rings are looked at this often
+#define RING_SCAN_MS        1000
+#define IMPORT_LOG_MS       2000
+#define SNAPSHOT_INTERVAL_S 60
+#define REPLAY_MAX          64
+#define TRACE_FAILURES_MAX  16      // in a row, the session is beyond repair then
+
+#define STAT_GET(x)         __atomic_load_n(&(x), __ATOMIC_RELAXED)
+#define STAT_ADD(x, y)      __atomic_fetch_add(&(x), y, __ATOMIC_RELAXED)
+
+volatile bool keep_running = true;
 
 
 typedef struct monitor {
     char const ** sut;
-    HashTable *branch_hits;
+    CoverageMap *branch_hits;       // coverage of all workers
+    bool merge_delta;               // workers merge per input instead of per branch
     section_bounds_t *sec_bounds;
+    uint64_t image_vaddr;           // link-time address the SUT binary is mapped from
     basic_block_t *bbs;
     size_t bbs_n;
-    char *graph_indiv_path;
+    bb_index_t *bb_index;
+    char *graph_indiv_path;         // directory of the per-input graph export
+    export_writer_t *graph_export;
+    bool graph_delta;               // export only the edges each input found
+    bool graph_async;               // write the export on a thread of its own
+    graph_depth_mode_t depth_mode;
+    size_t max_depth;
     size_t input_n;
     char *fuzz_corpus_path;
+    const char *forksrv_preload;
+    void *zmq_context;
+    size_t workers_n;
+    size_t data_pages;              // perf ring sizes, 0 for the defaults
+    size_t aux_pages;
+    bool aux_auto;
+    bool corpus_import;             // trace the corpus found at startup first
+    const char *snapshot_path;
+    long snapshot_interval_ms;
+    credits_t *credits;             // what the preloads may send, NULL if they sample
+    TraceCache *trace_cache;        // inputs traced before aren't run again
+    size_t trace_cache_sz;
+    trace_cache_policy_t trace_cache_policy;
+    snapshot_t *warm;               // what the last run left, until loaded
+    const char *capture_path;       // directory the workers write traces to
+    const char *replay_paths[REPLAY_MAX];
+    size_t replay_n;
+    char const *replay_sut[2];
 } monitor_t;
 
+// sent by the dispatcher ahead of every input
+typedef struct monitor_job {
+    size_t input_n;
+    size_t size;                    // of the input that follows
+    uint32_t seen;
+    double seen_avg;
+    bool from_corpus;
+    uint64_t hash;                  // key of the trace cache
+} monitor_job_t;
+
+typedef struct worker_stats {
+    uint64_t inputs;
+    uint64_t branches;
+    uint64_t filtered;
+    uint64_t new_branches;
+    uint64_t trace_ms;
+    uint64_t process_ms;
+    uint64_t max_depth;
+    uint64_t truncated;             // inputs whose trace is incomplete
+    uint64_t failed;                // inputs skipped, they could not be traced
+} worker_stats_t;
+
+typedef struct worker {
+    size_t id;
+    int cpu;                        // -1 if not pinned
+    pthread_t thread;
+    bool started;
+    int ret;
+    monitor_t *monitor;
+    perf_session_t perf;
+    Graph *graph;                   // edges of the current input
+    EdgeMap *trace_hits;            // hits of the current input, when merge_delta or exporting
+    edge_t *export_edges;           // graph export record of the current input
+    size_t export_n;
+    size_t export_cap;
+    trace_file_t *capture;
+    uint64_t input_filtered;        // of the input being processed
+    uint64_t input_new;
+    worker_stats_t stats;
+} worker_t;
+
 
 static inline long get_time_ms(void)
 {
     struct timespec spec;
     clock_gettime(CLOCK_MONOTONIC, &spec);
-    return round(spec.tv_nsec / 1.0e6);
+    return spec.tv_sec * 1000 + round(spec.tv_nsec / 1.0e6);
 }
 
 
@@ -56,105 +152,81 @@ void int_sig_handler(int signum)
 }
 
 
-void graph_print_and_free(uint64_t *from, uint64_t **connections,
-                          size_t connections_size, void *fd)
+// writes the coverage as Graphviz to graph_filename, as an export to export_filename
+static void free_branch_hits(monitor_t *monitor, char *graph_filename, char *export_filename)
 {
-    if (fd == NULL || fd == GRAPH_NO_PRINT) {
-        if (fd == NULL) {
-            LOG_I("0x%010" PRIx64 " %zu", *from, connections_size);
-        }
-        for (size_t i = 0; i < connections_size; i++) {
-            free(connections[i]);
+    if (graph_filename != NULL) {
+        if (export_coverage_gv(graph_filename, monitor->branch_hits, monitor->max_depth) == -1) {
+            LOG_E("failed to write the coverage graph %s", graph_filename);
+        } else {
+            LOG_I("wrote %zu edges to %s",
+                coverage_map_size(monitor->branch_hits), graph_filename);
         }
-    } else {
-        FILE *file = (FILE *) fd;
-        for (size_t i = 0; i < connections_size; i++) {
-            fprintf(file, "\t\"0x%" PRIx64 "\" -> \"0x%" PRIx64 "\";\n",
-                *from, *connections[i]);
-            free(connections[i]);
+    }
+    if (export_filename != NULL) {
+        export_writer_t *writer = export_create(export_filename, monitor->sut[0], false);
+        if (writer == NULL
+            || export_coverage(writer, monitor->branch_hits, monitor->max_depth) == -1
+            || export_close(writer) == -1) {
+            LOG_E("failed to export the coverage to %s", export_filename);
+        } else {
+            LOG_I("exported %zu edges to %s",
+                coverage_map_size(monitor->branch_hits), export_filename);
         }
     }
-    free(from);
+    coverage_map_destroy(monitor->branch_hits);
 }
 
 
-static void free_hashtable(HashTable *table, char *graph_filename)
+// queues an edge for the graph export record of the current input
+static void worker_export_edge(const edge_t *edge, void *data)
 {
-    FILE *graph_file = NULL;
-    Graph *graph = NULL;
-    if (graph_filename != NULL) {
-        if ((graph_file = fopen(graph_filename, "w")) == NULL) {
-            PLOG_F("failed to open file %s", graph_filename);
-            exit(EXIT_FAILURE);
-        }
-        assert(graph_new(&graph) == CC_OK);
-        fprintf(graph_file, "digraph {\n");
+    worker_t *worker = (worker_t *) data;
+    if (worker->export_n == worker->export_cap) {
+        worker->export_cap = worker->export_cap ? worker->export_cap * 2 : TRACE_EDGES_CAP;
+        worker->export_edges = realloc(worker->export_edges, worker->export_cap * sizeof(edge_t));
+        assert(worker->export_edges != NULL);
     }
+    worker->export_edges[worker->export_n++] = *edge;
+}
 
-    // this fixes a segfault when iterating an empty HashTable
-    if (hashtable_size(table) == 0) {
-        hashtable_destroy(table);
-        if (graph != NULL) {
-            fprintf(graph_file, "}\n");
-            fclose(graph_file);
-            graph_destroy(graph);
-        }
-        return;
-    }
 
-    HashTableIter hti;
-    hashtable_iter_init(&hti, table);
-    TableEntry *entry;
-    while (hashtable_iter_next(&hti, &entry) != CC_ITER_END) {
-        if (graph_filename != NULL) {
-            char *dup = strdup((char *) entry->key);
-            char *split = strstr(dup, HASH_KEY_SEP);
-            char *second = split + 1;
-            *split = '\0';
-            uint64_t *from = malloc(sizeof(uint64_t));
-            *from = atol(dup);
-            uint64_t *to = malloc(sizeof(uint64_t));
-            *to = atol(second);
-            free(dup);
-
-            fprintf(graph_file,
-                "\t\"0x%" PRIx64 "\" -> \"0x%" PRIx64 "\" [label=\"%" PRIu64 "\"];\n",
-                *from, *to, *(uint64_t *) entry->value);
-
-            switch (graph_add(graph, from, to)) {
-            case CC_GRAPH_BOTH_EXIST:
-                free(to);
-            case CC_GRAPH_FROM_EXISTS:
-                free(from);
-                break;
-            case CC_OK:
-                break;
-            default:
-                LOG_F("failed to add to graph");
-                abort();
-            }
-        }
-        free(entry->key);
-        free(entry->value);
-    }
-    hashtable_destroy(table);
+static void worker_fingerprint(uint64_t from, const uint64_t *connections,
+                               size_t connections_size, void *data)
+{
+    trace_result_t *result = (trace_result_t *) data;
+    for (size_t i = 0; i < connections_size; i++)
+        result->fingerprint = trace_fingerprint(result->fingerprint, from, connections[i]);
+    result->edges_n += connections_size;
+}
 
-    if (graph_filename != NULL) {
-        fprintf(graph_file, "}\n");
-        fclose(graph_file);
-        LOG_I("graph with %zu nodes and %zu edges",
-            graph_nodes(graph), graph_edges(graph));
-        graph_foreach(graph, NULL, graph_print_and_free);
-        graph_destroy(graph);
-    }
+
+static void process_begin(worker_t *worker)
+{
+    graph_clear(worker->graph);
+    edge_map_clear(worker->trace_hits);
+    worker->export_n = 0;
+    worker->input_filtered = 0;
+    worker->input_new = 0;
 }
 
 
-static int process_branches(bts_branch_t *bts_start, uint64_t count, monitor_t *monitor,
-                            uint64_t *new_branches, uint64_t *filtered_count, uint64_t *depth)
+// a branch address as linked: sections and basic blocks are read from the
+// binary, while a PIE one runs wherever ASLR put it
+static inline uint64_t link_address(const worker_t *worker, uint64_t addr)
 {
-    if (new_branches == NULL || filtered_count == NULL)
-        return 0;
+    const perf_session_t *perf = &worker->perf;
+    if (addr >= perf->image_start && addr < perf->image_end)
+        return addr - perf->image_start + worker->monitor->image_vaddr;
+    return addr;
+}
+
+
+// perf_chunk_fn_t, called as the trace of the current input streams in
+static void process_chunk(const bts_branch_t *bts_start, uint64_t count, void *data)
+{
+    worker_t *worker = (worker_t *) data;
+    monitor_t *monitor = worker->monitor;
 
     uint64_t _new_branches = 0;
     uint64_t _filtered_count = 0;
@@ -163,14 +235,16 @@ static int process_branches(bts_branch_t *bts_start, uint64_t count, monitor_t *
     const uint64_t sec_start = sec_bounds ? sec_bounds->sec_start : 0;
     const uint64_t sec_end = sec_bounds ? sec_bounds->sec_end : 0;
 
-    Graph *graph = NULL;
-    assert(graph_new(&graph) == CC_OK);
+    Graph *graph = worker->graph;
 
     for (uint64_t i = 0; i < count; i++) {
         bts_branch_t branch = bts_start[i];
-        if (branch.from > 0xFFFFFFFF00000000 || branch.to > 0xFFFFFFFF00000000) {
+        // zeroed records are padding left by the BTS driver
+        if (branch.from > 0xFFFFFFFF00000000 || branch.to > 0xFFFFFFFF00000000 || branch.from == 0) {
             continue;
         }
+        branch.from = link_address(worker, branch.from);
+        branch.to = link_address(worker, branch.to);
 
         if (sec_bounds && (
                 (branch.from < sec_start || branch.from > sec_end)
@@ -180,84 +254,86 @@ static int process_branches(bts_branch_t *bts_start, uint64_t count, monitor_t *
 
         _filtered_count++;
 
-        uint64_t *from_bb = malloc(sizeof(uint64_t));
-        uint64_t *to_bb = malloc(sizeof(uint64_t));
-        *from_bb = 0;
-        *to_bb = 0;
-        for (size_t j = 0; j < monitor->bbs_n; j++) {
-            basic_block_t bb = monitor->bbs[j];
-            if (branch.from >= bb.from && branch.from < bb.to)
-                *from_bb = bb.from;
-            if (branch.to >= bb.from && branch.to < bb.to)
-                *to_bb = bb.from;
-            if (*from_bb != 0 && *to_bb != 0)
-                break;
-        }
-        if (*from_bb == 0)
-            *from_bb = branch.from;
-        if (*to_bb == 0)
-            *to_bb = branch.to;
-
-        void *key = malloc(HASH_KEY_SZ * sizeof(char));
-        assert(key != NULL);
-        snprintf(key, HASH_KEY_SZ, "%" PRIu64 HASH_KEY_SEP "%" PRIu64, *from_bb, *to_bb);
-
-        switch (graph_add(graph, from_bb, to_bb)) {
-        case CC_GRAPH_BOTH_EXIST:
-            free(to_bb);
-        case CC_GRAPH_FROM_EXISTS:
-            free(from_bb);
-            break;
-        case CC_OK:
-            break;
-        default:
-            LOG_F("failed to add to graph");
-            abort();
-        }
+        uint64_t from_bb = bb_index_find(monitor->bb_index, branch.from);
+        uint64_t to_bb = bb_index_find(monitor->bb_index, branch.to);
+        if (from_bb == 0)
+            from_bb = branch.from;
+        if (to_bb == 0)
+            to_bb = branch.to;
 
-        uint64_t *value = NULL;
-        if (hashtable_get(monitor->branch_hits, key, (void **) &value) == CC_OK) {
-            (*value)++;
-            free(key);
+        if (monitor->merge_delta) {
+            edge_map_hit(worker->trace_hits, from_bb, to_bb);
         } else {
-            value = malloc(sizeof(uint64_t));
-            assert(value != NULL);
-            *value = 1;
-            if (hashtable_add(monitor->branch_hits, key, value) != CC_OK) {
-                LOG_F("failed to add branch [%s]", key);
-                return -1;
+            if (coverage_map_hit(monitor->branch_hits, from_bb, to_bb, 1)) {
+                _new_branches++;
+                if (monitor->graph_delta && monitor->graph_export != NULL) {
+                    const edge_t edge = { from_bb, to_bb, 0 };
+                    worker_export_edge(&edge, worker);
+                }
             }
-            _new_branches++;
+            if (monitor->graph_export != NULL)
+                edge_map_hit(worker->trace_hits, from_bb, to_bb);
         }
+        graph_add(graph, from_bb, to_bb);
     }
 
-    *depth = graph_depth_conn(graph);
-    if (_new_branches > 0) {
-        char graph_indiv_path[PATH_MAX];
-        snprintf(graph_indiv_path, PATH_MAX, "%s/graph.%zu.gv",
-            monitor->graph_indiv_path, monitor->input_n);
+    worker->input_new += _new_branches;
+    worker->input_filtered += _filtered_count;
+}
+
 
-        FILE *graph_file = fopen(graph_indiv_path, "w");
-        if (graph_file == NULL) {
-            PLOG_F("failed to open file %s", graph_indiv_path);
-            return -1;
+static int process_end(worker_t *worker, size_t input_n,
+                       uint64_t *new_branches, uint64_t *filtered_count, uint64_t *depth)
+{
+    monitor_t *monitor = worker->monitor;
+    Graph *graph = worker->graph;
+
+    const bool export_delta = monitor->graph_delta && monitor->graph_export != NULL;
+
+    // hot edges touch the shared store once per input rather than per branch
+    if (monitor->merge_delta) {
+        worker->input_new = coverage_map_merge(monitor->branch_hits, worker->trace_hits,
+            worker, export_delta ? worker_export_edge : NULL);
+    }
+
+    *depth = graph_depth_by(graph, monitor->depth_mode);
+    if (worker->input_new > 0 && monitor->graph_export != NULL) {
+        if (!monitor->graph_delta) {
+            edge_map_foreach(worker->trace_hits, worker, worker_export_edge);
+        } else if (!monitor->merge_delta) {
+            // queued when first seen, the hits came after
+            for (size_t i = 0; i < worker->export_n; i++) {
+                edge_t *edge = &worker->export_edges[i];
+                edge->hits = edge_map_get(worker->trace_hits, edge->from, edge->to);
+            }
         }
-        fprintf(graph_file, "digraph {\n");
-        graph_foreach(graph, graph_file, graph_print_and_free);
-        fprintf(graph_file, "}\n");
-        fclose(graph_file);
-    } else {
-        graph_foreach(graph, GRAPH_NO_PRINT, graph_print_and_free);
+
+        export_record_t record;
+        memset(&record, 0, sizeof(export_record_t));
+        record.input_n = input_n;
+        record.edges_n = worker->export_n;
+        record.depth = *depth;
+        record.flags = monitor->graph_delta ? EXPORT_DELTA : 0;
+        if (export_write(monitor->graph_export, &record, worker->export_edges) == -1)
+            return -1;
     }
-    graph_destroy(graph);
 
-    *new_branches = _new_branches;
-    *filtered_count = _filtered_count;
+    *new_branches = worker->input_new;
+    *filtered_count = worker->input_filtered;
 
     return 0;
 }
 
 
+static int process_branches(bts_branch_t *bts_start, uint64_t count, worker_t *worker, size_t input_n,
+                            uint64_t *new_branches, uint64_t *filtered_count, uint64_t *depth)
+{
+    process_begin(worker);
+    process_chunk(bts_start, count, worker);
+    return process_end(worker, input_n, new_branches, filtered_count, depth);
+}
+
+
 int cmp_uint64(const void *n1, const void *n2)
 {
     const uint64_t _n1 = *(const uint64_t *) n1;
@@ -279,53 +355,8 @@ static struct inotify_event *inotify_event_new(void)
 }
 
 
-static int inotify_maybe_read(int inotify_fd, int wd, const char *path,
-                              uint8_t *buf, size_t buf_len)
-{
-    struct inotify_event *in_event = inotify_event_new();
-    ssize_t ret = read(inotify_fd, in_event, IN_EVENT_SIZE);
-    if (ret == -1) {
-        free(in_event);
-        if (errno == EAGAIN || errno == EWOULDBLOCK)
-            return 0;
-        return -1;
-    }
-
-    if (in_event->wd != wd) {
-        free(in_event);
-        return 0;
-    }
-
-    if ((in_event->mask & IN_DELETE_SELF) == IN_DELETE_SELF) {
-        LOG_E("corpus directory %s deleted", path);
-        free(in_event);
-        return -1;
-    }
-
-    if (in_event->len == 0) {
-        LOG_W("inotify event name len is zero (%" PRIx32 ")", in_event->mask);
-        free(in_event);
-        return 0;
-    }
-    char file_path[PATH_MAX];
-    snprintf(file_path, PATH_MAX, "%s/%s", path, in_event->name);
-    free(in_event);
-
-    int fd = open(file_path, O_RDONLY);
-    if (fd == -1) {
-        PLOG_F("failed to open %s", file_path);
-        return -1;
-    }
-    ret = read(fd, buf, buf_len);
-    if (ret == -1) {
-        PLOG_F("failed reading from %s", file_path);
-    }
-    close(fd);
-    return ret;
-}
-
-
-static int inotify_wait4_creation(int inotify_fd, const char *path)
+// epoll_fd must be watching inotify_fd
+static int inotify_wait4_creation(int epoll_fd, int inotify_fd, const char *path)
 {
     char *parent_path = strdup(path);
     char *last_slash = strrchr(parent_path, '/');
@@ -347,8 +378,9 @@ static int inotify_wait4_creation(int inotify_fd, const char *path)
     while (keep_running) {
         ssize_t ret = read(inotify_fd, in_event, IN_EVENT_SIZE);
         if (ret == -1) {
-            if (errno == EAGAIN || errno == EWOULDBLOCK) {
-                usleep(100);
+            struct epoll_event event;
+            if ((errno == EAGAIN || errno == EWOULDBLOCK)
+                && (epoll_wait(epoll_fd, &event, 1, POLL_TIMEOUT_MS) != -1 || errno == EINTR)) {
                 continue;
             }
             break;
@@ -371,20 +403,579 @@ static int inotify_wait4_creation(int inotify_fd, const char *path)
 }
 
 
-static int monitor_loop(monitor_t *monitor, void *receiver, bool print_seen_inputs)
+// raises the global max depth to depth, returns true if it was lower
+static bool max_depth_raise(monitor_t *monitor, size_t depth)
+{
+    size_t max_depth = __atomic_load_n(&monitor->max_depth, __ATOMIC_RELAXED);
+    while (depth > max_depth) {
+        if (__atomic_compare_exchange_n(&monitor->max_depth, &max_depth, depth, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            return true;
+    }
+    return false;
+}
+
+
+static void worker_stats_add(worker_t *worker, uint64_t count, uint64_t filtered_count,
+                             uint64_t new_branches, long trace_ms, long process_ms, size_t depth)
+{
+    STAT_ADD(worker->stats.inputs, 1);
+    STAT_ADD(worker->stats.branches, count);
+    STAT_ADD(worker->stats.filtered, filtered_count);
+    STAT_ADD(worker->stats.new_branches, new_branches);
+    STAT_ADD(worker->stats.trace_ms, trace_ms);
+    STAT_ADD(worker->stats.process_ms, process_ms);
+    if (depth > worker->stats.max_depth)
+        __atomic_store_n(&worker->stats.max_depth, depth, __ATOMIC_RELAXED);
+}
+
+
+static void worker_pin(worker_t *worker)
+{
+    if (worker->cpu == -1)
+        return;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(worker->cpu, &cpus);
+    // inherited by the SUT processes forked from this thread
+    int err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    if (err != 0) {
+        LOG_W("worker %zu: failed to pin to CPU %d (%s)", worker->id, worker->cpu, strerror(err));
+    }
+}
+
+
+// a fresh fork server after a failed trace, whatever state the old one is in;
+// exec mode gets a new launcher with the next trace anyway
+static bool worker_restart(worker_t *worker)
+{
+    monitor_t *monitor = worker->monitor;
+    if (monitor->forksrv_preload == NULL)
+        return true;
+    perf_session_destroy(&worker->perf);
+    if (perf_session_forksrv(&worker->perf, monitor->sut, monitor->forksrv_preload) == PERF_FAILURE) {
+        LOG_F("worker %zu: failed to restart fork server", worker->id);
+        return false;
+    }
+    LOG_I("worker %zu: fork server restarted", worker->id);
+    return true;
+}
+
+
+static void *worker_loop(void *data)
+{
+    worker_t *worker = (worker_t *) data;
+    monitor_t *monitor = worker->monitor;
+    worker->ret = EXIT_FAILURE;
+
+    worker_pin(worker);
+    if (monitor->forksrv_preload != NULL) {
+        if (perf_session_forksrv(&worker->perf, monitor->sut, monitor->forksrv_preload) == PERF_FAILURE) {
+            LOG_F("worker %zu: failed to start fork server", worker->id);
+            keep_running = false;
+            return NULL;
+        }
+        LOG_I("worker %zu: fork server started on CPU %d", worker->id, worker->cpu);
+    }
+
+    void *receiver = zmq_socket(monitor->zmq_context, ZMQ_PULL);
+    if (receiver == NULL) {
+        PLOG_F("worker %zu: failed to create socket", worker->id);
+        keep_running = false;
+        return NULL;
+    }
+    const int hwm = WORKER_QUEUE, timeout = WORKER_TIMEOUT_MS;
+    zmq_setsockopt(receiver, ZMQ_RCVHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(receiver, ZMQ_RCVTIMEO, &timeout, sizeof(timeout));
+    if (zmq_connect(receiver, WORKERS_ENDPOINT) == -1) {
+        PLOG_F("worker %zu: failed to connect to dispatcher", worker->id);
+        zmq_close(receiver);
+        keep_running = false;
+        return NULL;
+    }
+
+    if (monitor->capture_path != NULL) {
+        char capture_path[PATH_MAX];
+        snprintf(capture_path, PATH_MAX, "%s/trace.%zu.bts", monitor->capture_path, worker->id);
+        if ((worker->capture = trace_create(capture_path, monitor->sut[0])) == NULL) {
+            zmq_close(receiver);
+            keep_running = false;
+            return NULL;
+        }
+    } else {
+        // analyze the trace while the SUT still runs, as the AUX ring drains
+        perf_session_stream(&worker->perf, process_chunk, worker);
+    }
+
+    worker->ret = EXIT_SUCCESS;
+    size_t failures = 0;            // in a row
+    while (keep_running) {
+        monitor_job_t job;
+        if (zmq_recv(receiver, &job, sizeof(job), 0) == -1) {
+            if (errno == EAGAIN || errno == EINTR)
+                continue;
+            if (keep_running) {
+                PLOG_F("worker %zu: failed to receive from dispatcher", worker->id);
+                worker->ret = EXIT_FAILURE;
+            }
+            break;
+        }
+
+        // received straight into the memory the SUT reads its input from;
+        // both parts of a message are delivered together
+        const size_t capacity = job.size > BUF_SZ ? job.size : BUF_SZ;
+        uint8_t *buf = perf_session_input(&worker->perf, capacity);
+        int size = buf != NULL ? zmq_recv(receiver, buf, capacity, 0) : -1;
+        if (size == -1) {
+            LOG_F("worker %zu: failed to receive input", worker->id);
+            worker->ret = EXIT_FAILURE;
+            break;
+        }
+        if ((size_t) size > job.size)
+            size = job.size;
+
+        bts_branch_t *bts_start;
+        uint64_t count;
+        process_begin(worker);
+        long start_ms = get_time_ms();
+        if (perf_session_trace(&worker->perf, buf, size, monitor->sut, &bts_start, &count) == PERF_FAILURE) {
+            // one input lost, the fuzzer gets its credit back all the same
+            STAT_ADD(worker->stats.failed, 1);
+            if (monitor->credits != NULL && !job.from_corpus)
+                credits_grant(monitor->credits, 1);
+            if (++failures >= TRACE_FAILURES_MAX) {
+                LOG_F("worker %zu: %zu traces failed in a row, giving up", worker->id, failures);
+                worker->ret = EXIT_FAILURE;
+                break;
+            }
+            LOG_E("worker %zu: failed to trace input %zu, skipped", worker->id, job.input_n);
+            if (!worker_restart(worker)) {
+                worker->ret = EXIT_FAILURE;
+                break;
+            }
+            continue;
+        }
+        failures = 0;
+        long elapsed_ms = get_time_ms() - start_ms;
+
+        if (worker->perf.aux_truncated > 0 || worker->perf.lost > 0)
+            STAT_ADD(worker->stats.truncated, 1);
+
+        // when streaming, the branches went through process_chunk already
+        // and only the per-input part of the processing is timed here
+        uint64_t new_branches = 0, filtered_count = 0, depth = 0;
+        long process_ms = get_time_ms();
+        if (worker->capture != NULL) {
+            // captured as linked, replays need no session to make sense of them
+            for (uint64_t i = 0; i < count; i++) {
+                bts_start[i].from = link_address(worker, bts_start[i].from);
+                bts_start[i].to = link_address(worker, bts_start[i].to);
+            }
+            trace_record_t record = { job.input_n, count, size, elapsed_ms, job.from_corpus, 0 };
+            if (trace_write(worker->capture, &record, bts_start) == -1) {
+                worker->ret = EXIT_FAILURE;
+                break;
+            }
+            process_chunk(bts_start, count, worker);
+        }
+        if (process_end(worker, job.input_n, &new_branches, &filtered_count, &depth) == -1) {
+            worker->ret = EXIT_FAILURE;
+            break;
+        }
+        process_ms = get_time_ms() - process_ms;
+
+        // an incomplete trace says little about the next run of the input
+        if (monitor->trace_cache != NULL && worker->perf.aux_truncated == 0 && worker->perf.lost == 0) {
+            trace_result_t result = { 0, 0, depth };
+            graph_foreach(worker->graph, &result, worker_fingerprint);
+            trace_cache_put(monitor->trace_cache, job.hash, &result);
+        }
+        if (monitor->credits != NULL && !job.from_corpus)
+            credits_grant(monitor->credits, 1);
+
+        bool new_depth = max_depth_raise(monitor, depth);
+        size_t max_depth = __atomic_load_n(&monitor->max_depth, __ATOMIC_RELAXED);
+        worker_stats_add(worker, count, filtered_count, new_branches, elapsed_ms, process_ms, depth);
+
+        // AUX ring high-water mark / size, in KiB
+        #define LOG_IT(logfn)                                                                           \
+        logfn("%2zu %8" PRIu64 " %8" PRIu64 " %6" PRIu64 " %2zu /%2zu %8ldms %6" PRIu64 "/%-6zuK"     \
+              " %6" PRIu32 " %4.3g %c",                                                                 \
+            worker->id, count, filtered_count, new_branches, depth, max_depth, elapsed_ms,              \
+            worker->perf.aux_hwm / 1024, worker->perf.mmap_aux_sz / 1024,                              \
+            job.seen, job.seen_avg, job.from_corpus ? 'C' : 'Z');
+        if (new_branches > 0 || job.from_corpus || new_depth) {
+            LOG_IT(LOG_I);
+        } else {
+            LOG_IT(LOG_D);
+        }
+        #undef LOG_IT
+    }
+
+    if (worker->ret == EXIT_FAILURE)
+        keep_running = false;
+    zmq_close(receiver);
+    if (worker->capture != NULL) {
+        trace_close(worker->capture);
+        worker->capture = NULL;
+    }
+    // the session belongs to this thread, it must be torn down here
+    perf_session_destroy(&worker->perf);
+    return NULL;
+}
+
+
+// feeds this worker's share of the captured traces through the analysis
+static void *replay_loop(void *data)
+{
+    worker_t *worker = (worker_t *) data;
+    monitor_t *monitor = worker->monitor;
+    worker->ret = EXIT_SUCCESS;
+    worker_pin(worker);
+
+    size_t record_n = 0;
+    for (size_t i = 0; i < monitor->replay_n && keep_running; i++) {
+        trace_file_t *trace = trace_open(monitor->replay_paths[i]);
+        if (trace == NULL) {
+            worker->ret = EXIT_FAILURE;
+            break;
+        }
+
+        int read_ret;
+        trace_record_t record;
+        bts_branch_t *bts_start;
+        while (keep_running) {
+            // records go round robin over the workers, each reads every file
+            if (record_n++ % monitor->workers_n != worker->id) {
+                if ((read_ret = trace_skip(trace, &record)) != 1)
+                    break;
+                continue;
+            }
+            if ((read_ret = trace_read(trace, &record, &bts_start)) != 1)
+                break;
+
+            uint64_t new_branches = 0, filtered_count = 0, depth = 0;
+            long process_ms = get_time_ms();
+            if (process_branches(bts_start, record.count, worker, record.input_n,
+                                 &new_branches, &filtered_count, &depth) == -1) {
+                read_ret = -1;
+                break;
+            }
+            process_ms = get_time_ms() - process_ms;
+
+            bool new_depth = max_depth_raise(monitor, depth);
+            worker_stats_add(worker, record.count, filtered_count, new_branches,
+                             record.trace_ms, process_ms, depth);
+
+            #define LOG_IT(logfn)                                                       \
+            logfn("%2zu %8" PRIu64 " %8" PRIu64 " %6" PRIu64 " %2zu /%2zu %8" PRIu32   \
+                  "ms %8ldms %c", worker->id, record.count, filtered_count,             \
+                new_branches, depth, __atomic_load_n(&monitor->max_depth, __ATOMIC_RELAXED), \
+                record.trace_ms, process_ms, record.from_corpus ? 'C' : 'Z');
+            if (new_branches > 0 || new_depth) {
+                LOG_IT(LOG_I);
+            } else {
+                LOG_IT(LOG_D);
+            }
+            #undef LOG_IT
+        }
+        trace_close(trace);
+
+        if (read_ret == -1) {
+            worker->ret = EXIT_FAILURE;
+            break;
+        }
+    }
+
+    if (worker->ret == EXIT_FAILURE)
+        keep_running = false;
+    return NULL;
+}
+
+
+static void monitor_log_stats(worker_t *workers, size_t workers_n, TraceCache *cache,
+                              long elapsed_ms, bool per_worker)
+{
+    worker_stats_t total;
+    memset(&total, 0, sizeof(worker_stats_t));
+
+    for (size_t i = 0; i < workers_n; i++) {
+        worker_stats_t stats = {
+            STAT_GET(workers[i].stats.inputs),
+            STAT_GET(workers[i].stats.branches),
+            STAT_GET(workers[i].stats.filtered),
+            STAT_GET(workers[i].stats.new_branches),
+            STAT_GET(workers[i].stats.trace_ms),
+            STAT_GET(workers[i].stats.process_ms),
+            STAT_GET(workers[i].stats.max_depth),
+            STAT_GET(workers[i].stats.truncated),
+            STAT_GET(workers[i].stats.failed),
+        };
+        if (per_worker) {
+            LOG_I("worker %2zu (CPU %2d): %8" PRIu64 " inputs %10" PRIu64 " branches %10" PRIu64
+                  " filtered %6" PRIu64 " new, max depth %2" PRIu64 ", %8" PRIu64 "ms tracing"
+                  " %8" PRIu64 "ms processing, %" PRIu64 " truncated, %" PRIu64 " failed",
+                workers[i].id, workers[i].cpu, stats.inputs, stats.branches, stats.filtered,
+                stats.new_branches, stats.max_depth, stats.trace_ms, stats.process_ms,
+                stats.truncated, stats.failed);
+        }
+        total.inputs += stats.inputs;
+        total.branches += stats.branches;
+        total.filtered += stats.filtered;
+        total.new_branches += stats.new_branches;
+        total.trace_ms += stats.trace_ms;
+        total.process_ms += stats.process_ms;
+        if (stats.max_depth > total.max_depth)
+            total.max_depth = stats.max_depth;
+        total.truncated += stats.truncated;
+        total.failed += stats.failed;
+    }
+
+    char cache_line[128] = "";
+    if (cache != NULL) {
+        trace_cache_stats_t cache_stats;
+        trace_cache_stats(cache, &cache_stats);
+        snprintf(cache_line, sizeof(cache_line), ", cache %.1f%% hits of %" PRIu64 " (%zu/%zu, %"
+                 PRIu64 " evicted, %" PRIu64 " unstable)",
+            cache_stats.lookups > 0 ? 100.0 * cache_stats.hits / cache_stats.lookups : 0.0,
+            cache_stats.lookups, cache_stats.entries, cache_stats.capacity, cache_stats.evictions,
+            cache_stats.unstable);
+    }
+
+    const double elapsed_s = elapsed_ms > 0 ? elapsed_ms / 1000.0 : 0.001;
+    LOG_I("%zu workers: %8" PRIu64 " inputs (%.1f/s) %10" PRIu64 " branches (%.3g/s) %10" PRIu64
+          " filtered %6" PRIu64 " new, max depth %2" PRIu64 ", %" PRIu64 " truncated, %" PRIu64
+          " failed%s",
+        workers_n, total.inputs, total.inputs / elapsed_s, total.branches,
+        total.branches / elapsed_s, total.filtered, total.new_branches, total.max_depth,
+        total.truncated, total.failed, cache_line);
+}
+
+
+// how often an input was seen, over everything the fuzzers sent
+typedef struct monitor_seen {
+    HashTable *table;
+    double avg;
+    size_t total;
+    size_t max;
+    uint64_t max_k;
+} monitor_seen_t;
+
+
+static uint32_t monitor_seen_add(monitor_t *monitor, monitor_seen_t *seen, const uint8_t *data, size_t size,
+                                 uint64_t *hash)
+{
+    seen->total++;
+
+    uint64_t *buf_hash = malloc(sizeof(uint64_t));
+    assert(buf_hash != NULL);
+    // *buf_hash = hashtable_hash(buf, KEY_LENGTH_VARIABLE, 42);
+    *buf_hash = util_CRC64(data, size);
+    *hash = *buf_hash;
+    uint32_t *seen_inputs_value = NULL;
+    if (hashtable_get(seen->table, buf_hash, (void **) &seen_inputs_value) == CC_OK) {
+        (*seen_inputs_value)++;
+    } else {
+        seen_inputs_value = malloc(sizeof(uint32_t));
+        assert(seen_inputs_value != NULL);
+        *seen_inputs_value = 1;
+        assert(hashtable_add(seen->table, buf_hash, seen_inputs_value) == CC_OK);
+    }
+
+    if (*seen_inputs_value > seen->max) {
+        seen->max = *seen_inputs_value;
+        seen->max_k = *buf_hash;
+        // if we added buf_hash as key we must not free it
+        if (*seen_inputs_value > 1)
+            free(buf_hash);
+        LOG_I("max seen input: %16" PRIx64 " %zu", seen->max_k, seen->max);
+    } else if (*seen_inputs_value > 1) {
+        free(buf_hash);
+    }
+    seen->avg = seen->total / (double) hashtable_size(seen->table);
+    if (seen->avg > 2) {
+        LOG_I("total seen reset (%" PRIu64 ")", monitor->input_n);
+        seen->total = hashtable_size(seen->table);
+    }
+    return *seen_inputs_value;
+}
+
+
+static void monitor_seen_init(monitor_seen_t *seen, const snapshot_t *warm)
 {
     HashTableConf seen_inputs_table_conf;
     hashtable_conf_init(&seen_inputs_table_conf);
     seen_inputs_table_conf.hash = GENERAL_HASH;
     seen_inputs_table_conf.key_compare = cmp_uint64;
-    HashTable *seen_inputs_table = NULL;
-    assert(hashtable_new_conf(&seen_inputs_table_conf, &seen_inputs_table) == CC_OK);
-    double seen_avg = 0;
-    size_t seen_total = 0;
-    size_t max_seen_input = 0;
-    uint64_t max_seen_input_k = 0;
-    size_t max_depth = 0;
+    memset(seen, 0, sizeof(monitor_seen_t));
+    assert(hashtable_new_conf(&seen_inputs_table_conf, &seen->table) == CC_OK);
+    if (warm == NULL)
+        return;
+
+    for (uint64_t i = 0; i < warm->header->seen_n; i++) {
+        uint64_t *buf_hash = malloc(sizeof(uint64_t));
+        uint32_t *seen_inputs_value = malloc(sizeof(uint32_t));
+        assert(buf_hash != NULL && seen_inputs_value != NULL);
+        *buf_hash = warm->seen[i].hash;
+        *seen_inputs_value = warm->seen[i].count;
+        assert(hashtable_add(seen->table, buf_hash, seen_inputs_value) == CC_OK);
+        if (*seen_inputs_value > seen->max) {
+            seen->max = *seen_inputs_value;
+            seen->max_k = *buf_hash;
+        }
+    }
+    seen->total = hashtable_size(seen->table);
+    seen->avg = 1;
+}
 
+
+static void monitor_seen_free(monitor_seen_t *seen, bool print_seen_inputs)
+{
+    HashTableIter hti;
+    hashtable_iter_init(&hti, seen->table);
+    TableEntry *seen_inputs_entry;
+    while (hashtable_iter_next(&hti, &seen_inputs_entry) != CC_ITER_END) {
+        if (print_seen_inputs) {
+            LOG_I("%16" PRIx64 " %5" PRIu32,
+                *(uint64_t *) seen_inputs_entry->key,
+                *(uint32_t *) seen_inputs_entry->value);
+        }
+        free(seen_inputs_entry->key);
+        free(seen_inputs_entry->value);
+    }
+    hashtable_destroy(seen->table);
+}
+
+
+static void monitor_snapshot_edge(const edge_t *edge, void *data)
+{
+    snapshot_writer_t **writer = (snapshot_writer_t **) data;
+    if (*writer != NULL && snapshot_add_edge(*writer, edge) == -1) {
+        snapshot_abort(*writer);
+        *writer = NULL;
+    }
+}
+
+
+// saves coverage and seen inputs (if any) for the next run, while the
+// workers keep adding to the coverage
+static void monitor_snapshot(monitor_t *monitor, monitor_seen_t *seen)
+{
+    const long start_ms = get_time_ms();
+    snapshot_writer_t *writer = snapshot_create(monitor->snapshot_path, monitor->sut[0]);
+    coverage_map_foreach(monitor->branch_hits, &writer, monitor_snapshot_edge);
+    if (writer == NULL)
+        return;
+
+    if (seen != NULL) {
+        HashTableIter hti;
+        hashtable_iter_init(&hti, seen->table);
+        TableEntry *seen_inputs_entry;
+        while (hashtable_iter_next(&hti, &seen_inputs_entry) != CC_ITER_END) {
+            if (snapshot_add_seen(writer, *(uint64_t *) seen_inputs_entry->key,
+                                  *(uint32_t *) seen_inputs_entry->value) == -1) {
+                snapshot_abort(writer);
+                return;
+            }
+        }
+    }
+
+    const uint64_t edges_n = writer->header.edges_n, seen_n = writer->header.seen_n;
+    if (snapshot_commit(writer, __atomic_load_n(&monitor->max_depth, __ATOMIC_RELAXED),
+                        monitor->input_n) == 0) {
+        LOG_I("snapshot %s: %" PRIu64 " edges, %" PRIu64 " seen inputs in %ldms",
+            monitor->snapshot_path, edges_n, seen_n, get_time_ms() - start_ms);
+    }
+}
+
+
+// hands an input to the workers; msg, when given, holds the data and is
+// moved into the dispatcher instead of copied. Returns 1 once sent, 0 if it
+// was dropped as seen before (only when unique) or its trace is cached and
+// -1 on errors
+static int monitor_dispatch(monitor_t *monitor, monitor_seen_t *seen, void *dispatcher,
+                            const uint8_t *data, size_t size, zmq_msg_t *msg, bool from_corpus,
+                            bool unique)
+{
+    if (size > INPUT_MAX) {
+        LOG_W("input of %zu bytes, only the first %d are traced", size, INPUT_MAX);
+        size = INPUT_MAX;
+    }
+    uint64_t hash;
+    const uint32_t seen_n = monitor_seen_add(monitor, seen, data, size, &hash);
+    if (unique && seen_n > 1)
+        return 0;
+    trace_result_t cached;
+    if (seen_n > 1 && monitor->trace_cache != NULL && trace_cache_get(monitor->trace_cache, hash, &cached)) {
+        LOG_D("cached %016" PRIx64 " %6" PRIu32 ": %" PRIu32 " edges, depth %" PRIu32 " %c",
+            hash, seen_n, cached.edges_n, cached.depth, from_corpus ? 'C' : 'Z');
+        return 0;
+    }
+    monitor_job_t job = { monitor->input_n++, size, seen_n, seen->avg, from_corpus, hash };
+
+    // blocks while every worker queue is full, which throttles the fuzzers;
+    // once the header is in, the rest of the message can't be refused
+    while (zmq_send(dispatcher, &job, sizeof(job), ZMQ_SNDMORE) == -1) {
+        if (!keep_running)
+            return 1;
+        if (errno != EAGAIN && errno != EINTR) {
+            PLOG_F("failed to dispatch input");
+            return -1;
+        }
+    }
+    int ret;
+    do {
+        ret = msg != NULL ? zmq_msg_send(msg, dispatcher, 0) : zmq_send(dispatcher, data, size, 0);
+    } while (ret == -1 && errno == EINTR);
+    if (ret == -1) {
+        PLOG_F("failed to dispatch input");
+        return -1;
+    }
+    return 1;
+}
+
+
+// the corpus that was there at startup, traced before anything live
+typedef struct monitor_import {
+    Corpus *corpus;                 // NULL once everything is dispatched
+    size_t files;
+    size_t dispatched;
+    size_t duplicates;
+    long start_ms;
+    long log_ms;
+    bool done;                      // everything dispatched is traced
+} monitor_import_t;
+
+
+static void monitor_import_log(monitor_t *monitor, monitor_import_t *import,
+                               worker_t *workers, size_t workers_n)
+{
+    // imported inputs are the first ones, so the workers trace them first;
+    // those that failed are done with too
+    size_t traced = 0;
+    for (size_t i = 0; i < workers_n; i++)
+        traced += STAT_GET(workers[i].stats.inputs) + STAT_GET(workers[i].stats.failed);
+    if (traced > import->dispatched)
+        traced = import->dispatched;
+
+    const long now_ms = get_time_ms();
+    import->done = import->corpus == NULL && traced == import->dispatched;
+    if (!import->done && now_ms - import->log_ms < IMPORT_LOG_MS)
+        return;
+
+    const double elapsed_s = now_ms > import->start_ms ? (now_ms - import->start_ms) / 1000.0 : 0.001;
+    import->log_ms = now_ms;
+    LOG_I("corpus import%s: %zu/%zu files traced (%.1f/s), %zu duplicates, %zu edges, %.1fs",
+        import->done ? " done" : "", traced, import->files, traced / elapsed_s,
+        import->duplicates, coverage_map_size(monitor->branch_hits), elapsed_s);
+}
+
+
+// receives inputs from the fuzzers and the corpus and hands them to the workers
+static int monitor_loop(monitor_t *monitor, void *receiver, void *dispatcher,
+                        worker_t *workers, size_t workers_n, monitor_seen_t *seen)
+{
     int ret = EXIT_SUCCESS;
     int inotify_fd = inotify_init1(IN_NONBLOCK);
     if (inotify_fd == -1) {
@@ -392,146 +983,427 @@ static int monitor_loop(monitor_t *monitor, void *receiver, bool print_seen_inpu
         return EXIT_FAILURE;
     }
 
+    // the loop sleeps here until the fuzzers or the corpus have input
+    int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    struct epoll_event event = { .events = EPOLLIN, .data.fd = inotify_fd };
+    if (epoll_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, inotify_fd, &event) == -1) {
+        PLOG_F("failed to set up epoll");
+        close(inotify_fd);
+        return EXIT_FAILURE;
+    }
+
     int watch_d = 0;
     while (keep_running) {
         watch_d = inotify_add_watch(inotify_fd, monitor->fuzz_corpus_path, IN_CLOSE_WRITE | IN_DELETE_SELF);
         if (watch_d == -1) {
             if (errno == ENOENT) {
-                if (inotify_wait4_creation(inotify_fd, monitor->fuzz_corpus_path) == -1) {
+                if (inotify_wait4_creation(epoll_fd, inotify_fd, monitor->fuzz_corpus_path) == -1) {
+                    close(epoll_fd);
+                    close(inotify_fd);
                     return EXIT_FAILURE;
                 }
                 continue;
             }
             PLOG_F("failed to add inotify watch for %s", monitor->fuzz_corpus_path);
+            close(epoll_fd);
+            close(inotify_fd);
             return EXIT_FAILURE;
         }
         break;
     }
 
+    // zmq raises its fd on state changes only, ZMQ_EVENTS has the details
+    int zmq_fd = -1;
+    size_t zmq_fd_len = sizeof(zmq_fd);
+    zmq_getsockopt(receiver, ZMQ_FD, &zmq_fd, &zmq_fd_len);
+    event.data.fd = zmq_fd;
+    if (zmq_fd == -1 || epoll_ctl(epoll_fd, EPOLL_CTL_ADD, zmq_fd, &event) == -1) {
+        PLOG_F("failed to watch the zmq socket");
+        close(epoll_fd);
+        close(inotify_fd);
+        return EXIT_FAILURE;
+    }
+
+    Corpus *corpus = corpus_new(monitor->fuzz_corpus_path, inotify_fd, watch_d, INPUT_MAX);
+    assert(corpus != NULL);
+
+    // the watch is in place, so whatever the scan misses inotify reports
+    monitor_import_t import;
+    memset(&import, 0, sizeof(monitor_import_t));
+    import.done = true;
+    if (monitor->corpus_import) {
+        import.corpus = corpus_new(monitor->fuzz_corpus_path, -1, -1, INPUT_MAX);
+        assert(import.corpus != NULL);
+        int files = corpus_scan(import.corpus);
+        if (files == -1) {
+            ret = EXIT_FAILURE;
+            keep_running = false;
+        } else {
+            import.files = files;
+            import.done = false;
+            import.start_ms = import.log_ms = get_time_ms();
+            LOG_I("corpus import: %zu files in %s", import.files, monitor->fuzz_corpus_path);
+        }
+    }
+    RingSet *rings = ring_set_new();
+    assert(rings != NULL);
+    event.data.fd = ring_set_bell(rings);
+    if (event.data.fd != -1 && epoll_ctl(epoll_fd, EPOLL_CTL_ADD, event.data.fd, &event) == -1) {
+        PLOG_F("failed to watch the ring doorbell");
+        ret = EXIT_FAILURE;
+        keep_running = false;
+    }
+    zmq_msg_t msg;
+    zmq_msg_init(&msg);
+    bool more = false;
+    const long start_ms = get_time_ms();
+    long stats_ms = start_ms;
+    long snapshot_ms = start_ms;
+    long rings_ms = start_ms - RING_SCAN_MS;
+
     while (keep_running) {
-        bool from_corpus = false;
-        uint8_t buf[BUF_SZ];
-        int size = zmq_recv(receiver, buf, BUF_SZ, ZMQ_DONTWAIT);
-        if (size == -1) {
-            if (errno == EAGAIN) {
-                size = inotify_maybe_read(inotify_fd, watch_d, monitor->fuzz_corpus_path, buf, BUF_SZ);
-                if (size == -1) {
+        if (monitor->credits != NULL)
+            credits_alive(monitor->credits, get_time_ms());
+        if (get_time_ms() - rings_ms >= RING_SCAN_MS) {
+            rings_ms = get_time_ms();
+            ring_set_scan(rings);
+        }
+        if (get_time_ms() - stats_ms >= STATS_INTERVAL_MS) {
+            stats_ms = get_time_ms();
+            monitor_log_stats(workers, workers_n, monitor->trace_cache, stats_ms - start_ms, false);
+            ring_set_stats_t ring_stats;
+            ring_set_stats(rings, &ring_stats);
+            if (ring_stats.sent > 0 || ring_stats.dropped > 0) {
+                LOG_I("%zu rings: %" PRIu64 " inputs, %" PRIu64 " dropped by the preloads",
+                    ring_stats.rings, ring_stats.sent, ring_stats.dropped);
+            }
+        }
+        if (monitor->snapshot_path != NULL && get_time_ms() - snapshot_ms >= monitor->snapshot_interval_ms) {
+            monitor_snapshot(monitor, seen);
+            snapshot_ms = get_time_ms();
+        }
+        if (!import.done)
+            monitor_import_log(monitor, &import, workers, workers_n);
+
+        // the fuzzers wait until the startup corpus is dispatched, worker
+        // queues are short so it is mostly traced by the time they go
+        if (import.corpus != NULL) {
+            size_t import_n = 0;
+            corpus_file_t file;
+            while (keep_running && import_n < INGEST_BATCH && corpus_next(import.corpus, &file)) {
+                import_n++;
+                int sent = monitor_dispatch(monitor, seen, dispatcher, file.data, file.size, NULL,
+                                            true, true);
+                if (sent == -1) {
                     ret = EXIT_FAILURE;
-                    break;
-                } else if (size == 0) {
-                    usleep(10);
-                    continue;
+                    keep_running = false;
+                } else if (sent == 0) {
+                    import.duplicates++;
+                } else {
+                    import.dispatched++;
                 }
-                from_corpus = true;
-            } else if (!keep_running) {
-                break;
-            } else {
+                corpus_file_release(&file);
+            }
+            if (import_n > 0)
+                continue;
+            corpus_destroy(import.corpus);
+            import.corpus = NULL;
+        }
+
+        // everything the fuzzers have queued, up to a batch; a preload may
+        // send a batch of inputs as one multipart message, a frame each
+        size_t fuzzer_n = 0;
+        while (keep_running && fuzzer_n < INGEST_BATCH) {
+            if (zmq_msg_recv(&msg, receiver, ZMQ_DONTWAIT) == -1) {
+                if (errno == EAGAIN || errno == EINTR || !keep_running)
+                    break;
                 PLOG_F("failed to receive from zmq");
                 ret = EXIT_FAILURE;
+                keep_running = false;
                 break;
             }
-        }
-        seen_total++;
+            fuzzer_n++;
 
-        uint64_t *buf_hash = malloc(sizeof(uint64_t));
-        // *buf_hash = hashtable_hash(buf, KEY_LENGTH_VARIABLE, 42);
-        *buf_hash = util_CRC64(buf, size);
-        uint32_t *seen_inputs_value = NULL;
-        if (hashtable_get(seen_inputs_table, buf_hash, (void **) &seen_inputs_value) == CC_OK) {
-            (*seen_inputs_value)++;
-        } else {
-            seen_inputs_value = malloc(sizeof(uint32_t));
-            assert(seen_inputs_value != NULL);
-            *seen_inputs_value = 1;
-            assert(hashtable_add(seen_inputs_table, buf_hash, seen_inputs_value) == CC_OK);
-        }
-
-        if (*seen_inputs_value > max_seen_input) {
-            max_seen_input = *seen_inputs_value;
-            max_seen_input_k = *buf_hash;
-            // if we added buf_hash as key we must not free it
-            if (*seen_inputs_value > 1)
-                free(buf_hash);
-            LOG_I("max seen input: %16" PRIx64 " %zu", max_seen_input_k, max_seen_input);
-        } else if (*seen_inputs_value > 1) {
-            free(buf_hash);
+            // an empty last frame only closes a batch the preload left open
+            const bool closes_batch = more && !zmq_msg_more(&msg);
+            more = zmq_msg_more(&msg);
+            if (closes_batch && zmq_msg_size(&msg) == 0)
+                continue;
+
+            int sent = monitor_dispatch(monitor, seen, dispatcher, zmq_msg_data(&msg), zmq_msg_size(&msg),
+                                        &msg, false, false);
+            if (sent == -1) {
+                ret = EXIT_FAILURE;
+                keep_running = false;
+            } else if (sent == 0 && monitor->credits != NULL) {
+                // cached, done with it already
+                credits_grant(monitor->credits, 1);
+            }
         }
-        seen_avg = seen_total / (double) hashtable_size(seen_inputs_table);
-        if (seen_avg > 2) {
-            LOG_I("total seen reset (%" PRIu64 ")", monitor->input_n);
-            seen_total = hashtable_size(seen_inputs_table);
+
+        // and what the preloads put in shared memory, dispatched from there;
+        // a ring that fills after this rings the doorbell again
+        ring_set_wake(rings);
+        const uint8_t *ring_data;
+        size_t ring_size;
+        while (keep_running && fuzzer_n < INGEST_BATCH && ring_set_next(rings, &ring_data, &ring_size)) {
+            fuzzer_n++;
+            int sent = monitor_dispatch(monitor, seen, dispatcher, ring_data, ring_size, NULL, false, false);
+            ring_set_release(rings);
+            if (sent == -1) {
+                ret = EXIT_FAILURE;
+                keep_running = false;
+            } else if (sent == 0 && monitor->credits != NULL) {
+                credits_grant(monitor->credits, 1);
+            }
         }
 
-        bts_branch_t *bts_start;
-        uint64_t count;
-        long start_ms = get_time_ms();
-        if (perf_monitor_api(buf, size, monitor->sut, &bts_start, &count) == PERF_FAILURE) {
-            LOG_F("failed perf monitoring");
+        // whatever the fuzzers synced, in one go, then a batch of the files
+        if (keep_running && corpus_poll(corpus) == -1) {
             ret = EXIT_FAILURE;
             break;
         }
-        long elapsed_ms = get_time_ms() - start_ms;
+        size_t corpus_n = 0;
+        corpus_file_t file;
+        while (keep_running && corpus_n < INGEST_BATCH && corpus_next(corpus, &file)) {
+            corpus_n++;
+            if (monitor_dispatch(monitor, seen, dispatcher, file.data, file.size, NULL, true, false) == -1) {
+                ret = EXIT_FAILURE;
+                keep_running = false;
+            }
+            corpus_file_release(&file);
+        }
 
-        uint64_t new_branches = 0, filtered_count = 0, depth = 0;
-        if (process_branches(bts_start, count, monitor, &new_branches, &filtered_count, &depth) == -1) {
+        if (fuzzer_n > 0 || corpus_n > 0 || !keep_running)
+            continue;
+
+        // an interrupted receive may have left messages the fd won't announce
+        int zmq_events = 0;
+        size_t zmq_events_len = sizeof(zmq_events);
+        if (zmq_getsockopt(receiver, ZMQ_EVENTS, &zmq_events, &zmq_events_len) == 0
+            && (zmq_events & ZMQ_POLLIN))
+            continue;
+
+        // sleeps until any has input; the timeout catches failed workers
+        struct epoll_event events[3];
+        const int timeout_ms = ring_set_size(rings) > 0 && ring_set_bell(rings) == -1
+            ? RING_POLL_MS : POLL_TIMEOUT_MS;
+        if (epoll_wait(epoll_fd, events, 3, timeout_ms) == -1 && errno != EINTR) {
+            PLOG_F("failed to wait for inputs");
             ret = EXIT_FAILURE;
             break;
         }
+    }
+
+    keep_running = false;
+    zmq_msg_close(&msg);
+    ring_set_destroy(rings);
+    if (import.corpus != NULL)
+        corpus_destroy(import.corpus);
+    corpus_destroy(corpus);
+    close(epoll_fd);
+    close(inotify_fd);
 
-        bool new_depth = false;
-        if (depth > max_depth) {
-            max_depth = depth;
-            new_depth = true;
+    monitor_log_stats(workers, workers_n, monitor->trace_cache, get_time_ms() - start_ms, true);
+    return ret;
+}
+
+
+// one worker per CPU we may run on (or n of them round robin), each pinned
+static worker_t *workers_new(monitor_t *monitor, size_t *workers_n)
+{
+    cpu_set_t allowed;
+    int cpus[CPU_SETSIZE];
+    size_t cpus_n = 0;
+    if (sched_getaffinity(0, sizeof(cpu_set_t), &allowed) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+            if (CPU_ISSET(cpu, &allowed))
+                cpus[cpus_n++] = cpu;
         }
+    } else {
+        PLOG_W("failed to get CPU affinity, workers will not be pinned");
+    }
 
-        #define LOG_IT(logfn)                                                                   \
-        logfn("%8" PRIu64 " %8" PRIu64 " %6" PRIu64 " %2zu /%2zu %8ldms %6" PRIu32 " %4.3g %c", \
-            count, filtered_count, new_branches, depth, max_depth, elapsed_ms,                  \
-            *seen_inputs_value, seen_avg, from_corpus ? 'C' : 'Z');
-        if (new_branches > 0 || from_corpus || new_depth) {
-            LOG_IT(LOG_I);
-        } else {
-            LOG_IT(LOG_D);
+    if (*workers_n == 0)
+        *workers_n = cpus_n > 0 ? cpus_n : 1;
+
+    worker_t *workers = calloc(*workers_n, sizeof(worker_t));
+    assert(workers != NULL);
+    for (size_t i = 0; i < *workers_n; i++) {
+        worker_t *worker = &workers[i];
+        worker->id = i;
+        worker->cpu = cpus_n > 0 ? cpus[i % cpus_n] : -1;
+        worker->monitor = monitor;
+        perf_session_init(&worker->perf);
+        perf_session_buffers(&worker->perf, monitor->data_pages, monitor->aux_pages, monitor->aux_auto);
+        if ((worker->graph = graph_new()) == NULL
+            || (worker->trace_hits = edge_map_new(TRACE_EDGES_CAP)) == NULL) {
+            LOG_F("failed to create graph and edge map of worker %zu", i);
+            *workers_n = i + 1;
+            return workers;
         }
-        #undef LOG_IT
+    }
+    return workers;
+}
+
 
-        monitor->input_n++;
+static void workers_destroy(worker_t *workers, size_t workers_n)
+{
+    for (size_t i = 0; i < workers_n; i++) {
+        if (workers[i].graph)
+            graph_destroy(workers[i].graph);
+        if (workers[i].trace_hits)
+            edge_map_destroy(workers[i].trace_hits);
+        free(workers[i].export_edges);
     }
+    free(workers);
+}
 
-    close(inotify_fd);
 
-    HashTableIter hti;
-    hashtable_iter_init(&hti, seen_inputs_table);
-    TableEntry *seen_inputs_entry;
-    while (hashtable_iter_next(&hti, &seen_inputs_entry) != CC_ITER_END) {
-        if (print_seen_inputs) {
-            LOG_I("%16" PRIx64 " %5" PRIu32,
-                *(uint64_t *) seen_inputs_entry->key,
-                *(uint32_t *) seen_inputs_entry->value);
+static void workers_start(worker_t *workers, size_t workers_n, void *(*loop)(void *))
+{
+    for (size_t i = 0; i < workers_n; i++) {
+        int err = pthread_create(&workers[i].thread, NULL, loop, &workers[i]);
+        if (err != 0) {
+            LOG_F("failed to start worker %zu (%s)", i, strerror(err));
+            keep_running = false;
+            return;
         }
-        free(seen_inputs_entry->key);
-        free(seen_inputs_entry->value);
+        workers[i].started = true;
+    }
+}
+
+
+static int workers_join(worker_t *workers, size_t workers_n)
+{
+    int ret = EXIT_SUCCESS;
+    for (size_t i = 0; i < workers_n; i++) {
+        if (!workers[i].started)
+            continue;
+        pthread_join(workers[i].thread, NULL);
+        workers[i].started = false;
+        if (workers[i].ret != EXIT_SUCCESS)
+            ret = EXIT_FAILURE;
+    }
+    return ret;
+}
+
+
+static int monitor_live(monitor_t *monitor, worker_t *workers, size_t workers_n, bool print_seen_inputs)
+{
+    int ret = EXIT_FAILURE;
+    void *receiver = NULL, *dispatcher = NULL;
+    void *context = zmq_ctx_new();
+    if (context == NULL) {
+        LOG_F("failed to create new zmq context");
+        return EXIT_FAILURE;
+    }
+    monitor->zmq_context = context;
+    monitor_seen_t seen;
+    monitor_seen_init(&seen, monitor->warm);
+
+    receiver = zmq_socket(context, ZMQ_PULL);
+    if (receiver == NULL) {
+        PLOG_F("failed to create socket");
+        goto out;
+    }
+    if (zmq_bind(receiver, "tcp://*:5558") == -1) {
+        PLOG_F("failed to connect to socket");
+        goto out;
+    }
+    // workers connect here and get inputs round robin
+    dispatcher = zmq_socket(context, ZMQ_PUSH);
+    if (dispatcher == NULL) {
+        PLOG_F("failed to create socket");
+        goto out;
+    }
+    const int hwm = WORKER_QUEUE, timeout = WORKER_TIMEOUT_MS;
+    zmq_setsockopt(dispatcher, ZMQ_SNDHWM, &hwm, sizeof(hwm));
+    zmq_setsockopt(dispatcher, ZMQ_SNDTIMEO, &timeout, sizeof(timeout));
+    if (zmq_bind(dispatcher, WORKERS_ENDPOINT) == -1) {
+        PLOG_F("failed to bind %s", WORKERS_ENDPOINT);
+        goto out;
     }
-    hashtable_destroy(seen_inputs_table);
 
+    // without credits the preloads fall back to sampling at a fixed rate
+    if ((monitor->credits = credits_create(workers_n * CREDITS_PER_WORKER)) != NULL)
+        credits_alive(monitor->credits, get_time_ms());
+    workers_start(workers, workers_n, worker_loop);
+    LOG_I("listening with %zu workers...", workers_n);
+    if (keep_running)
+        ret = monitor_loop(monitor, receiver, dispatcher, workers, workers_n, &seen);
+    keep_running = false;
+    if (workers_join(workers, workers_n) != EXIT_SUCCESS)
+        ret = EXIT_FAILURE;
+    if (monitor->snapshot_path != NULL)
+        monitor_snapshot(monitor, &seen);
+    if (monitor->credits != NULL) {
+        credits_destroy(monitor->credits);
+        monitor->credits = NULL;
+    }
+
+out:
+    if (dispatcher != NULL)
+        zmq_close(dispatcher);
+    if (receiver != NULL)
+        zmq_close(receiver);
+    zmq_ctx_destroy(context);
+    monitor_seen_free(&seen, print_seen_inputs);
+    return ret;
+}
+
+
+static int monitor_replay(monitor_t *monitor, worker_t *workers, size_t workers_n)
+{
+    LOG_I("replaying %zu traces with %zu workers...", monitor->replay_n, workers_n);
+    const long start_ms = get_time_ms();
+    workers_start(workers, workers_n, replay_loop);
+    int ret = workers_join(workers, workers_n);
+    monitor_log_stats(workers, workers_n, NULL, get_time_ms() - start_ms, true);
+    if (monitor->snapshot_path != NULL)
+        monitor_snapshot(monitor, NULL);
     return ret;
 }
 
 
+// carries on from the last snapshot: its edges are loaded with the coverage
+// map, seen inputs by monitor_live()
+static void monitor_warm_start(monitor_t *monitor, long start_ms)
+{
+    const snapshot_t *warm = monitor->warm;
+    monitor->max_depth = warm->header->max_depth;
+    monitor->input_n = warm->header->input_n;
+    LOG_I("warm start from %s: %" PRIu64 " edges, %" PRIu64 " seen inputs, max depth %zu, "
+          "input %zu (%ldms)", monitor->snapshot_path, warm->header->edges_n, warm->header->seen_n,
+        monitor->max_depth, monitor->input_n, get_time_ms() - start_ms);
+}
+
+
 void free_monitor(monitor_t *monitor)
 {
     if (monitor->sec_bounds)
         free(monitor->sec_bounds);
     if (monitor->bbs)
         free(monitor->bbs);
+    if (monitor->bb_index)
+        bb_index_destroy(monitor->bb_index);
+    free((char *) monitor->replay_sut[0]);
+    if (monitor->warm)
+        snapshot_close(monitor->warm);
+    if (monitor->trace_cache)
+        trace_cache_destroy(monitor->trace_cache);
     free(monitor);
 }
 
 
 void usage(const char *progname)
 {
-    printf("usage: %s [-g graph.gv] [-t path] [-s .section] [-i] -b r2bb.sh "
-           "-c corpus -- command [args]\n", progname);
+    printf("usage: %s [-g graph.gv] [-G graph.fmg] [-t graphs_dir] [-D] [-W] [-s .section] [-i] [-f forksrv.so] "
+           "[-d scc|entry|bfs] [-j workers] [-m delta|direct] [-w capture_dir] "
+           "[-p data_pages] [-a aux_pages] [-A] [-M budget_MiB] [-S] [-k snapshot] [-K secs] [-C cache_MiB] [-E lru|fifo] -b r2bb.sh -c corpus -- command [args]\n"
+           "       %s [-g graph.gv] [-G graph.fmg] [-t graphs_dir] [-D] [-W] [-s .section] [-d mode] [-j workers] [-m mode] "
+           "[-b r2bb.sh] -r trace.bts [-r trace.bts ...] [-- command]\n"
+           "       %s -x graph.fmg\n", progname, progname, progname);
 }
 
 
@@ -539,20 +1411,28 @@ int main(int argc, char const *argv[])
 {
     log_level = INFO;
     char *graph_filename = NULL;
+    char *graph_export_filename = NULL;
+    char *graph_convert = NULL;
     char *sec_name = NULL;
     bool print_seen_inputs = false;
     char *basic_block_script = NULL;
+    size_t workers_n = 1;
 
     monitor_t *monitor = malloc(sizeof(monitor_t));
     assert(monitor != NULL);
     memset(monitor, 0, sizeof(monitor_t));
+    monitor->merge_delta = true;
+    monitor->snapshot_interval_ms = SNAPSHOT_INTERVAL_S * 1000;
 
     int opt;
-    while ((opt = getopt(argc, (char * const *) argv, "g:s:ib:t:c:")) != -1) {
+    while ((opt = getopt(argc, (char * const *) argv, "g:G:s:ib:t:DWx:c:f:d:j:m:w:r:p:a:AM:Sk:K:C:E:")) != -1) {
         switch (opt) {
         case 'g':
             graph_filename = optarg;
             break;
+        case 'G':
+            graph_export_filename = optarg;
+            break;
         case 's':
             sec_name = optarg;
             break;
@@ -565,9 +1445,100 @@ int main(int argc, char const *argv[])
         case 't':
             monitor->graph_indiv_path = optarg;
             break;
+        case 'D':
+            monitor->graph_delta = true;
+            break;
+        case 'W':
+            monitor->graph_async = true;
+            break;
+        case 'x':
+            graph_convert = optarg;
+            break;
         case 'c':
             monitor->fuzz_corpus_path = optarg;
             break;
+        case 'f':
+            monitor->forksrv_preload = optarg;
+            break;
+        case 'j':
+            // 0 is one worker per CPU
+            workers_n = strtoul(optarg, NULL, 10);
+            break;
+        case 'w':
+            monitor->capture_path = optarg;
+            break;
+        case 'p':
+            monitor->data_pages = strtoul(optarg, NULL, 10);
+            break;
+        case 'a':
+            monitor->aux_pages = strtoul(optarg, NULL, 10);
+            break;
+        case 'A':
+            // -a is then the smallest the AUX ring shrinks to
+            monitor->aux_auto = true;
+            break;
+        case 'k':
+            monitor->snapshot_path = optarg;
+            break;
+        case 'K':
+            monitor->snapshot_interval_ms = strtol(optarg, NULL, 10) * 1000;
+            break;
+        case 'S':
+            monitor->corpus_import = true;
+            break;
+        case 'C':
+            // 0, the default, traces every input however often it's seen
+            monitor->trace_cache_sz = strtoul(optarg, NULL, 10) * 1024 * 1024;
+            break;
+        case 'E':
+            if (strcmp(optarg, "lru") == 0) {
+                monitor->trace_cache_policy = TRACE_CACHE_LRU;
+            } else if (strcmp(optarg, "fifo") == 0) {
+                monitor->trace_cache_policy = TRACE_CACHE_FIFO;
+            } else {
+                LOG_E("unknown cache eviction policy %s", optarg);
+                free_monitor(monitor);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'M':
+            perf_set_budget(strtoul(optarg, NULL, 10) * 1024 * 1024);
+            break;
+        case 'r':
+            if (monitor->replay_n == REPLAY_MAX) {
+                LOG_E("at most %d traces can be replayed", REPLAY_MAX);
+                free_monitor(monitor);
+                exit(EXIT_FAILURE);
+            }
+            monitor->replay_paths[monitor->replay_n++] = optarg;
+            break;
+        case 'm':
+            if (strcmp(optarg, "delta") == 0) {
+                monitor->merge_delta = true;
+            } else if (strcmp(optarg, "direct") == 0) {
+                monitor->merge_delta = false;
+            } else {
+                LOG_E("unknown merge mode %s", optarg);
+                free_monitor(monitor);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
+        case 'd':
+            if (strcmp(optarg, "scc") == 0) {
+                monitor->depth_mode = GRAPH_DEPTH_SCC;
+            } else if (strcmp(optarg, "entry") == 0) {
+                monitor->depth_mode = GRAPH_DEPTH_ENTRY;
+            } else if (strcmp(optarg, "bfs") == 0) {
+                monitor->depth_mode = GRAPH_DEPTH_BFS;
+            } else {
+                LOG_E("unknown depth mode %s", optarg);
+                free_monitor(monitor);
+                usage(argv[0]);
+                exit(EXIT_FAILURE);
+            }
+            break;
         // default:
         //     free_monitor(monitor);
         //     usage(argv[0]);
@@ -575,13 +1546,34 @@ int main(int argc, char const *argv[])
         }
     }
 
-    if (argc == optind || basic_block_script == NULL || monitor->fuzz_corpus_path == NULL) {
+    if (graph_convert != NULL) {
+        int graphs_n = export_to_gv(graph_convert);
+        if (graphs_n >= 0)
+            LOG_I("wrote %d graphs of %s", graphs_n, graph_convert);
+        free_monitor(monitor);
+        exit(graphs_n >= 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
+    const bool replay = monitor->replay_n > 0;
+    if (!replay && (argc == optind || basic_block_script == NULL || monitor->fuzz_corpus_path == NULL)) {
         free_monitor(monitor);
         usage(argv[0]);
         exit(EXIT_FAILURE);
     }
 
-    monitor->sut = argv + optind;
+    if (argc > optind) {
+        monitor->sut = argv + optind;
+    } else {
+        // the binary the first trace was captured from
+        trace_file_t *trace = trace_open(monitor->replay_paths[0]);
+        if (trace == NULL) {
+            free_monitor(monitor);
+            exit(EXIT_FAILURE);
+        }
+        monitor->replay_sut[0] = strdup(trace->sut);
+        trace_close(trace);
+        monitor->sut = monitor->replay_sut;
+    }
 
     if (sec_name) {
         monitor->sec_bounds = malloc(sizeof(section_bounds_t));
@@ -600,8 +1592,15 @@ int main(int argc, char const *argv[])
     } else {
         LOG_I("monitoring on %s (all code)", monitor->sut[0]);
     }
+    // branches are brought back to it, wherever the SUT runs
+    ElfIndex *elf = elf_index_open(monitor->sut[0]);
+    if (elf != NULL) {
+        monitor->image_vaddr = elf_index_base(elf);
+        elf_index_close(elf);
+    }
 
-    monitor->bbs_n = basic_blocks_find(basic_block_script, monitor->sut[0], &monitor->bbs);
+    if (basic_block_script != NULL)
+        monitor->bbs_n = basic_blocks_find(basic_block_script, monitor->sut[0], &monitor->bbs);
     if (monitor->bbs_n < 0) {
         LOG_F("failed reading basic blocks");
         free_monitor(monitor);
@@ -611,38 +1610,63 @@ int main(int argc, char const *argv[])
     for (size_t i = 0; i < monitor->bbs_n; i++) {
         LOG_D("BB 0x%08" PRIx64 " 0x%08" PRIx64, monitor->bbs[i].from, monitor->bbs[i].to);
     }
-
-    void *context = zmq_ctx_new();
-    if (context == NULL) {
-        LOG_F("failed to create new zmq context");
-        free_monitor(monitor);
-        exit(EXIT_FAILURE);
-    }
-    void *receiver = zmq_socket(context, ZMQ_PULL);
-    if (receiver == NULL) {
-        PLOG_F("failed to create socket");
-        free_monitor(monitor);
-        exit(EXIT_FAILURE);
+    monitor->bb_index = bb_index_new(monitor->bbs, monitor->bbs_n);
+    LOG_I("indexed basic blocks in %zu ranges", monitor->bb_index->n);
+
+    size_t edges_cap = EDGES_CAP;
+    if (monitor->snapshot_path != NULL) {
+        monitor->warm = snapshot_open(monitor->snapshot_path, monitor->sut[0]);
+        if (monitor->warm != NULL && monitor->warm->header->edges_n * 2 > edges_cap)
+            edges_cap = monitor->warm->header->edges_n * 2;
     }
-    if (zmq_bind(receiver, "tcp://*:5558") == -1) {
-        PLOG_F("failed to connect to socket");
-        free_monitor(monitor);
-        exit(EXIT_FAILURE);
+
+    if (!replay && monitor->trace_cache_sz > 0) {
+        if ((monitor->trace_cache = trace_cache_new(monitor->trace_cache_sz, monitor->trace_cache_policy)) == NULL) {
+            LOG_F("failed to create a trace cache of %zu bytes", monitor->trace_cache_sz);
+            free_monitor(monitor);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    LOG_I("listening...");
+    if (monitor->graph_indiv_path != NULL) {
+        char export_path[PATH_MAX];
+        snprintf(export_path, PATH_MAX, "%s/graphs.fmg", monitor->graph_indiv_path);
+        if ((monitor->graph_export = export_create(export_path, monitor->sut[0], monitor->graph_async)) == NULL) {
+            free_monitor(monitor);
+            exit(EXIT_FAILURE);
+        }
+    }
 
     int ret = EXIT_FAILURE;
-    if (hashtable_new(&monitor->branch_hits) != CC_OK) {
-        LOG_F("failed to create hashtable");
+    worker_t *workers = workers_new(monitor, &workers_n);
+    monitor->workers_n = workers_n;
+    // a warm start begins with the snapshot's coverage, taken from its mapping
+    const long load_ms = get_time_ms();
+    if (monitor->warm != NULL)
+        monitor->branch_hits = coverage_map_load(edges_cap, monitor->warm->edges, monitor->warm->header->edges_n);
+    else
+        monitor->branch_hits = coverage_map_new(edges_cap);
+    if (monitor->branch_hits == NULL
+        || workers[workers_n - 1].trace_hits == NULL) {
+        LOG_F("failed to create edge maps and graphs");
+        if (monitor->branch_hits != NULL)
+            coverage_map_destroy(monitor->branch_hits);
     } else {
+        if (monitor->warm != NULL)
+            monitor_warm_start(monitor, load_ms);
         signal(SIGINT, int_sig_handler);
-        ret = monitor_loop(monitor, receiver, print_seen_inputs);
-        free_hashtable(monitor->branch_hits, graph_filename);
+        // a fork server or launcher that died fails its trace, not the monitor
+        signal(SIGPIPE, SIG_IGN);
+        if (replay)
+            ret = monitor_replay(monitor, workers, workers_n);
+        else
+            ret = monitor_live(monitor, workers, workers_n, print_seen_inputs);
+        free_branch_hits(monitor, graph_filename, graph_export_filename);
     }
 
-    zmq_close(receiver);
-    zmq_ctx_destroy(context);
+    if (monitor->graph_export != NULL && export_close(monitor->graph_export) == -1)
+        ret = EXIT_FAILURE;
+    workers_destroy(workers, workers_n);
     free_monitor(monitor);
     return ret;
 }
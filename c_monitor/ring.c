@@ -0,0 +1,234 @@
+#define _GNU_SOURCE
+#include "ring.h"
+#include <perf/log.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <linux/limits.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define RING_SET_MAX    64
+#define RING_SHM_DIR    "/dev/shm"
+
+
+typedef struct ring_map {
+    ring_t *ring;
+    size_t map_size;
+    char name[NAME_MAX + 1];
+} ring_map_t;
+
+struct ring_set_s {
+    int bell_fd;                // -1 without a doorbell, the rings are polled
+    ring_map_t maps[RING_SET_MAX];
+    size_t n;
+    size_t next;                // where the round robin goes on
+    ring_t *current;            // of the record handed out, until released
+    uint64_t current_len;
+    uint64_t gone_sent;         // of the rings dropped already
+    uint64_t gone_dropped;
+};
+
+
+RingSet *ring_set_new(void)
+{
+    RingSet *set = malloc(sizeof(RingSet));
+    if (set == NULL)
+        return NULL;
+    memset(set, 0, sizeof(RingSet));
+
+    struct sockaddr_un addr;
+    const socklen_t addr_len = ring_bell_addr(&addr);
+    set->bell_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (set->bell_fd != -1 && bind(set->bell_fd, (struct sockaddr *) &addr, addr_len) == -1) {
+        PLOG_W("no doorbell for the rings, they are polled");
+        close(set->bell_fd);
+        set->bell_fd = -1;
+    }
+    return set;
+}
+
+
+static void ring_set_drop(RingSet *set, size_t i, bool unlink)
+{
+    ring_map_t *map = &set->maps[i];
+    set->gone_sent += __atomic_load_n(&map->ring->sent, __ATOMIC_RELAXED);
+    set->gone_dropped += __atomic_load_n(&map->ring->dropped, __ATOMIC_RELAXED);
+    LOG_I("ring %s gone, %" PRIu64 " inputs, %" PRIu64 " dropped", map->name,
+        __atomic_load_n(&map->ring->sent, __ATOMIC_RELAXED),
+        __atomic_load_n(&map->ring->dropped, __ATOMIC_RELAXED));
+
+    if (unlink) {
+        char shm_name[NAME_MAX + 2];
+        snprintf(shm_name, sizeof(shm_name), "/%s", map->name);
+        shm_unlink(shm_name);
+    }
+    munmap(map->ring, map->map_size);
+    set->maps[i] = set->maps[--set->n];
+}
+
+
+void ring_set_destroy(RingSet *set)
+{
+    while (set->n > 0)
+        ring_set_drop(set, set->n - 1, false);
+    if (set->bell_fd != -1)
+        close(set->bell_fd);
+    free(set);
+}
+
+
+static void ring_set_map(RingSet *set, const char *name)
+{
+    char shm_name[NAME_MAX + 2];
+    snprintf(shm_name, sizeof(shm_name), "/%s", name);
+    int fd = shm_open(shm_name, O_RDWR, 0);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    const size_t map_size = st.st_size;
+    ring_t *ring = map_size >= sizeof(ring_t)
+        ? mmap(NULL, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0) : MAP_FAILED;
+    close(fd);
+    if (ring == MAP_FAILED)
+        return;
+
+    // still being set up otherwise, the next scan gets it
+    const uint64_t size = __atomic_load_n(&ring->magic, __ATOMIC_ACQUIRE) == RING_MAGIC ? ring->size : 0;
+    if (size == 0 || (size & (size - 1)) != 0 || size > map_size - sizeof(ring_t)) {
+        munmap(ring, map_size);
+        return;
+    }
+
+    ring_map_t *map = &set->maps[set->n++];
+    map->ring = ring;
+    map->map_size = map_size;
+    snprintf(map->name, sizeof(map->name), "%s", name);
+    LOG_I("ring %s of %" PRIu64 " KiB", name, size / 1024);
+}
+
+
+// maps the rings of new preloads, drops those of preloads that are gone
+void ring_set_scan(RingSet *set)
+{
+    for (size_t i = set->n; i-- > 0; ) {
+        ring_t *ring = set->maps[i].ring;
+        if (ring == set->current)
+            continue;
+        const bool closed = __atomic_load_n(&ring->closed, __ATOMIC_ACQUIRE);
+        const bool dead = !closed && kill(ring->pid, 0) == -1 && errno == ESRCH;
+        if ((closed || dead) && __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == ring->tail)
+            ring_set_drop(set, i, dead);
+    }
+
+    DIR *dir = opendir(RING_SHM_DIR);
+    if (dir == NULL)
+        return;
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL && set->n < RING_SET_MAX) {
+        if (strncmp(entry->d_name, RING_SHM_PREFIX, strlen(RING_SHM_PREFIX)) != 0)
+            continue;
+        bool mapped = false;
+        for (size_t i = 0; i < set->n && !mapped; i++)
+            mapped = strcmp(set->maps[i].name, entry->d_name) == 0;
+        if (!mapped)
+            ring_set_map(set, entry->d_name);
+    }
+    closedir(dir);
+}
+
+
+// the fd the monitor waits on for the rings, -1 if it has to poll them
+int ring_set_bell(RingSet *set)
+{
+    return set->bell_fd;
+}
+
+
+// empties the doorbell, a ring not mapped yet is looked for right away
+void ring_set_wake(RingSet *set)
+{
+    if (set->bell_fd == -1)
+        return;
+    bool unknown = false;
+    int32_t tid;
+    while (recv(set->bell_fd, &tid, sizeof(tid), MSG_DONTWAIT) == sizeof(tid)) {
+        bool mapped = false;
+        for (size_t i = 0; i < set->n && !mapped; i++)
+            mapped = set->maps[i].ring->tid == tid;
+        unknown |= !mapped;
+    }
+    if (unknown)
+        ring_set_scan(set);
+}
+
+
+// the next input of any ring, in place; release it once dispatched
+bool ring_set_next(RingSet *set, const uint8_t **data, size_t *size)
+{
+    assert(set->current == NULL);
+    for (size_t k = 0; k < set->n; k++) {
+        const size_t i = (set->next + k) % set->n;
+        ring_t *ring = set->maps[i].ring;
+        const uint64_t mask = ring->size - 1;
+
+        uint64_t head = __atomic_load_n(&ring->head, __ATOMIC_SEQ_CST);
+        uint64_t off = ring->tail & mask;
+        if (ring->tail != head && *(uint32_t *) (ring_data(ring) + off) == RING_WRAP) {
+            __atomic_store_n(&ring->tail, ring->tail + ring->size - off, __ATOMIC_RELEASE);
+            off = 0;
+        }
+        if (ring->tail == head)
+            continue;
+
+        const uint32_t len = *(uint32_t *) (ring_data(ring) + off);
+        if (RING_RECORD(len) > ring->size - off || RING_RECORD(len) > head - ring->tail) {
+            LOG_E("ring %s is corrupt, resetting it", set->maps[i].name);
+            __atomic_store_n(&ring->tail, head, __ATOMIC_RELEASE);
+            continue;
+        }
+        *data = ring_data(ring) + off + sizeof(uint32_t);
+        *size = len;
+        set->current = ring;
+        set->current_len = RING_RECORD(len);
+        set->next = i + 1;
+        return true;
+    }
+    return false;
+}
+
+
+// hands the space of the last input back to its preload
+void ring_set_release(RingSet *set)
+{
+    ring_t *ring = set->current;
+    __atomic_store_n(&ring->tail, ring->tail + set->current_len, __ATOMIC_SEQ_CST);
+    set->current = NULL;
+}
+
+
+size_t ring_set_size(RingSet *set)
+{
+    return set->n;
+}
+
+
+void ring_set_stats(RingSet *set, ring_set_stats_t *stats)
+{
+    stats->rings = set->n;
+    stats->sent = set->gone_sent;
+    stats->dropped = set->gone_dropped;
+    for (size_t i = 0; i < set->n; i++) {
+        stats->sent += __atomic_load_n(&set->maps[i].ring->sent, __ATOMIC_RELAXED);
+        stats->dropped += __atomic_load_n(&set->maps[i].ring->dropped, __ATOMIC_RELAXED);
+    }
+}
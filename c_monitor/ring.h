@@ -0,0 +1,78 @@
+#ifndef _H_RING_
+#define _H_RING_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+/*
+ * Inputs from a fuzzer preload to the monitor through shared memory, one
+ * ring per fuzzer thread, /dev/shm/fuzz-monitor.ring.<pid>.<tid>. The
+ * thread is the only producer of its ring and never waits: an input that
+ * doesn't fit is dropped and counted. The monitor finds rings by name and
+ * reads the inputs in place.
+ *
+ *   ring_t, then size bytes of records: uint32_t length, the input,
+ *   padding to 8. RING_WRAP as length sends the reader back to 0.
+ *
+ * The monitor sleeps in epoll. A producer that finds its ring empty as it
+ * puts an input rings it, with a datagram of its tid to the abstract unix
+ * socket RING_BELL; head and tail are then seq_cst on both sides, so
+ * either the monitor sees the input or the producer sees it is empty.
+ */
+
+#define RING_SHM_PREFIX     "fuzz-monitor.ring."
+#define RING_MAGIC          0x676e69726d7a6666ULL   // "ffzmring"
+#define RING_WRAP           UINT32_MAX
+#define RING_RECORD(n)      ((sizeof(uint32_t) + (n) + 7) & ~(size_t) 7)
+#define RING_BELL           "fuzz-monitor.bell"
+
+typedef struct ring {
+    uint64_t magic;
+    uint64_t size;              // of the records, a power of two
+    int32_t pid;                // of the producer's process
+    int32_t tid;                // of the producer
+    uint32_t closed;            // the producer is done, drain and drop it
+    uint64_t head __attribute__((aligned(64)));     // bytes written, producer
+    uint64_t sent;
+    uint64_t dropped;           // inputs that didn't fit
+    uint64_t tail __attribute__((aligned(64)));     // bytes read, monitor
+} ring_t;
+
+static inline uint8_t *ring_data(ring_t *ring)
+{
+    return (uint8_t *) (ring + 1);
+}
+
+static inline socklen_t ring_bell_addr(struct sockaddr_un *addr)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path + 1, RING_BELL, sizeof(RING_BELL) - 1);
+    return offsetof(struct sockaddr_un, sun_path) + sizeof(RING_BELL);
+}
+
+
+typedef struct ring_set_s RingSet;
+
+typedef struct ring_set_stats {
+    size_t rings;
+    uint64_t sent;
+    uint64_t dropped;
+} ring_set_stats_t;
+
+RingSet *ring_set_new(void);
+void     ring_set_destroy(RingSet *set);
+void     ring_set_scan(RingSet *set);
+int      ring_set_bell(RingSet *set);
+void     ring_set_wake(RingSet *set);
+bool     ring_set_next(RingSet *set, const uint8_t **data, size_t *size);
+void     ring_set_release(RingSet *set);
+size_t   ring_set_size(RingSet *set);
+void     ring_set_stats(RingSet *set, ring_set_stats_t *stats);
+
+#endif
@@ -0,0 +1,200 @@
+#define _GNU_SOURCE
+#include "snapshot.h"
+#include <perf/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#define SNAPSHOT_BUF_SZ     (1024 * 1024)
+#define SNAPSHOT_PAD(n)     (((n) + 7) & ~(size_t) 7)
+
+
+// what tells the SUT apart from a rebuilt one, whose addresses differ
+static bool snapshot_sut_stat(const char *sut, uint64_t *size, int64_t *mtime)
+{
+    struct stat st;
+    if (stat(sut, &st) == -1) {
+        PLOG_W("failed to stat %s", sut);
+        return false;
+    }
+    *size = st.st_size;
+    *mtime = st.st_mtime;
+    return true;
+}
+
+
+snapshot_writer_t *snapshot_create(const char *path, const char *sut)
+{
+    snapshot_writer_t *writer = malloc(sizeof(snapshot_writer_t));
+    assert(writer != NULL);
+    memset(writer, 0, sizeof(snapshot_writer_t));
+    writer->path = strdup(path);
+    assert(writer->path != NULL);
+    writer->tmp_path = malloc(strlen(path) + sizeof(".tmp"));
+    assert(writer->tmp_path != NULL);
+    sprintf(writer->tmp_path, "%s.tmp", path);
+
+    snapshot_header_t *header = &writer->header;
+    memcpy(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic));
+    header->version = SNAPSHOT_VERSION;
+    header->sut_len = strlen(sut);
+    if (!snapshot_sut_stat(sut, &header->sut_size, &header->sut_mtime)) {
+        snapshot_abort(writer);
+        return NULL;
+    }
+
+    if ((writer->file = fopen(writer->tmp_path, "wb")) == NULL) {
+        PLOG_F("failed to create snapshot %s", writer->tmp_path);
+        snapshot_abort(writer);
+        return NULL;
+    }
+    setvbuf(writer->file, NULL, _IOFBF, SNAPSHOT_BUF_SZ);
+
+    // the header is written again with the counts on commit
+    const uint64_t pad = 0;
+    if (fwrite(header, sizeof(snapshot_header_t), 1, writer->file) != 1
+        || fwrite(sut, 1, header->sut_len, writer->file) != header->sut_len
+        || fwrite(&pad, 1, SNAPSHOT_PAD(header->sut_len) - header->sut_len, writer->file)
+           != SNAPSHOT_PAD(header->sut_len) - header->sut_len) {
+        PLOG_F("failed writing snapshot %s", writer->tmp_path);
+        snapshot_abort(writer);
+        return NULL;
+    }
+    return writer;
+}
+
+
+// every edge goes before the first seen input
+int snapshot_add_edge(snapshot_writer_t *writer, const edge_t *edge)
+{
+    assert(writer->header.seen_n == 0);
+    if (fwrite(edge, sizeof(edge_t), 1, writer->file) != 1) {
+        PLOG_F("failed writing snapshot %s", writer->tmp_path);
+        return -1;
+    }
+    writer->header.edges_n++;
+    return 0;
+}
+
+
+int snapshot_add_seen(snapshot_writer_t *writer, uint64_t hash, uint32_t count)
+{
+    snapshot_seen_t seen = { hash, count, 0 };
+    if (fwrite(&seen, sizeof(snapshot_seen_t), 1, writer->file) != 1) {
+        PLOG_F("failed writing snapshot %s", writer->tmp_path);
+        return -1;
+    }
+    writer->header.seen_n++;
+    return 0;
+}
+
+
+// makes the snapshot the one at path, frees the writer either way
+int snapshot_commit(snapshot_writer_t *writer, uint64_t max_depth, uint64_t input_n)
+{
+    writer->header.max_depth = max_depth;
+    writer->header.input_n = input_n;
+    if (fseek(writer->file, 0, SEEK_SET) == -1
+        || fwrite(&writer->header, sizeof(snapshot_header_t), 1, writer->file) != 1
+        || fflush(writer->file) != 0
+        || fsync(fileno(writer->file)) == -1) {
+        PLOG_F("failed writing snapshot %s", writer->tmp_path);
+        snapshot_abort(writer);
+        return -1;
+    }
+    fclose(writer->file);
+    writer->file = NULL;
+
+    if (rename(writer->tmp_path, writer->path) == -1) {
+        PLOG_F("failed to move snapshot to %s", writer->path);
+        snapshot_abort(writer);
+        return -1;
+    }
+    free(writer->tmp_path);
+    free(writer->path);
+    free(writer);
+    return 0;
+}
+
+
+void snapshot_abort(snapshot_writer_t *writer)
+{
+    if (writer->file != NULL) {
+        fclose(writer->file);
+        unlink(writer->tmp_path);
+    }
+    free(writer->tmp_path);
+    free(writer->path);
+    free(writer);
+}
+
+
+// NULL when there is no usable snapshot of sut at path, start cold then
+snapshot_t *snapshot_open(const char *path, const char *sut)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        if (errno == ENOENT) {
+            LOG_I("no snapshot at %s yet", path);
+        } else {
+            PLOG_W("failed to open snapshot %s", path);
+        }
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(snapshot_header_t)) {
+        LOG_W("%s is not a snapshot", path);
+        close(fd);
+        return NULL;
+    }
+
+    snapshot_t *snapshot = malloc(sizeof(snapshot_t));
+    assert(snapshot != NULL);
+    snapshot->map_size = st.st_size;
+    snapshot->map = mmap(NULL, snapshot->map_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    close(fd);
+    if (snapshot->map == MAP_FAILED) {
+        PLOG_W("failed mmap snapshot %s, sz=%zu", path, snapshot->map_size);
+        free(snapshot);
+        return NULL;
+    }
+
+    const snapshot_header_t *header = snapshot->map;
+    const size_t body = snapshot->map_size - sizeof(snapshot_header_t);
+    snapshot->header = header;
+    snapshot->sut = (const char *) (header + 1);
+
+    uint64_t sut_size;
+    int64_t sut_mtime;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(header->magic)) != 0
+        || header->version != SNAPSHOT_VERSION
+        || header->sut_len > body || header->edges_n > body / sizeof(edge_t)
+        || header->seen_n > body / sizeof(snapshot_seen_t)
+        || SNAPSHOT_PAD(header->sut_len) + header->edges_n * sizeof(edge_t)
+           + header->seen_n * sizeof(snapshot_seen_t) != body) {
+        LOG_W("%s is not a snapshot of version %d", path, SNAPSHOT_VERSION);
+    } else if (header->sut_len != strlen(sut) || memcmp(snapshot->sut, sut, header->sut_len) != 0
+               || !snapshot_sut_stat(sut, &sut_size, &sut_mtime)
+               || sut_size != header->sut_size || sut_mtime != header->sut_mtime) {
+        LOG_W("snapshot %s was taken of another build of %s", path, sut);
+    } else {
+        snapshot->edges = (const edge_t *) (snapshot->sut + SNAPSHOT_PAD(header->sut_len));
+        snapshot->seen = (const snapshot_seen_t *) (snapshot->edges + header->edges_n);
+        return snapshot;
+    }
+    snapshot_close(snapshot);
+    return NULL;
+}
+
+
+void snapshot_close(snapshot_t *snapshot)
+{
+    munmap(snapshot->map, snapshot->map_size);
+    free(snapshot);
+}
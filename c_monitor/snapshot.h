@@ -0,0 +1,66 @@
+#ifndef _H_SNAPSHOT_
+#define _H_SNAPSHOT_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#include "edges.h"
+
+/*
+ * Monitor state for warm restarts: coverage, seen input hashes and the
+ * counters that go with them. Little endian, as written by the monitor:
+ *
+ *   snapshot_header_t, SUT path (sut_len bytes, padded to 8)
+ *   edges_n * edge_t, seen_n * snapshot_seen_t
+ *
+ * Written to path.tmp and renamed over path, so a snapshot on disk is
+ * always complete; read back through a single mmap.
+ */
+
+#define SNAPSHOT_MAGIC      "FMSNAP\0\0"
+#define SNAPSHOT_VERSION    1
+
+typedef struct snapshot_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t sut_len;
+    uint64_t sut_size;          // the SUT the addresses belong to
+    int64_t sut_mtime;
+    uint64_t edges_n;
+    uint64_t seen_n;
+    uint64_t max_depth;
+    uint64_t input_n;
+} snapshot_header_t;
+
+typedef struct snapshot_seen {
+    uint64_t hash;
+    uint32_t count;
+    uint32_t reserved;
+} snapshot_seen_t;
+
+typedef struct snapshot_writer {
+    FILE *file;
+    char *path;
+    char *tmp_path;
+    snapshot_header_t header;
+} snapshot_writer_t;
+
+typedef struct snapshot {
+    void *map;
+    size_t map_size;
+    const snapshot_header_t *header;
+    const char *sut;            // not terminated, header->sut_len long
+    const edge_t *edges;
+    const snapshot_seen_t *seen;
+} snapshot_t;
+
+snapshot_writer_t *snapshot_create(const char *path, const char *sut);
+int         snapshot_add_edge(snapshot_writer_t *writer, const edge_t *edge);
+int         snapshot_add_seen(snapshot_writer_t *writer, uint64_t hash, uint32_t count);
+int         snapshot_commit(snapshot_writer_t *writer, uint64_t max_depth, uint64_t input_n);
+void        snapshot_abort(snapshot_writer_t *writer);
+snapshot_t *snapshot_open(const char *path, const char *sut);
+void        snapshot_close(snapshot_t *snapshot);
+
+#endif
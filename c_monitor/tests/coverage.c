@@ -0,0 +1,168 @@
+#include <c_monitor/coverage.h>
+#include <c_monitor/edges.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * The shared coverage map under contention: worker threads replay the same
+ * traces at once, per branch (-m direct) and per input through a local
+ * EdgeMap (-m delta), starting small so that shards grow meanwhile. Every
+ * edge must be new to exactly one thread, as many as a single-threaded
+ * replay finds, and no hit may be lost. A map loaded from those edges, as
+ * a warm start does, has them all: replaying again finds nothing new.
+ *
+ * usage: coverage [threads [traces]]
+ */
+
+#define THREADS_N       8
+#define TRACES_N        2000
+#define TRACE_LEN       1000
+#define EDGES_N         200000      // distinct edges the traces are drawn from
+
+#define CHECK(cond) do {                                                        \
+    if (!(cond)) {                                                              \
+        fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond);      \
+        exit(EXIT_FAILURE);                                                     \
+    }                                                                           \
+} while (0)
+
+
+typedef struct replay {
+    CoverageMap *map;
+    size_t id;
+    size_t threads_n;
+    size_t traces_n;
+    bool delta;
+    uint64_t new_edges;
+} replay_t;
+
+
+// the i-th branch of a trace, the same for every thread
+static void trace_branch(size_t trace, size_t i, uint64_t *from, uint64_t *to)
+{
+    uint64_t x = trace * TRACE_LEN + i;
+    x ^= x >> 31;
+    x *= 0x7fb5d329728ea185ULL;
+    x ^= x >> 27;
+    const uint64_t edge = x % EDGES_N;
+    *from = 0x400000 + edge * 16;
+    *to = 0x400000 + (edge * 7919) % EDGES_N * 16;
+}
+
+
+// thread i starts at its own trace and goes through all of them
+static void *replay_run(void *data)
+{
+    replay_t *replay = (replay_t *) data;
+    EdgeMap *delta = edge_map_new(TRACE_LEN);
+    CHECK(delta != NULL);
+    for (size_t k = 0; k < replay->traces_n; k++) {
+        const size_t trace = (k + replay->id * replay->traces_n / replay->threads_n) % replay->traces_n;
+        uint64_t from, to;
+        if (replay->delta) {
+            edge_map_clear(delta);
+            for (size_t i = 0; i < TRACE_LEN; i++) {
+                trace_branch(trace, i, &from, &to);
+                edge_map_hit(delta, from, to);
+            }
+            replay->new_edges += coverage_map_merge(replay->map, delta, NULL, NULL);
+        } else {
+            for (size_t i = 0; i < TRACE_LEN; i++) {
+                trace_branch(trace, i, &from, &to);
+                replay->new_edges += coverage_map_hit(replay->map, from, to, 1);
+            }
+        }
+    }
+    edge_map_destroy(delta);
+    return NULL;
+}
+
+
+static uint64_t replay(CoverageMap *map, size_t threads_n, size_t traces_n, bool delta)
+{
+    replay_t replays[threads_n];
+    pthread_t threads[threads_n];
+    for (size_t t = 0; t < threads_n; t++) {
+        replays[t] = (replay_t) { map, t, threads_n, traces_n, delta, 0 };
+        CHECK(pthread_create(&threads[t], NULL, replay_run, &replays[t]) == 0);
+    }
+    uint64_t new_edges = 0;
+    for (size_t t = 0; t < threads_n; t++) {
+        pthread_join(threads[t], NULL);
+        new_edges += replays[t].new_edges;
+    }
+    return new_edges;
+}
+
+
+typedef struct totals {
+    size_t edges;
+    uint64_t hits;
+} totals_t;
+
+static void count_edge(const edge_t *edge, void *data)
+{
+    totals_t *totals = (totals_t *) data;
+    totals->edges++;
+    totals->hits += edge->hits;
+}
+
+
+typedef struct dump {
+    edge_t *edges;
+    size_t edges_n;
+} dump_t;
+
+static void dump_edge(const edge_t *edge, void *data)
+{
+    dump_t *dump = (dump_t *) data;
+    dump->edges[dump->edges_n++] = *edge;
+}
+
+
+int main(int argc, char *argv[])
+{
+    const size_t threads_n = argc > 1 ? strtoul(argv[1], NULL, 10) : THREADS_N;
+    const size_t traces_n = argc > 2 ? strtoul(argv[2], NULL, 10) : TRACES_N;
+    CHECK(threads_n > 0 && traces_n > 0);
+
+    CoverageMap *single = coverage_map_new(0);
+    CHECK(single != NULL);
+    const uint64_t expected = replay(single, 1, traces_n, false);
+    coverage_map_destroy(single);
+
+    for (int delta = 0; delta < 2; delta++) {
+        CoverageMap *map = coverage_map_new(0);
+        CHECK(map != NULL);
+        const uint64_t new_edges = replay(map, threads_n, traces_n, delta);
+
+        totals_t totals = { 0, 0 };
+        coverage_map_foreach(map, &totals, count_edge);
+        printf("coverage: %zu threads, %s: %" PRIu64 " new edges (%" PRIu64 " single-threaded), "
+               "%" PRIu64 " hits\n", threads_n, delta ? "delta" : "direct", new_edges, expected, totals.hits);
+        CHECK(new_edges == expected);
+        CHECK(coverage_map_size(map) == expected);
+        CHECK(totals.edges == expected);
+        CHECK(totals.hits == (uint64_t) threads_n * traces_n * TRACE_LEN);
+
+        // the edges as a snapshot keeps them, loaded into a map of the smallest size
+        dump_t dump = { malloc(expected * sizeof(edge_t)), 0 };
+        CHECK(dump.edges != NULL);
+        coverage_map_foreach(map, &dump, dump_edge);
+        coverage_map_destroy(map);
+        map = coverage_map_load(0, dump.edges, dump.edges_n);
+        CHECK(map != NULL);
+        CHECK(coverage_map_size(map) == expected);
+        CHECK(replay(map, threads_n, traces_n, delta) == 0);
+        totals = (totals_t) { 0, 0 };
+        coverage_map_foreach(map, &totals, count_edge);
+        CHECK(totals.edges == expected);
+        CHECK(totals.hits == 2ULL * threads_n * traces_n * TRACE_LEN);
+        free(dump.edges);
+        coverage_map_destroy(map);
+    }
+
+    printf("coverage: ok\n");
+    return EXIT_SUCCESS;
+}
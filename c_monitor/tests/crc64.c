@@ -0,0 +1,74 @@
+#include <c_monitor/util.h>
+#include <c_monitor/util_impl.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+ * util_CRC64 names inputs in snapshots, so whichever implementation the
+ * CPU picks must give the values the byte-wise table loop always gave:
+ * known answers from it, then slice-by-8 and CLMUL against it over every
+ * length up to a few folding blocks, at every alignment.
+ */
+
+#define LEN_MAX         5000
+#define ALIGN_N         8
+
+#define CHECK(cond) do {                                                        \
+    if (!(cond)) {                                                              \
+        fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond);      \
+        exit(EXIT_FAILURE);                                                     \
+    }                                                                           \
+} while (0)
+
+
+static void pattern(uint8_t *buf, size_t len)
+{
+    for (size_t i = 0; i < len; i++)
+        buf[i] = (uint8_t) (i * 131 + (i >> 8) * 7 + 1);
+}
+
+
+int main(void)
+{
+    static uint8_t buf[70000 + ALIGN_N];
+    pattern(buf, sizeof(buf));
+
+    static const struct {
+        size_t len;
+        uint64_t crc;
+    } known[] = {
+        { 0, 0x0000000000000000ULL },
+        { 1, 0x01b0000000000000ULL },
+        { 63, 0x00e059b02b0dde5bULL },
+        { 255, 0xe67cd535a3ba0c0cULL },
+        { 256, 0x42867cd535a3ba0cULL },
+        { 1000, 0x60e59f143a740d39ULL },
+        { 4096, 0xe73a21b8c1792689ULL },
+        { 65537, 0x32d90ee7353ea198ULL },
+    };
+    // the byte-wise table loop util_CRC64 was before slicing and folding
+    const util_crc64_impl_t *impls;
+    const size_t impls_n = util_CRC64Impls(&impls);
+    CHECK(impls_n >= 2);
+    const util_crc64_impl_t *bytewise = &impls[0];
+
+    CHECK(util_CRC64((const uint8_t *) "123456789", 9) == 0x46a5a9388a5beffeULL);
+    for (size_t k = 0; k < sizeof(known) / sizeof(known[0]); k++) {
+        CHECK(bytewise->crc(0ULL, buf, known[k].len) == known[k].crc);
+        CHECK(util_CRC64(buf, known[k].len) == known[k].crc);
+    }
+
+    for (size_t m = 1; m < impls_n; m++) {
+        for (size_t align = 0; align < ALIGN_N; align++) {
+            for (size_t len = 0; len <= LEN_MAX; len++) {
+                if (impls[m].crc(0ULL, buf + align, len) != bytewise->crc(0ULL, buf + align, len)) {
+                    fprintf(stderr, "crc64: %s differs on %zu bytes at offset %zu\n",
+                            impls[m].name, len, align);
+                    return EXIT_FAILURE;
+                }
+            }
+        }
+        printf("crc64: %s ok\n", impls[m].name);
+    }
+    return EXIT_SUCCESS;
+}
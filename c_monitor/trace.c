@@ -0,0 +1,154 @@
+#define _GNU_SOURCE
+#include "trace.h"
+#include <perf/log.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+
+#define TRACE_BUF_SZ    (1024 * 1024)
+
+
+static trace_file_t *trace_new(FILE *file, const char *path)
+{
+    trace_file_t *trace = malloc(sizeof(trace_file_t));
+    assert(trace != NULL);
+    memset(trace, 0, sizeof(trace_file_t));
+    trace->file = file;
+    trace->path = strdup(path);
+    assert(trace->path != NULL);
+    setvbuf(file, NULL, _IOFBF, TRACE_BUF_SZ);
+    return trace;
+}
+
+
+trace_file_t *trace_create(const char *path, const char *sut)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        PLOG_F("failed to create trace file %s", path);
+        return NULL;
+    }
+    trace_file_t *trace = trace_new(file, path);
+    trace->sut = strdup(sut);
+    assert(trace->sut != NULL);
+
+    trace_file_header_t header;
+    memset(&header, 0, sizeof(trace_file_header_t));
+    memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.branch_size = sizeof(bts_branch_t);
+    header.sut_len = strlen(sut);
+    if (fwrite(&header, sizeof(header), 1, file) != 1
+        || fwrite(sut, 1, header.sut_len, file) != header.sut_len) {
+        PLOG_F("failed writing trace file %s", path);
+        trace_close(trace);
+        return NULL;
+    }
+    return trace;
+}
+
+
+int trace_write(trace_file_t *trace, const trace_record_t *record, const bts_branch_t *branches)
+{
+    if (fwrite(record, sizeof(trace_record_t), 1, trace->file) != 1
+        || fwrite(branches, sizeof(bts_branch_t), record->count, trace->file) != record->count) {
+        PLOG_F("failed writing trace file %s", trace->path);
+        return -1;
+    }
+    return 0;
+}
+
+
+trace_file_t *trace_open(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        PLOG_F("failed to open trace file %s", path);
+        return NULL;
+    }
+    trace_file_t *trace = trace_new(file, path);
+
+    trace_file_header_t header;
+    if (fread(&header, sizeof(header), 1, file) != 1
+        || memcmp(header.magic, TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        LOG_F("%s is not a trace file", path);
+        trace_close(trace);
+        return NULL;
+    }
+    if (header.version != TRACE_VERSION || header.branch_size != sizeof(bts_branch_t)) {
+        LOG_F("%s has unsupported version %" PRIu32 " (branch size %" PRIu32 ")",
+            path, header.version, header.branch_size);
+        trace_close(trace);
+        return NULL;
+    }
+
+    trace->sut = malloc(header.sut_len + 1);
+    assert(trace->sut != NULL);
+    if (fread(trace->sut, 1, header.sut_len, file) != header.sut_len) {
+        LOG_F("%s is truncated", path);
+        trace_close(trace);
+        return NULL;
+    }
+    trace->sut[header.sut_len] = '\0';
+    return trace;
+}
+
+
+// 1 on a record, 0 at the end of the file, -1 on errors
+static int trace_read_record(trace_file_t *trace, trace_record_t *record)
+{
+    if (fread(record, sizeof(trace_record_t), 1, trace->file) != 1) {
+        if (feof(trace->file))
+            return 0;
+        PLOG_F("failed reading trace file %s", trace->path);
+        return -1;
+    }
+    return 1;
+}
+
+
+// the branches stay valid until the next call
+int trace_read(trace_file_t *trace, trace_record_t *record, bts_branch_t **branches)
+{
+    int ret = trace_read_record(trace, record);
+    if (ret != 1)
+        return ret;
+
+    if (record->count > trace->branches_cap) {
+        trace->branches_cap = record->count;
+        trace->branches = realloc(trace->branches, trace->branches_cap * sizeof(bts_branch_t));
+        assert(trace->branches != NULL);
+    }
+    if (fread(trace->branches, sizeof(bts_branch_t), record->count, trace->file) != record->count) {
+        LOG_F("%s is truncated", trace->path);
+        return -1;
+    }
+    *branches = trace->branches;
+    return 1;
+}
+
+
+// reads a record but not its branches
+int trace_skip(trace_file_t *trace, trace_record_t *record)
+{
+    int ret = trace_read_record(trace, record);
+    if (ret != 1)
+        return ret;
+
+    if (fseeko(trace->file, record->count * sizeof(bts_branch_t), SEEK_CUR) == -1) {
+        PLOG_F("failed seeking in trace file %s", trace->path);
+        return -1;
+    }
+    return 1;
+}
+
+
+void trace_close(trace_file_t *trace)
+{
+    fclose(trace->file);
+    free(trace->path);
+    free(trace->sut);
+    free(trace->branches);
+    free(trace);
+}
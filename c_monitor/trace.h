@@ -0,0 +1,53 @@
+#ifndef _H_TRACE_
+#define _H_TRACE_
+
+#include <perf/perf.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+/*
+ * Capture file of raw BTS traces, so that the analysis can be replayed
+ * without an intel_bts PMU. Little endian, as written by the monitor:
+ *
+ *   trace_file_header_t, SUT path (sut_len bytes)
+ *   per input: trace_record_t, count * bts_branch_t
+ */
+
+#define TRACE_MAGIC     "FMBTS\0\0\0"
+#define TRACE_VERSION   1
+
+typedef struct trace_file_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t branch_size;       // sizeof(bts_branch_t) at capture
+    uint32_t sut_len;
+    uint32_t reserved;
+} trace_file_header_t;
+
+typedef struct trace_record {
+    uint64_t input_n;
+    uint64_t count;             // branches that follow
+    uint32_t input_size;
+    uint32_t trace_ms;          // time the live trace took
+    uint32_t from_corpus;
+    uint32_t reserved;
+} trace_record_t;
+
+typedef struct trace_file {
+    FILE *file;
+    char *path;
+    char *sut;
+    bts_branch_t *branches;     // reader buffer
+    size_t branches_cap;
+} trace_file_t;
+
+trace_file_t *trace_create(const char *path, const char *sut);
+int           trace_write(trace_file_t *trace, const trace_record_t *record,
+                          const bts_branch_t *branches);
+trace_file_t *trace_open(const char *path);
+int           trace_read(trace_file_t *trace, trace_record_t *record, bts_branch_t **branches);
+int           trace_skip(trace_file_t *trace, trace_record_t *record);
+void          trace_close(trace_file_t *trace);
+
+#endif
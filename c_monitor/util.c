@@ -1,4 +1,9 @@
 #include "util.h"
+#include "util_impl.h"
+#include <string.h>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
 
 
 /* ISO 3309 CRC-64 Poly table */
@@ -69,10 +74,37 @@ static const uint64_t util_CRC64ISOPoly[] = {
     0x9240000000000000ULL, 0x93F0000000000000ULL, 0x9120000000000000ULL, 0x9090000000000000ULL,
 };
 
-uint64_t util_CRC64(uint8_t * buf, size_t len)
+/* the table above advanced by 1..7 more bytes, for 8 bytes per step */
+static uint64_t util_CRC64Slice[8][256];
+
+/* x^n mod P, reflected, with n = 127, 191, 511, 575 */
+#define UTIL_CRC64_K127     0xF500000000000001ULL
+#define UTIL_CRC64_K191     0x6B70000000000001ULL
+#define UTIL_CRC64_K511     0xB100010100000001ULL
+#define UTIL_CRC64_K575     0x01B001B1B0000001ULL
+#define UTIL_CRC64_FOLD_MIN 256     // shorter inputs aren't worth the setup
+
+/* util_CRC64 as it used to be, the reference for the others */
+static uint64_t util_CRC64Bytewise(uint64_t res, const uint8_t * buf, size_t len)
 {
-    uint64_t res = 0ULL;
+    for (size_t i = 0; i < len; i++) {
+        res = util_CRC64ISOPoly[(uint8_t) res ^ buf[i]] ^ (res >> 8);
+    }
 
+    return res;
+}
+
+static uint64_t util_CRC64Slice8(uint64_t res, const uint8_t * buf, size_t len)
+{
+    for (; len >= 8; buf += 8, len -= 8) {
+        uint64_t word;
+        memcpy(&word, buf, sizeof(word));
+        res ^= word;
+        res = util_CRC64Slice[7][res & 0xFF] ^ util_CRC64Slice[6][(res >> 8) & 0xFF]
+            ^ util_CRC64Slice[5][(res >> 16) & 0xFF] ^ util_CRC64Slice[4][(res >> 24) & 0xFF]
+            ^ util_CRC64Slice[3][(res >> 32) & 0xFF] ^ util_CRC64Slice[2][(res >> 40) & 0xFF]
+            ^ util_CRC64Slice[1][(res >> 48) & 0xFF] ^ util_CRC64Slice[0][res >> 56];
+    }
     for (size_t i = 0; i < len; i++) {
         res = util_CRC64ISOPoly[(uint8_t) res ^ buf[i]] ^ (res >> 8);
     }
@@ -80,6 +112,101 @@ uint64_t util_CRC64(uint8_t * buf, size_t len)
     return res;
 }
 
+#if defined(__x86_64__)
+/* acc * x^(64 * k) + next, k given by the constants of the two halves */
+__attribute__((target("pclmul")))
+static inline __m128i util_CRC64Fold(__m128i acc, __m128i next, __m128i k)
+{
+    return _mm_xor_si128(next, _mm_xor_si128(
+        _mm_clmulepi64_si128(acc, k, 0x00), _mm_clmulepi64_si128(acc, k, 0x11)));
+}
+
+/*
+ * Carry-less multiply folding (Intel's "Fast CRC Computation for Generic
+ * Polynomials Using PCLMULQDQ"): four 128-bit lanes fold 64 bytes a
+ * step, then into one lane, whose remainder slicing finishes.
+ */
+__attribute__((target("pclmul")))
+static uint64_t util_CRC64Clmul(uint64_t res, const uint8_t * buf, size_t len)
+{
+    if (len < UTIL_CRC64_FOLD_MIN) {
+        return util_CRC64Slice8(res, buf, len);
+    }
+
+    const __m128i k512 = _mm_set_epi64x(UTIL_CRC64_K511, UTIL_CRC64_K575);
+    const __m128i k128 = _mm_set_epi64x(UTIL_CRC64_K127, UTIL_CRC64_K191);
+    __m128i x0 = _mm_xor_si128(_mm_loadu_si128((const __m128i *) buf), _mm_cvtsi64_si128(res));
+    __m128i x1 = _mm_loadu_si128((const __m128i *) (buf + 16));
+    __m128i x2 = _mm_loadu_si128((const __m128i *) (buf + 32));
+    __m128i x3 = _mm_loadu_si128((const __m128i *) (buf + 48));
+    buf += 64;
+    len -= 64;
+
+    for (; len >= 64; buf += 64, len -= 64) {
+        x0 = util_CRC64Fold(x0, _mm_loadu_si128((const __m128i *) buf), k512);
+        x1 = util_CRC64Fold(x1, _mm_loadu_si128((const __m128i *) (buf + 16)), k512);
+        x2 = util_CRC64Fold(x2, _mm_loadu_si128((const __m128i *) (buf + 32)), k512);
+        x3 = util_CRC64Fold(x3, _mm_loadu_si128((const __m128i *) (buf + 48)), k512);
+    }
+    x0 = util_CRC64Fold(x0, x1, k128);
+    x0 = util_CRC64Fold(x0, x2, k128);
+    x0 = util_CRC64Fold(x0, x3, k128);
+    for (; len >= 16; buf += 16, len -= 16) {
+        x0 = util_CRC64Fold(x0, _mm_loadu_si128((const __m128i *) buf), k128);
+    }
+
+    /* x0 * x^64 mod P: the low half times x^128 brought under 128 bits, the
+       rest is one 8 byte step */
+    const __m128i high = _mm_srli_si128(x0, 8);
+    x0 = _mm_xor_si128(_mm_clmulepi64_si128(x0, k128, 0x10), high);
+    res = util_CRC64Slice8(0, (const uint8_t *) &x0, 8)
+        ^ (uint64_t) _mm_cvtsi128_si64(_mm_srli_si128(x0, 8));
+
+    return util_CRC64Slice8(res, buf, len);
+}
+#endif
+
+static uint64_t (*util_CRC64Impl)(uint64_t, const uint8_t *, size_t) = util_CRC64Slice8;
+static util_crc64_impl_t util_CRC64All[3] = {
+    { "table", util_CRC64Bytewise },
+    { "slice-by-8", util_CRC64Slice8 },
+};
+static size_t util_CRC64AllN = 2;
+
+__attribute__((constructor))
+static void util_CRC64Init(void)
+{
+    for (size_t i = 0; i < 256; i++) {
+        util_CRC64Slice[0][i] = util_CRC64ISOPoly[i];
+    }
+    for (size_t k = 1; k < 8; k++) {
+        for (size_t i = 0; i < 256; i++) {
+            const uint64_t prev = util_CRC64Slice[k - 1][i];
+            util_CRC64Slice[k][i] = util_CRC64ISOPoly[(uint8_t) prev] ^ (prev >> 8);
+        }
+    }
+
+#if defined(__x86_64__)
+    if (__builtin_cpu_supports("pclmul")) {
+        util_CRC64Impl = util_CRC64Clmul;
+        util_CRC64All[util_CRC64AllN++] = (util_crc64_impl_t) { "clmul", util_CRC64Clmul };
+    }
+#endif
+}
+
+/* same values whichever way it's computed, they are kept in snapshots */
+uint64_t util_CRC64(const uint8_t * buf, size_t len)
+{
+    return util_CRC64Impl(0ULL, buf, len);
+}
+
+/* those this CPU can run, the byte-wise table loop first */
+size_t util_CRC64Impls(const util_crc64_impl_t ** impls)
+{
+    *impls = util_CRC64All;
+    return util_CRC64AllN;
+}
+
 uint64_t util_CRC64Rev(uint8_t * buf, size_t len)
 {
     uint64_t res = 0ULL;
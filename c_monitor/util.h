@@ -4,7 +4,7 @@
 #include <stdint.h>
 #include <unistd.h>
 
-uint64_t util_CRC64(uint8_t * buf, size_t len);
+uint64_t util_CRC64(const uint8_t * buf, size_t len);
 uint64_t util_CRC64Rev(uint8_t * buf, size_t len);
 
 #endif
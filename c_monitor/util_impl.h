@@ -0,0 +1,19 @@
+#ifndef _H_UTIL_IMPL_
+#define _H_UTIL_IMPL_
+
+#include <stdint.h>
+#include <unistd.h>
+
+/*
+ * The ways util_CRC64 can be computed, for tests and benches to hold
+ * against each other; everything else goes through util.h.
+ */
+
+typedef struct util_crc64_impl {
+    const char *name;
+    uint64_t (*crc)(uint64_t res, const uint8_t * buf, size_t len);
+} util_crc64_impl_t;
+
+size_t util_CRC64Impls(const util_crc64_impl_t ** impls);
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef _H_FORKSRV_
+#define _H_FORKSRV_
+
+/*
+ * Fork-server protocol shared between libperf and preloads/forksrv.so.
+ *
+ * The SUT is exec'd once with forksrv.so preloaded; the shim parks it right
+ * before main (or at FORKSRV_ADDR_ENV) and says hello on the status pipe.
+ * Every input then goes like this (all messages are 4 bytes):
+ *
+ *   monitor -> ctl  FORKSRV_MSG_FORK
+ *   server  -> st   pid of the new child (child blocks reading ctl)
+ *   monitor -> ctl  FORKSRV_MSG_GO (once perf is attached to the child)
+ *   server  -> st   waitpid() status of the child
+ */
+
+#define FORKSRV_CTL_FD      198
+#define FORKSRV_ST_FD       (FORKSRV_CTL_FD + 1)
+
+#define FORKSRV_ADDR_ENV    "FUZZ_MONITOR_FORKSRV_ADDR"
+
+#define FORKSRV_MSG_HELLO   0x6f6c6568
+#define FORKSRV_MSG_FORK    0x6b726f66
+#define FORKSRV_MSG_GO      0x00006f67
+
+#endif
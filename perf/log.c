@@ -29,22 +29,31 @@ void log_log(enum llevel_t ll, const char *fn, int ln, bool perr, const char *fm
         {"D", "\033[0;4m", true},
     };
 
+    // the whole line goes out in a single write so that lines logged by
+    // different threads do not interleave
+    char line[4096];
+    size_t len = 0;
     if (log_levels[ll].descr) {
-        dprintf(STDOUT_FILENO, "[%s] ", log_levels[ll].descr);
+        len += snprintf(line + len, sizeof(line) - len, "[%s] ", log_levels[ll].descr);
     }
 
-    if (log_levels[ll].print_funcline) {
-        dprintf(STDOUT_FILENO, "%s():%d ", fn, ln);
+    if (log_levels[ll].print_funcline && len < sizeof(line)) {
+        len += snprintf(line + len, sizeof(line) - len, "%s():%d ", fn, ln);
     }
 
-    va_list args;
-    va_start(args, fmt);
-    vdprintf(STDOUT_FILENO, fmt, args);
-    va_end(args);
+    if (len < sizeof(line)) {
+        va_list args;
+        va_start(args, fmt);
+        len += vsnprintf(line + len, sizeof(line) - len, fmt, args);
+        va_end(args);
+    }
 
-    if (perr == true) {
-        dprintf(STDOUT_FILENO, ": %s", strerr);
+    if (perr == true && len < sizeof(line)) {
+        len += snprintf(line + len, sizeof(line) - len, ": %s", strerr);
     }
 
-    dprintf(STDOUT_FILENO, "\n");
+    if (len > sizeof(line) - 2)
+        len = sizeof(line) - 2;
+    line[len++] = '\n';
+    write(STDOUT_FILENO, line, len);
 }
@@ -1,10 +1,13 @@
 #define _GNU_SOURCE
 #include "perf.h"
+#include "forksrv.h"
 #include "log.h"
 
 #include <linux/perf_event.h>
+#include <sys/epoll.h>
 #include <sys/ioctl.h>
 #include <sys/mman.h>
+#include <sys/prctl.h>
 #include <sys/ptrace.h>
 #include <sys/types.h>
 #include <sys/syscall.h>
@@ -18,13 +21,24 @@
 #include <string.h>
 #include <assert.h>
 #include <errno.h>
+#include <sched.h>
 #include <signal.h>
 
+#ifndef SYS_pidfd_open
+#   define SYS_pidfd_open 434
+#endif
+
 
+// default ring sizes in pages, both must be powers of two
 #define PERF_MAP_PG 512
-#define PERF_MAP_SZ (getpagesize() * (PERF_MAP_PG + 1))
 #define PERF_AUX_PG 1024
-#define PERF_AUX_SZ (getpagesize() * PERF_AUX_PG)
+// an auto-sized AUX ring shrinks after this many traces using under a quarter
+#define PERF_AUX_CALM 64
+
+#define PERF_INPUT_NAME "fuzz-monitor-input"
+#define PERF_INPUT_ARG  "@@"
+#define PERF_INPUT_PATH "/proc/self/fd/0"
+#define PERF_MAPS_SZ    4096    // of /proc/<pid>/maps, enough for the SUT binary's lines
 
 #define likely(x)       __builtin_expect((x),1)
 #define unlikely(x)     __builtin_expect((x),0)
@@ -43,9 +57,16 @@
 int32_t perf_bts_type = -1;
 enum llevel_t log_level = DEBUG;
 
-gbl_status_t gbl_status = {
-    -1, -1, 0, NULL, NULL
-};
+// bytes all sessions of the process may map, 0 for no limit
+static size_t perf_budget = 0;
+static size_t perf_mapped = 0;
+
+// session behind perf_monitor_api(), set up by its first call
+static perf_session_t api_session;
+static bool api_session_ready = false;
+
+// spreads the servers of all sessions over the CPUs
+static unsigned perf_next_cpu = 0;
 
 
 static inline long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
@@ -57,6 +78,9 @@ static inline long perf_event_open(struct perf_event_attr *hw_event, pid_t pid,
 
 static bool perf_init(void)
 {
+    if (perf_bts_type != -1)
+        return true;
+
     int fd = open("/sys/bus/event_source/devices/intel_bts/type", O_RDONLY | O_CLOEXEC);
     if (fd == -1) {
         PLOG_F("Intel BTS not supported");
@@ -79,241 +103,1136 @@ static bool perf_init(void)
 }
 
 
-static void analyze_bts(bts_branch_t **bts_start, uint64_t *count)
+static void perf_emit(perf_session_t *session, const bts_branch_t *br, uint64_t count)
+{
+    session->trace_count += count;
+    if (session->chunk_fn != NULL) {
+        session->chunk_fn(br, count, session->chunk_data);
+        return;
+    }
+
+    if (session->trace_count > session->trace_cap) {
+        session->trace_cap = session->trace_cap ? session->trace_cap : 4096;
+        while (session->trace_cap < session->trace_count)
+            session->trace_cap *= 2;
+        session->trace_buf = realloc(session->trace_buf, session->trace_cap * sizeof(bts_branch_t));
+        assert(session->trace_buf != NULL);
+    }
+    memcpy(session->trace_buf + session->trace_count - count, br, count * sizeof(bts_branch_t));
+}
+
+
+// copies len bytes at pos out of a ring of size bytes
+static void perf_ring_copy(const uint8_t *ring, uint64_t size, uint64_t pos, void *dst, size_t len)
+{
+    const uint64_t off = pos % size;
+    const uint64_t first_len = len < size - off ? len : size - off;
+    memcpy(dst, ring + off, first_len);
+    memcpy((uint8_t *) dst + first_len, ring, len - first_len);
+}
+
+
+// walks the side-band records, counting what the kernel could not store
+static void perf_drain_records(perf_session_t *session)
+{
+    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) session->mmap_buf;
+    const uint8_t *data = (const uint8_t *) session->mmap_buf + pem->data_offset;
+    uint64_t data_head = ATOMIC_GET(pem->data_head);
+    rmb();
+    uint64_t data_tail = pem->data_tail;
+
+    while (data_head - data_tail >= sizeof(struct perf_event_header)) {
+        struct perf_event_header header;
+        perf_ring_copy(data, pem->data_size, data_tail, &header, sizeof(header));
+        if (header.size == 0)
+            break;
+
+        if (header.type == PERF_RECORD_AUX) {
+            struct { uint64_t aux_offset, aux_size, flags; } aux;
+            perf_ring_copy(data, pem->data_size, data_tail + sizeof(header), &aux, sizeof(aux));
+            if (aux.flags & PERF_AUX_FLAG_TRUNCATED)
+                session->aux_truncated++;
+        } else if (header.type == PERF_RECORD_LOST) {
+            struct { uint64_t id, lost; } lost;
+            perf_ring_copy(data, pem->data_size, data_tail + sizeof(header), &lost, sizeof(lost));
+            session->lost += lost.lost;
+        }
+        data_tail += header.size;
+    }
+
+    mb();
+    ATOMIC_SET(pem->data_tail, data_tail);
+}
+
+
+// hands everything the kernel wrote so far on, freeing the space right away
+// so that a long trace can keep going around the AUX ring
+static void perf_drain(perf_session_t *session)
 {
-    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) gbl_status.mmap_buf;
+    if (session->mmap_buf == NULL)
+        return;
+    perf_drain_records(session);
+
+    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) session->mmap_buf;
     uint64_t aux_head = ATOMIC_GET(pem->aux_head);
     rmb();
-    bts_branch_t *br = (bts_branch_t *) gbl_status.mmap_aux;
+    uint64_t aux_tail = pem->aux_tail;
+    const uint64_t aux_size = pem->aux_size;
+    const uint8_t *aux = (const uint8_t *) session->mmap_aux;
+    if (aux_head - aux_tail > session->aux_hwm)
+        session->aux_hwm = aux_head - aux_tail;
 
-    if (bts_start != NULL && count != NULL) {
-        *bts_start = br;
-        *count = ((bts_branch_t *)(gbl_status.mmap_aux + aux_head) - br);
+    while (aux_head - aux_tail >= sizeof(bts_branch_t)) {
+        const uint64_t aux_off = aux_tail % aux_size;
+        const uint64_t len = aux_head - aux_tail < aux_size - aux_off ?
+                             aux_head - aux_tail : aux_size - aux_off;
+        const uint64_t n = len / sizeof(bts_branch_t);
+        if (n > 0) {
+            perf_emit(session, (const bts_branch_t *) (aux + aux_off), n);
+            aux_tail += n * sizeof(bts_branch_t);
+            continue;
+        }
+
+        // the ring size is no multiple of the record size, glue this one back
+        bts_branch_t br;
+        perf_ring_copy(aux, aux_size, aux_tail, &br, sizeof(bts_branch_t));
+        perf_emit(session, &br, 1);
+        aux_tail += sizeof(bts_branch_t);
+    }
+
+    mb();
+    ATOMIC_SET(pem->aux_tail, aux_tail);
+}
+
+
+static void perf_trace_begin(perf_session_t *session)
+{
+    session->trace_count = 0;
+    session->aux_truncated = 0;
+    session->lost = 0;
+    session->aux_hwm = 0;
+}
+
+
+static inline size_t perf_map_size(perf_session_t *session)
+{
+    return getpagesize() * ((session->data_pages ? session->data_pages : PERF_MAP_PG) + 1);
+}
+
+
+static inline size_t perf_aux_size(perf_session_t *session)
+{
+    if (session->aux_pages_cur == 0)
+        session->aux_pages_cur = session->aux_pages ? session->aux_pages : PERF_AUX_PG;
+    return getpagesize() * session->aux_pages_cur;
+}
+
+
+// picks the AUX ring size for the next attach from how the last trace went
+static void perf_autosize(perf_session_t *session)
+{
+    if (!session->aux_auto || session->mmap_aux_sz == 0)
         return;
+
+    const size_t floor = session->aux_pages ? session->aux_pages : PERF_AUX_PG;
+    const size_t aux_sz = session->mmap_aux_sz;
+    size_t pages = session->aux_pages_cur;
+
+    if (session->aux_truncated > 0 || session->lost > 0 || session->aux_hwm * 4 > aux_sz * 3) {
+        pages *= 2;
+        session->aux_calm = 0;
+    } else if (session->aux_hwm * 4 < aux_sz && pages > floor) {
+        if (++session->aux_calm >= PERF_AUX_CALM) {
+            pages /= 2;
+            session->aux_calm = 0;
+        }
+    } else {
+        session->aux_calm = 0;
     }
 
-    uint64_t counter = 0;
-    for (; br < ((bts_branch_t *)(gbl_status.mmap_aux + aux_head)); br++) {
+    // what the other sessions map counts too, so this also gives memory
+    // back when they grew in the meantime
+    const size_t budget = __atomic_load_n(&perf_budget, __ATOMIC_RELAXED);
+    const size_t others = __atomic_load_n(&perf_mapped, __ATOMIC_RELAXED)
+                          - session->mmap_buf_sz - session->mmap_aux_sz;
+    while (budget > 0 && pages > floor
+           && others + session->mmap_buf_sz + pages * getpagesize() > budget)
+        pages /= 2;
+
+    if (pages != session->aux_pages_cur) {
+        LOG_I("AUX ring of PID=%d %s to %zu KiB (high-water mark %" PRIu64 " KiB)",
+            session->child_pid, pages > session->aux_pages_cur ? "grows" : "shrinks",
+            pages * getpagesize() / 1024, session->aux_hwm / 1024);
+        session->aux_pages_cur = pages;
+    }
+}
+
+
+static void perf_trace_end(perf_session_t *session, bts_branch_t **bts_start, uint64_t *count)
+{
+    if (session->aux_truncated > 0 || session->lost > 0) {
+        LOG_W("trace of PID=%d incomplete: %" PRIu64 " AUX truncations, %" PRIu64 " lost records",
+            session->child_pid, session->aux_truncated, session->lost);
+    }
+    perf_autosize(session);
+    if (bts_start != NULL && count != NULL) {
+        *bts_start = session->chunk_fn == NULL ? session->trace_buf : NULL;
+        *count = session->trace_count;
+    }
+}
+
+
+// chunk consumer of perf_monitor()
+static void perf_log_chunk(const bts_branch_t *br, uint64_t count, void *data)
+{
+    uint64_t *counter = (uint64_t *) data;
+    for (const bts_branch_t *br_end = br + count; br < br_end; br++) {
         if (unlikely(br->from > 0xFFFFFFFF00000000) || unlikely(br->to > 0xFFFFFFFF00000000)) {
             continue;
         }
-        LOG_D("[%" PRIu64 "] 0x%x -> 0x%x", counter, br->from, br->to);
+        LOG_D("[%" PRIu64 "] 0x%" PRIx64 " -> 0x%" PRIx64, *counter, br->from, br->to);
         LOG_M("branch,%" PRIu64 ",%" PRIu64, br->from, br->to);
-        counter++;
+        (*counter)++;
     }
+}
 
-    LOG_I("BTS recorded %" PRIu64 " branches", counter);
+
+static void perf_close(perf_session_t *session)
+{
+    if (session->mmap_aux != NULL) {
+        munmap(session->mmap_aux, session->mmap_aux_sz);
+        __atomic_sub_fetch(&perf_mapped, session->mmap_aux_sz, __ATOMIC_RELAXED);
+        session->mmap_aux = NULL;
+        session->mmap_aux_sz = 0;
+    }
+    if (session->mmap_buf != NULL) {
+        munmap(session->mmap_buf, session->mmap_buf_sz);
+        __atomic_sub_fetch(&perf_mapped, session->mmap_buf_sz, __ATOMIC_RELAXED);
+        session->mmap_buf = NULL;
+        session->mmap_buf_sz = 0;
+    }
+    if (session->perf_fd != -1) {
+        if (session->wait_fd != -1)
+            epoll_ctl(session->wait_fd, EPOLL_CTL_DEL, session->perf_fd, NULL);
+        close(session->perf_fd);
+        session->perf_fd = -1;
+    }
+    session->persistent = false;
 }
 
 
-static void perf_sig_handler(int signum, siginfo_t *siginfo, void *dummy)
+// epoll set every wait of the session sleeps in, perf_fd is always part of it
+static bool perf_wait_init(perf_session_t *session)
 {
-    if (signum == SIGIO) {
-        kill(gbl_status.child_pid, SIGTRAP);
-        gbl_status.data_ready++;
+    if (session->wait_fd != -1)
+        return true;
+    session->wait_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (session->wait_fd == -1) {
+        PLOG_F("failed to create epoll fd");
+        return false;
     }
+    return true;
 }
 
 
-static int32_t perf_parent(bts_branch_t **bts_start, uint64_t *count)
+// one of the CPUs we may run on, a different one for each server started
+static int perf_pick_cpu(void)
 {
-    struct sigaction sa;
-    memset(&sa, 0, sizeof(struct sigaction));
-    sa.sa_sigaction = perf_sig_handler;
-    sa.sa_flags = SA_SIGINFO;
-    if (sigaction(SIGIO, &sa, NULL) < 0) {
-        PLOG_F("error setting up signal handler");
-        return PERF_FAILURE;
+    cpu_set_t allowed;
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == -1 || CPU_COUNT(&allowed) == 0)
+        return -1;
+    unsigned nth = __atomic_fetch_add(&perf_next_cpu, 1, __ATOMIC_RELAXED) % CPU_COUNT(&allowed);
+    for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+        if (CPU_ISSET(cpu, &allowed) && nth-- == 0)
+            return cpu;
+    }
+    return -1;
+}
+
+
+// pins a server that has not forked yet, its children stay on the same CPU
+static bool perf_pin(perf_session_t *session, pid_t pid)
+{
+    session->cpu = perf_pick_cpu();
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (session->cpu != -1)
+        CPU_SET(session->cpu, &set);
+    if (session->cpu == -1 || sched_setaffinity(pid, sizeof(set), &set) == -1) {
+        PLOG_F("failed to pin PID=%d to CPU %d", pid, session->cpu);
+        session->cpu = -1;
+        return false;
     }
+    LOG_D("PID=%d pinned to CPU %d", pid, session->cpu);
+    return true;
+}
+
+
+static int32_t perf_attach(perf_session_t *session, pid_t pid, bool persistent)
+{
+    if (!perf_wait_init(session))
+        return PERF_FAILURE;
 
     struct perf_event_attr pe;
     memset(&pe, 0, sizeof(struct perf_event_attr));
     pe.size = sizeof(struct perf_event_attr);
     pe.exclude_kernel = 1;
     pe.type = perf_bts_type;
+    // a persistent event sits disabled on the fork server or launcher and
+    // gets inherited, still disabled, by every child it forks; the inherited
+    // events write into our buffers and are switched on and off through our
+    // fd (not by enable_on_exec: once the kernel swaps the contexts of a
+    // parent and child, an exec clears it for every later child). The
+    // kernel maps no rings
+    // of an inherited event that follows its task over all CPUs, so it
+    // counts on the CPU the server was pinned to, where its children run
+    pe.inherit = persistent;
+    pe.disabled = persistent;
+    // wake us up (perf_fd turns readable) well before the AUX ring fills,
+    // so that it can be drained while the child is still running
+    pe.aux_watermark = perf_aux_size(session) / 4;
 
-    gbl_status.perf_fd = perf_event_open(&pe, gbl_status.child_pid, -1, -1, 0);
-    if (gbl_status.perf_fd == -1) {
+    assert(!persistent || session->cpu != -1);
+    session->perf_fd = perf_event_open(&pe, pid, persistent ? session->cpu : -1, -1, 0);
+    if (session->perf_fd == -1) {
         PLOG_F("perf_event_open() failed");
-        goto bail_perf_open;
+        return PERF_FAILURE;
     }
 
-    gbl_status.mmap_buf = mmap(NULL, PERF_MAP_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, gbl_status.perf_fd, 0);
-    if (gbl_status.mmap_buf == MAP_FAILED) {
-        PLOG_F("failed mmap perf buffer, sz=%zu", (size_t) PERF_MAP_SZ);
-        goto bail_perf_buf;
+    const size_t map_sz = perf_map_size(session);
+    session->mmap_buf = mmap(NULL, map_sz, PROT_READ | PROT_WRITE, MAP_SHARED, session->perf_fd, 0);
+    if (session->mmap_buf == MAP_FAILED) {
+        PLOG_F("failed mmap perf buffer, sz=%zu", map_sz);
+        session->mmap_buf = NULL;
+        perf_close(session);
+        return PERF_FAILURE;
     }
+    session->mmap_buf_sz = map_sz;
+    __atomic_add_fetch(&perf_mapped, map_sz, __ATOMIC_RELAXED);
+    // nothing we fork (launchers of other sessions) keeps the rings alive
+    madvise(session->mmap_buf, map_sz, MADV_DONTFORK);
 
-    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) gbl_status.mmap_buf;
+    // the AUX area is mapped writable so that the kernel honours aux_tail
+    // instead of overwriting: traces of consecutive children queue up in it
+    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) session->mmap_buf;
     pem->aux_offset = pem->data_offset + pem->data_size;
-    pem->aux_size = PERF_AUX_SZ;
-    gbl_status.mmap_aux = mmap(NULL, pem->aux_size, PROT_READ, MAP_SHARED, gbl_status.perf_fd, pem->aux_offset);
-    if (gbl_status.mmap_aux == MAP_FAILED) {
-        PLOG_F("failed mmap perf aux, sz=%zu", (size_t) PERF_AUX_SZ);
-        goto bail_perf_aux;
+    pem->aux_size = perf_aux_size(session);
+    session->mmap_aux = mmap(NULL, pem->aux_size, PROT_READ | PROT_WRITE, MAP_SHARED, session->perf_fd, pem->aux_offset);
+    if (session->mmap_aux == MAP_FAILED) {
+        PLOG_F("failed mmap perf aux, sz=%zu", (size_t) pem->aux_size);
+        session->mmap_aux = NULL;
+        perf_close(session);
+        return PERF_FAILURE;
+    }
+    session->mmap_aux_sz = pem->aux_size;
+    __atomic_add_fetch(&perf_mapped, session->mmap_aux_sz, __ATOMIC_RELAXED);
+    madvise(session->mmap_aux, session->mmap_aux_sz, MADV_DONTFORK);
+
+    fcntl(session->perf_fd, F_SETFL, O_RDWR|O_NONBLOCK);
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = session->perf_fd };
+    if (epoll_ctl(session->wait_fd, EPOLL_CTL_ADD, session->perf_fd, &ev) == -1) {
+        PLOG_F("failed to watch perf fd");
+        perf_close(session);
+        return PERF_FAILURE;
     }
+    if (!persistent)
+        ioctl(session->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
 
-    fcntl(gbl_status.perf_fd, F_SETFL, O_RDWR|O_NONBLOCK|O_ASYNC);
-    fcntl(gbl_status.perf_fd, F_SETSIG, SIGIO);
-    fcntl(gbl_status.perf_fd, F_SETOWN, getpid());
-    ioctl(gbl_status.perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    session->persistent = persistent;
+    return PERF_SUCCESS;
+}
 
-    int status;
-    int wait_ret;
-    while (1) {
-        LOG_D("waiting for child PID=%lu", gbl_status.child_pid);
-        wait_ret = waitpid(gbl_status.child_pid, &status, 0);
-        if (wait_ret == -1 && errno == EINTR) {
-            continue;
-        }
-        if (wait_ret == -1) {
-            PLOG_F("failed waiting for child PID=%lu", gbl_status.child_pid);
-            goto bail_perf_wait;
-        }
-        if (gbl_status.data_ready > 0) {
-            gbl_status.data_ready--;
-            analyze_bts(bts_start, count);
-        }
-        if (WIFEXITED(status)) {
-            LOG_D("child terminated with status %d", WEXITSTATUS(status));
-            break;
-        } else if (WIFSIGNALED(status)) {
-            LOG_D("child terminated by signal #%d", WTERMSIG(status));
-            break;
-        } else if (WIFSTOPPED(status) && WSTOPSIG(status) != SIGTRAP) {
-            LOG_D("child stopped by signal #%d", WSTOPSIG(status));
+
+// hands the space used by the last trace back to the kernel
+static void perf_consume(perf_session_t *session)
+{
+    struct perf_event_mmap_page *pem = (struct perf_event_mmap_page *) session->mmap_buf;
+    uint64_t data_head = ATOMIC_GET(pem->data_head);
+    uint64_t aux_head = ATOMIC_GET(pem->aux_head);
+    mb();
+    ATOMIC_SET(pem->data_tail, data_head);
+    ATOMIC_SET(pem->aux_tail, aux_head);
+}
+
+
+// sleeps until fd turns readable (or hangs up), draining the AUX ring
+// whenever perf wakes us up in the meantime
+static bool perf_wait(perf_session_t *session, int fd)
+{
+    if (!perf_wait_init(session))
+        return false;
+    struct epoll_event ev = { .events = EPOLLIN, .data.fd = fd };
+    if (epoll_ctl(session->wait_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        PLOG_F("failed to watch fd %d", fd);
+        return false;
+    }
+
+    bool ready = false, ret = true;
+    while (!ready) {
+        struct epoll_event events[2];
+        int n = epoll_wait(session->wait_fd, events, 2, -1);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            PLOG_F("failed waiting for PID=%d", session->child_pid);
+            ret = false;
             break;
         }
-        if (ptrace(PTRACE_CONT, gbl_status.child_pid, 0, 0) == -1) {
-            PLOG_F("failed to continue child");
+        for (int i = 0; i < n; i++) {
+            if (events[i].data.fd == fd) {
+                ready = true;
+                continue;
+            }
+            // past the AUX watermark, or the traced task is gone and the
+            // perf fd would report so forever
+            perf_drain(session);
+            if (events[i].events & EPOLLHUP)
+                epoll_ctl(session->wait_fd, EPOLL_CTL_DEL, session->perf_fd, NULL);
+        }
+    }
+
+    epoll_ctl(session->wait_fd, EPOLL_CTL_DEL, fd, NULL);
+    return ret;
+}
+
+
+static void perf_log_status(int status)
+{
+    if (WIFEXITED(status)) {
+        LOG_D("child terminated with status %d", WEXITSTATUS(status));
+    } else if (WIFSIGNALED(status)) {
+        LOG_D("child terminated by signal #%d", WTERMSIG(status));
+    }
+}
+
+
+// traces the child perf_fork() left waiting on go_fd until it exits
+static int32_t perf_parent(perf_session_t *session, int go_fd, bts_branch_t **bts_start, uint64_t *count)
+{
+    int child_fd = syscall(SYS_pidfd_open, session->child_pid, 0);
+    if (child_fd == -1) {
+        PLOG_F("failed to open pidfd of child PID=%d", session->child_pid);
+    } else if (perf_attach(session, session->child_pid, false) == PERF_FAILURE) {
+        close(child_fd);
+        child_fd = -1;
+    }
+
+    // closing go_fd without a byte makes the child give up
+    const uint8_t go = 1;
+    if (child_fd != -1 && write(go_fd, &go, 1) != 1) {
+        PLOG_F("failed to start child PID=%d", session->child_pid);
+        close(child_fd);
+        child_fd = -1;
+    }
+    close(go_fd);
+
+    bool traced = child_fd != -1;
+    if (traced) {
+        LOG_D("waiting for child PID=%d", session->child_pid);
+        traced = perf_wait(session, child_fd);
+        close(child_fd);
+    }
+    if (!traced)
+        kill(session->child_pid, 9);
+
+    int status;
+    while (waitpid(session->child_pid, &status, 0) == -1) {
+        if (errno != EINTR) {
+            PLOG_F("failed waiting for child PID=%d", session->child_pid);
             return PERF_FAILURE;
         }
     }
+    if (!traced)
+        return PERF_FAILURE;
+    perf_log_status(status);
 
-    analyze_bts(bts_start, count);
-    ATOMIC_SET(pem->data_head, 0);
-    ATOMIC_SET(pem->data_tail, 0);
-    ATOMIC_SET(pem->aux_head, 0);
-    ATOMIC_SET(pem->aux_tail, 0);
+    perf_drain(session);
+    perf_trace_end(session, bts_start, count);
     return PERF_SUCCESS;
+}
+
+
+// SUT arguments with every "@@" replaced by a path to the input
+static char const **perf_input_argv(char const **argv)
+{
+    size_t argc = 0;
+    while (argv[argc] != NULL)
+        argc++;
 
-bail_perf_wait:
-    munmap(gbl_status.mmap_aux, PERF_AUX_SZ);
-bail_perf_aux:
-    munmap(gbl_status.mmap_buf, PERF_MAP_SZ);
-bail_perf_buf:
-    close(gbl_status.perf_fd);
-bail_perf_open:
-    kill(gbl_status.child_pid, 9);
-    return PERF_FAILURE;
+    char const **input_argv = malloc((argc + 1) * sizeof(char *));
+    if (input_argv == NULL)
+        return argv;
+    for (size_t i = 0; i <= argc; i++) {
+        if (argv[i] != NULL && strcmp(argv[i], PERF_INPUT_ARG) == 0)
+            input_argv[i] = PERF_INPUT_PATH;
+        else
+            input_argv[i] = argv[i];
+    }
+    return input_argv;
 }
 
 
-static int32_t perf_child(char const **argv)
+static bool perf_null_output(void)
 {
     int null_fd = open("/dev/null", O_WRONLY);
-    if (null_fd == -1) {
-        PLOG_F("failed to open /dev/null");
-        return PERF_FAILURE;
-    }
+    if (null_fd == -1)
+        return false;
     dup2(null_fd, STDOUT_FILENO);
     dup2(null_fd, STDERR_FILENO);
+    close(null_fd);
+    return true;
+}
+
+
+// argv must already have gone through perf_input_argv(), nothing past fork()
+// may allocate when the monitor is multi-threaded
+static void perf_child(char const **argv, int go_fd)
+{
+    if (!perf_null_output())
+        _exit(EXIT_FAILURE);
+
+    // perf is attached to us once the parent says go
+    uint8_t go;
+    if (read(go_fd, &go, 1) != 1)
+        _exit(EXIT_FAILURE);
+    close(go_fd);
+
+    execv(argv[0], (char *const *) &argv[0]);
+    _exit(EXIT_FAILURE);
+}
+
+
+// forks a child that execs argv, with input_fd (if not -1) as its stdin, as
+// soon as perf_parent() has attached to it; returns the fd that lets it go
+static int perf_fork(perf_session_t *session, char const **argv, int input_fd)
+{
+    int go_pipe[2];
+    if (pipe2(go_pipe, O_CLOEXEC) == -1) {
+        PLOG_F("failed to create child pipe");
+        return -1;
+    }
+
+    session->child_pid = fork();
+    if (session->child_pid < 0) {
+        PLOG_F("failed to fork");
+        close(go_pipe[0]);
+        close(go_pipe[1]);
+        return -1;
+    } else if (session->child_pid == 0) {
+        close(go_pipe[1]);
+        if (input_fd != -1) {
+            dup2(input_fd, STDIN_FILENO);
+            lseek(STDIN_FILENO, 0, SEEK_SET);
+        }
+        perf_child(argv, go_pipe[0]);
+    }
+
+    close(go_pipe[0]);
+    return go_pipe[1];
+}
+
+
+// creates the input memfd and maps at least capacity bytes of it; with a
+// capacity of 0 nothing needs to be mapped yet
+static bool perf_input_reserve(perf_session_t *session, size_t capacity)
+{
+    if (session->input_fd == -1) {
+        session->input_fd = memfd_create(PERF_INPUT_NAME, MFD_CLOEXEC);
+        if (session->input_fd == -1) {
+            PLOG_F("failed to create input memfd");
+            return false;
+        }
+    }
+
+    if (capacity > session->input_cap) {
+        if (session->input_buf != NULL)
+            munmap(session->input_buf, session->input_cap);
+        session->input_buf = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED,
+                                  session->input_fd, 0);
+        if (session->input_buf == MAP_FAILED) {
+            PLOG_F("failed mmap input, sz=%zu", capacity);
+            session->input_buf = NULL;
+            session->input_cap = 0;
+            return false;
+        }
+        session->input_cap = capacity;
+    }
 
-    if (ptrace(PTRACE_TRACEME, 0, 0, 0) == -1) {
-        PLOG_F("failed to ptrace child");
+    // the whole mapping must be backed before anyone writes into it
+    if (session->input_len != session->input_cap) {
+        if (ftruncate(session->input_fd, session->input_cap) == -1) {
+            PLOG_F("failed to resize input memfd");
+            return false;
+        }
+        session->input_len = session->input_cap;
+    }
+
+    return true;
+}
+
+
+// shrinks the input memfd to the actual input, so the SUT sees EOF there
+static bool perf_input_commit(perf_session_t *session, const uint8_t *data, size_t data_count)
+{
+    if (data != session->input_buf || session->input_buf == NULL) {
+        if (!perf_input_reserve(session, data_count))
+            return false;
+        if (data_count > 0)
+            memcpy(session->input_buf, data, data_count);
+    }
+
+    if (ftruncate(session->input_fd, data_count) == -1) {
+        PLOG_F("failed to resize input memfd");
+        return false;
+    }
+    session->input_len = data_count;
+    return true;
+}
+
+
+// the AUX ring may fill up under the child while we wait for the reply
+static bool forksrv_read(perf_session_t *session, uint32_t *msg)
+{
+    if (!perf_wait(session, session->forksrv_st_fd))
+        return false;
+    ssize_t ret;
+    do {
+        ret = read(session->forksrv_st_fd, msg, sizeof(uint32_t));
+    } while (ret == -1 && errno == EINTR);
+    return ret == sizeof(uint32_t);
+}
+
+
+static bool forksrv_write(perf_session_t *session, uint32_t msg)
+{
+    ssize_t ret;
+    do {
+        ret = write(session->forksrv_ctl_fd, &msg, sizeof(uint32_t));
+    } while (ret == -1 && errno == EINTR);
+    return ret == sizeof(uint32_t);
+}
+
+
+// one input through the fork server or the launcher, both keep the event
+// what the launcher says while a child is stopped at its exec, it goes on
+// with FORKSRV_MSG_GO like a child of the fork server
+typedef struct launcher_msg {
+    uint32_t pid;
+    uint32_t reserved;
+    uint64_t image_start;
+    uint64_t image_end;
+} launcher_msg_t;
+
+
+static int32_t perf_server_run(perf_session_t *session, const uint8_t *data, size_t data_count,
+                               bts_branch_t **bts_start, uint64_t *count)
+{
+    const char *server = session->launcher ? "launcher" : "fork server";
+
+    // the persistent event has to be reopened for a resized AUX ring
+    if (perf_aux_size(session) != session->mmap_aux_sz) {
+        perf_close(session);
+        if (perf_attach(session, session->forksrv_pid, true) == PERF_FAILURE)
+            return PERF_FAILURE;
+    }
+
+    perf_consume(session);
+    perf_trace_begin(session);
+
+    if (!perf_input_commit(session, data, data_count)) {
         return PERF_FAILURE;
     }
 
-    raise(SIGTRAP);
-    execv(argv[0], (char *const *) &argv[0]);
-    return PERF_FAILURE;
+    uint32_t msg;
+    if (!forksrv_write(session, FORKSRV_MSG_FORK)) {
+        LOG_F("%s PID=%d is gone", server, session->forksrv_pid);
+        return PERF_FAILURE;
+    }
+    if (session->launcher) {
+        // read without draining: chunks streamed before the image is known
+        // could not be relocated, and the launcher answers as the child execs
+        launcher_msg_t started;
+        ssize_t ret;
+        do {
+            ret = read(session->forksrv_st_fd, &started, sizeof(started));
+        } while (ret == -1 && errno == EINTR);
+        if (ret != sizeof(started)) {
+            LOG_F("%s PID=%d is gone", server, session->forksrv_pid);
+            return PERF_FAILURE;
+        }
+        msg = started.pid;
+        session->image_start = started.image_start;
+        session->image_end = started.image_end;
+    } else if (!forksrv_read(session, &msg)) {
+        LOG_F("%s PID=%d is gone", server, session->forksrv_pid);
+        return PERF_FAILURE;
+    }
+    session->child_pid = (pid_t) msg;
+    LOG_D("waiting for forked child PID=%d", session->child_pid);
+
+    // the server itself is traced too while it waits for the child, but all
+    // it runs is libc and the shim, or the launcher's loop
+    ioctl(session->perf_fd, PERF_EVENT_IOC_ENABLE, 0);
+    const bool alive = forksrv_write(session, FORKSRV_MSG_GO) && forksrv_read(session, &msg);
+    ioctl(session->perf_fd, PERF_EVENT_IOC_DISABLE, 0);
+    if (!alive) {
+        LOG_F("%s PID=%d is gone", server, session->forksrv_pid);
+        return PERF_FAILURE;
+    }
+
+    perf_log_status((int) msg);
+
+    perf_drain(session);
+    perf_trace_end(session, bts_start, count);
+    return PERF_SUCCESS;
 }
 
 
-static void perf_close(void)
+// stops the fork server or launcher, the event goes with it
+static void perf_server_stop(perf_session_t *session)
 {
-    if (gbl_status.mmap_aux != NULL) {
-        munmap(gbl_status.mmap_aux, PERF_AUX_SZ);
-        gbl_status.mmap_aux = NULL;
+    perf_close(session);
+    if (session->forksrv_ctl_fd != -1) {
+        close(session->forksrv_ctl_fd);
+        session->forksrv_ctl_fd = -1;
     }
-    if (gbl_status.mmap_buf != NULL) {
-        munmap(gbl_status.mmap_buf, PERF_MAP_SZ);
-        gbl_status.mmap_buf = NULL;
+    if (session->forksrv_st_fd != -1) {
+        close(session->forksrv_st_fd);
+        session->forksrv_st_fd = -1;
     }
-    if (gbl_status.perf_fd != -1) {
-        close(gbl_status.perf_fd);
-        gbl_status.perf_fd = -1;
+    if (session->forksrv_pid != -1) {
+        kill(session->forksrv_pid, 9);
+        waitpid(session->forksrv_pid, NULL, 0);
+        session->forksrv_pid = -1;
     }
+    if (session->launcher_input_argv != session->launcher_argv)
+        free(session->launcher_input_argv);
+    session->launcher_input_argv = NULL;
+    session->launcher_argv = NULL;
+    session->launcher = false;
+    session->cpu = -1;
+    session->image_start = 0;
+    session->image_end = 0;
 }
 
 
-void perf_monitor(char const **argv)
+void perf_session_init(perf_session_t *session)
+{
+    memset(session, 0, sizeof(perf_session_t));
+    session->child_pid = -1;
+    session->perf_fd = -1;
+    session->wait_fd = -1;
+    session->forksrv_pid = -1;
+    session->cpu = -1;
+    session->forksrv_ctl_fd = -1;
+    session->forksrv_st_fd = -1;
+    session->input_fd = -1;
+}
+
+
+void perf_session_destroy(perf_session_t *session)
+{
+    perf_server_stop(session);
+    if (session->wait_fd != -1) {
+        close(session->wait_fd);
+        session->wait_fd = -1;
+    }
+    if (session->input_buf != NULL) {
+        munmap(session->input_buf, session->input_cap);
+        session->input_buf = NULL;
+        session->input_cap = 0;
+    }
+    if (session->input_fd != -1) {
+        close(session->input_fd);
+        session->input_fd = -1;
+    }
+    session->input_len = 0;
+    free(session->trace_buf);
+    session->trace_buf = NULL;
+    session->trace_cap = 0;
+}
+
+
+// shared buffer of at least capacity bytes that the next input can be
+// written into directly, saving perf_session_trace() a copy
+uint8_t *perf_session_input(perf_session_t *session, size_t capacity)
+{
+    return perf_input_reserve(session, capacity) ? session->input_buf : NULL;
+}
+
+
+// with fn set, traces are handed to it chunk by chunk as the AUX ring is
+// drained (also while the child runs) and perf_session_trace() returns no
+// branch array; with NULL they are gathered and returned whole
+void perf_session_stream(perf_session_t *session, perf_chunk_fn_t fn, void *data)
+{
+    session->chunk_fn = fn;
+    session->chunk_data = data;
+}
+
+
+static size_t round_pow2(size_t n)
+{
+    size_t p = 1;
+    while (p < n)
+        p *= 2;
+    return p;
+}
+
+
+// ring sizes in pages (rounded up to powers of two), 0 keeps the default;
+// takes effect at the next attach
+void perf_session_buffers(perf_session_t *session, size_t data_pages, size_t aux_pages, bool aux_auto)
+{
+    session->data_pages = data_pages ? round_pow2(data_pages) : 0;
+    session->aux_pages = aux_pages ? round_pow2(aux_pages) : 0;
+    session->aux_pages_cur = 0;
+    session->aux_auto = aux_auto;
+    session->aux_calm = 0;
+}
+
+
+// caps what auto-sized AUX rings may grow to, summed over all sessions
+void perf_set_budget(size_t bytes)
+{
+    __atomic_store_n(&perf_budget, bytes, __ATOMIC_RELAXED);
+}
+
+
+static const char *perf_parse_num(const char *p, const char *end, uint64_t base, uint64_t *value)
+{
+    *value = 0;
+    for (; p < end; p++) {
+        uint64_t digit;
+        if (*p >= '0' && *p <= '9')
+            digit = *p - '0';
+        else if (base == 16 && *p >= 'a' && *p <= 'f')
+            digit = *p - 'a' + 10;
+        else
+            break;
+        *value = *value * base + digit;
+    }
+    return p;
+}
+
+
+static const char *perf_skip_field(const char *p, const char *end)
+{
+    while (p < end && *p != ' ')
+        p++;
+    while (p < end && *p == ' ')
+        p++;
+    return p;
+}
+
+
+// where the executable of pid is mapped: its first mapping and the ones of
+// the same file right after it; async-signal-safe, the launcher uses it
+static bool perf_image_find(pid_t pid, uint64_t *image_start, uint64_t *image_end)
+{
+    char path[32] = "/proc/";
+    size_t len = 6;
+    char digits[12];
+    size_t n = 0;
+    do {
+        digits[n++] = '0' + pid % 10;
+        pid /= 10;
+    } while (pid > 0);
+    while (n > 0)
+        path[len++] = digits[--n];
+    memcpy(path + len, "/maps", sizeof("/maps"));
+
+    char maps[PERF_MAPS_SZ];
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1)
+        return false;
+    ssize_t size = 0, ret;
+    while (size < (ssize_t) sizeof(maps)
+           && (ret = read(fd, maps + size, sizeof(maps) - size)) > 0)
+        size += ret;
+    close(fd);
+
+    *image_start = *image_end = 0;
+    uint64_t image_inode = 0;
+    const char *p = maps, *end = maps + size;
+    while (p < end) {
+        const char *eol = memchr(p, '\n', end - p);
+        if (eol == NULL)
+            break;
+        // start-end perms offset dev inode path
+        uint64_t start, stop, inode;
+        p = perf_parse_num(p, eol, 16, &start) + 1;
+        p = perf_parse_num(p, eol, 16, &stop);
+        p = perf_skip_field(perf_skip_field(perf_skip_field(p, eol), eol), eol);
+        perf_parse_num(perf_skip_field(p, eol), eol, 10, &inode);
+        if (*image_end == 0 && inode != 0) {
+            image_inode = inode;
+            *image_start = start;
+        } else if (inode != image_inode) {
+            break;
+        }
+        *image_end = stop;
+        p = eol + 1;
+    }
+    return *image_end != 0;
+}
+
+
+int32_t perf_session_forksrv(perf_session_t *session, char const **argv, const char *preload)
 {
-    perf_close();
     if (!perf_init()) {
-        exit(EXIT_FAILURE);
+        return PERF_FAILURE;
     }
 
-    gbl_status.child_pid = fork();
-    if (gbl_status.child_pid < 0) {
+    if (!perf_input_reserve(session, 0)) {
+        LOG_F("failed to set up the fork server input");
+        return PERF_FAILURE;
+    }
+
+    int ctl_pipe[2], st_pipe[2];
+    if (pipe2(ctl_pipe, O_CLOEXEC) == -1) {
+        PLOG_F("failed to create fork server pipe");
+        perf_session_destroy(session);
+        return PERF_FAILURE;
+    }
+    if (pipe2(st_pipe, O_CLOEXEC) == -1) {
+        PLOG_F("failed to create fork server pipe");
+        close(ctl_pipe[0]);
+        close(ctl_pipe[1]);
+        perf_session_destroy(session);
+        return PERF_FAILURE;
+    }
+
+    session->forksrv_pid = fork();
+    if (session->forksrv_pid < 0) {
         PLOG_F("failed to fork");
-        exit(EXIT_FAILURE);
-    } else if (gbl_status.child_pid > 0) {
-        if (perf_parent(NULL, NULL) == PERF_FAILURE)
-          exit(EXIT_FAILURE);
-    } else {
-        if (perf_child(argv) == PERF_FAILURE)
-          exit(EXIT_FAILURE);
+        session->forksrv_pid = -1;
+        close(ctl_pipe[0]);
+        close(ctl_pipe[1]);
+        close(st_pipe[0]);
+        close(st_pipe[1]);
+        perf_session_destroy(session);
+        return PERF_FAILURE;
+    } else if (session->forksrv_pid == 0) {
+        int null_fd = open("/dev/null", O_WRONLY);
+        if (null_fd == -1) {
+            PLOG_F("failed to open /dev/null");
+            _exit(EXIT_FAILURE);
+        }
+        dup2(null_fd, STDOUT_FILENO);
+        dup2(null_fd, STDERR_FILENO);
+        dup2(session->input_fd, STDIN_FILENO);
+        dup2(ctl_pipe[0], FORKSRV_CTL_FD);
+        dup2(st_pipe[1], FORKSRV_ST_FD);
+
+        setenv("LD_PRELOAD", preload, 1);
+        argv = perf_input_argv(argv);
+        execv(argv[0], (char *const *) &argv[0]);
+        _exit(EXIT_FAILURE);
     }
+
+    close(ctl_pipe[0]);
+    close(st_pipe[1]);
+    session->forksrv_ctl_fd = ctl_pipe[1];
+    session->forksrv_st_fd = st_pipe[0];
+
+    uint32_t msg;
+    if (!forksrv_read(session, &msg) || msg != FORKSRV_MSG_HELLO) {
+        LOG_F("fork server did not start, is %s loadable by %s?", preload, argv[0]);
+        perf_session_destroy(session);
+        return PERF_FAILURE;
+    }
+
+    if (!perf_pin(session, session->forksrv_pid)
+        || perf_attach(session, session->forksrv_pid, true) == PERF_FAILURE) {
+        perf_session_destroy(session);
+        return PERF_FAILURE;
+    }
+
+    // every child is forked from it, at the same addresses
+    if (!perf_image_find(session->forksrv_pid, &session->image_start, &session->image_end))
+        LOG_W("where fork server PID=%d maps %s is unknown", session->forksrv_pid, argv[0]);
+    LOG_D("fork server PID=%d ready", session->forksrv_pid);
+    return PERF_SUCCESS;
 }
 
 
-int32_t perf_monitor_api(const uint8_t *data, size_t data_count, char const **argv,
-                         bts_branch_t **bts_start, uint64_t *count)
+// the launcher of exec mode: a fork of ours, left with nothing but the
+// input and its pipes, that forks and execs the SUT for every input; only
+// async-signal-safe calls past fork(), the monitor is multi-threaded
+static void perf_launcher_loop(char const **argv)
 {
-    perf_close();
-    if (!perf_init()) {
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (!perf_null_output())
+        _exit(EXIT_FAILURE);
+    syscall(SYS_close_range, 3, FORKSRV_CTL_FD - 1, 0);
+    syscall(SYS_close_range, FORKSRV_ST_FD + 1, ~0U, 0);
+
+    uint32_t msg;
+    while (read(FORKSRV_CTL_FD, &msg, sizeof(uint32_t)) == sizeof(uint32_t)) {
+        if (msg != FORKSRV_MSG_FORK)
+            _exit(EXIT_FAILURE);
+
+        pid_t child = fork();
+        if (child < 0)
+            _exit(EXIT_FAILURE);
+        if (child == 0) {
+            close(FORKSRV_CTL_FD);
+            close(FORKSRV_ST_FD);
+            lseek(STDIN_FILENO, 0, SEEK_SET);
+            // stopped right after the exec, while where ASLR put the SUT is
+            // looked up and the event is switched on; untraceable, it runs
+            // on and that stays unknown
+            ptrace(PTRACE_TRACEME, 0, NULL, NULL);
+            execv(argv[0], (char *const *) &argv[0]);
+            _exit(EXIT_FAILURE);
+        }
+
+        launcher_msg_t started = { (uint32_t) child, 0, 0, 0 };
+        int status;
+        for (;;) {
+            while (waitpid(child, &status, 0) == -1) {
+                if (errno != EINTR)
+                    _exit(EXIT_FAILURE);
+            }
+            if (!WIFSTOPPED(status))
+                break;
+            if (WSTOPSIG(status) == SIGTRAP) {
+                perf_image_find(child, &started.image_start, &started.image_end);
+                break;
+            }
+            // a signal that came before the exec
+            ptrace(PTRACE_CONT, child, NULL, (void *) (uintptr_t) WSTOPSIG(status));
+        }
+        if (write(FORKSRV_ST_FD, &started, sizeof(started)) != sizeof(started)
+            || read(FORKSRV_CTL_FD, &msg, sizeof(uint32_t)) != sizeof(uint32_t)
+            || msg != FORKSRV_MSG_GO)
+            _exit(EXIT_FAILURE);
+        // still stopped at its exec, the child is yet to run
+        if (WIFSTOPPED(status)) {
+            ptrace(PTRACE_DETACH, child, NULL, NULL);
+            while (waitpid(child, &status, 0) == -1) {
+                if (errno != EINTR)
+                    _exit(EXIT_FAILURE);
+            }
+        }
+        msg = (uint32_t) status;
+        if (write(FORKSRV_ST_FD, &msg, sizeof(uint32_t)) != sizeof(uint32_t))
+            _exit(EXIT_FAILURE);
+    }
+    _exit(EXIT_SUCCESS);
+}
+
+
+// exec mode keeps one event and its buffers for the whole session: it sits
+// disabled on the launcher and every child inherits it, to be switched on
+// once the child has exec'd, so that the SUT is traced from its first
+// instruction; the launcher and its children are pinned to one CPU for it
+static int32_t perf_launcher_start(perf_session_t *session, char const **argv)
+{
+    perf_server_stop(session);
+    if (!perf_input_reserve(session, 0)) {
+        LOG_F("failed to set up the launcher input");
         return PERF_FAILURE;
     }
 
-    int in_fd = open("./.input", O_CREAT | O_TRUNC | O_WRONLY | O_CLOEXEC, 0644);
-    if (in_fd == -1) {
-        PLOG_F("failed to open input file");
+    int ctl_pipe[2], st_pipe[2];
+    if (pipe2(ctl_pipe, O_CLOEXEC) == -1) {
+        PLOG_F("failed to create launcher pipe");
         return PERF_FAILURE;
     }
-    ssize_t write_sz = write(in_fd, data, data_count);
-    if (write_sz == -1) {
-        PLOG_F("failed to write to input file");
-        close(in_fd);
-        unlink("./.input");
+    if (pipe2(st_pipe, O_CLOEXEC) == -1) {
+        PLOG_F("failed to create launcher pipe");
+        close(ctl_pipe[0]);
+        close(ctl_pipe[1]);
         return PERF_FAILURE;
     }
-    close(in_fd);
 
-    gbl_status.child_pid = fork();
-    if (gbl_status.child_pid < 0) {
+    session->launcher = true;
+    session->launcher_argv = argv;
+    session->launcher_input_argv = perf_input_argv(argv);
+    session->forksrv_pid = fork();
+    if (session->forksrv_pid < 0) {
         PLOG_F("failed to fork");
-        unlink("./.input");
+        session->forksrv_pid = -1;
+        close(ctl_pipe[0]);
+        close(ctl_pipe[1]);
+        close(st_pipe[0]);
+        close(st_pipe[1]);
+        perf_server_stop(session);
         return PERF_FAILURE;
-    } else if (gbl_status.child_pid > 0) {
-        close(in_fd);
-        int32_t ret = perf_parent(bts_start, count);
-        unlink("./.input");
-        return ret;
-    } else {
-        in_fd = open("./.input", O_RDONLY);
-        if (in_fd == -1) {
-            PLOG_F("failed to open input file");
+    } else if (session->forksrv_pid == 0) {
+        dup2(session->input_fd, STDIN_FILENO);
+        dup3(ctl_pipe[0], FORKSRV_CTL_FD, O_CLOEXEC);
+        dup3(st_pipe[1], FORKSRV_ST_FD, O_CLOEXEC);
+        perf_launcher_loop(session->launcher_input_argv);
+    }
+
+    close(ctl_pipe[0]);
+    close(st_pipe[1]);
+    session->forksrv_ctl_fd = ctl_pipe[1];
+    session->forksrv_st_fd = st_pipe[0];
+
+    if (!perf_pin(session, session->forksrv_pid)
+        || perf_attach(session, session->forksrv_pid, true) == PERF_FAILURE) {
+        perf_server_stop(session);
+        return PERF_FAILURE;
+    }
+    LOG_D("launcher PID=%d ready", session->forksrv_pid);
+    return PERF_SUCCESS;
+}
+
+
+int32_t perf_session_trace(perf_session_t *session, const uint8_t *data, size_t data_count,
+                           char const **argv, bts_branch_t **bts_start, uint64_t *count)
+{
+    if (session->forksrv_pid == -1 || (session->launcher && session->launcher_argv != argv)) {
+        if (!perf_init() || perf_launcher_start(session, argv) == PERF_FAILURE)
             return PERF_FAILURE;
-        }
-        dup2(in_fd, STDIN_FILENO);
-        close(in_fd);
-        perf_child(argv);
-        LOG_M("returning from child...");
-        // raise(SIGKILL);
-        return 0;
-        // kill(getpid(), 9);
-        // _exit(1);
-        // abort();
     }
+    int32_t ret = perf_server_run(session, data, data_count, bts_start, count);
+    // whatever state it was left in, the next input gets a fresh launcher
+    if (ret == PERF_FAILURE && session->launcher)
+        perf_server_stop(session);
+    return ret;
+}
+
+
+void perf_monitor(char const **argv)
+{
+    perf_session_t session;
+    perf_session_init(&session);
+    if (!perf_init()) {
+        exit(EXIT_FAILURE);
+    }
+    uint64_t counter = 0;
+    perf_session_stream(&session, perf_log_chunk, &counter);
+
+    char const **input_argv = perf_input_argv(argv);
+    int go_fd = perf_fork(&session, input_argv, -1);
+    if (input_argv != argv)
+        free(input_argv);
+    if (go_fd == -1 || perf_parent(&session, go_fd, NULL, NULL) == PERF_FAILURE)
+        exit(EXIT_FAILURE);
+    LOG_I("BTS recorded %" PRIu64 " branches", counter);
+    perf_session_destroy(&session);
+}
+
+
+int32_t perf_monitor_api(const uint8_t *data, size_t data_count, char const **argv,
+                         bts_branch_t **bts_start, uint64_t *count)
+{
+    if (!api_session_ready) {
+        perf_session_init(&api_session);
+        api_session_ready = true;
+    }
+    return perf_session_trace(&api_session, data, data_count, argv, bts_start, count);
+}
+
+
+// where the SUT binary was mapped during the last perf_monitor_api() trace
+void perf_monitor_api_image(uint64_t *image_start, uint64_t *image_end)
+{
+    *image_start = api_session.image_start;
+    *image_end = api_session.image_end;
 }
@@ -3,6 +3,8 @@
 
 #include <inttypes.h>
 #include <stdlib.h>
+#include <stdbool.h>
+#include <sys/types.h>
 
 #define PERF_FAILURE -1
 #define PERF_SUCCESS  1
@@ -13,16 +15,59 @@ typedef struct bts_branch {
     uint64_t misc;
 } bts_branch_t;
 
-typedef struct gbl_status {
+// gets the trace in order, chunk by chunk, while it is being drained
+typedef void (*perf_chunk_fn_t)(const bts_branch_t *branches, uint64_t count, void *data);
+
+typedef struct perf_session {
     pid_t child_pid;
     int perf_fd;
-    size_t data_ready;
+    int wait_fd;            // epoll on perf_fd and whatever signals the end of a run
     void *mmap_buf;
     void *mmap_aux;
-} gbl_status_t;
+    bts_branch_t *trace_buf;    // drained trace, when nobody streams it
+    size_t trace_cap;
+    bool persistent;        // perf_fd follows the fork server, not a child
+    pid_t forksrv_pid;      // the fork server, or the launcher in exec mode
+    int cpu;                // the server and its children run there, -1 if unpinned
+    int forksrv_ctl_fd;
+    int forksrv_st_fd;
+    int input_fd;           // memfd the SUT reads its input from
+    uint8_t *input_buf;     // shared mapping of input_fd
+    size_t input_cap;
+    size_t input_len;
+    perf_chunk_fn_t chunk_fn;
+    void *chunk_data;
+    uint64_t trace_count;   // branches of the last trace
+    uint64_t aux_truncated; // PERF_RECORD_AUX truncations during the last trace
+    uint64_t lost;          // records the kernel dropped during the last trace
+    uint64_t aux_hwm;       // most bytes of the AUX ring in use at once, last trace
+    size_t data_pages;      // data ring size, 0 for the default
+    size_t aux_pages;       // AUX ring size, the floor when auto-sized; 0 for the default
+    size_t aux_pages_cur;   // AUX ring size the next attach maps
+    bool aux_auto;          // grow the AUX ring on truncation, shrink it when idle
+    size_t aux_calm;        // traces in a row that used little of the AUX ring
+    size_t mmap_buf_sz;
+    size_t mmap_aux_sz;
+    bool launcher;          // forksrv_pid is our own launcher, exec mode
+    char const **launcher_argv;         // as given, a different SUT restarts it
+    char const **launcher_input_argv;
+    uint64_t image_start;   // where the SUT binary is mapped in the last child,
+    uint64_t image_end;     // 0 when unknown
+} perf_session_t;
+
+void    perf_session_init(perf_session_t *session);
+void    perf_session_destroy(perf_session_t *session);
+uint8_t *perf_session_input(perf_session_t *session, size_t capacity);
+void    perf_session_stream(perf_session_t *session, perf_chunk_fn_t fn, void *data);
+void    perf_session_buffers(perf_session_t *session, size_t data_pages, size_t aux_pages, bool aux_auto);
+void    perf_set_budget(size_t bytes);
+int32_t perf_session_forksrv(perf_session_t *session, char const **argv, const char *preload);
+int32_t perf_session_trace(perf_session_t *session, const uint8_t *data, size_t data_count,
+                           char const **argv, bts_branch_t **bts_start, uint64_t *count);
 
 void perf_monitor(char const **argv);
 int32_t perf_monitor_api(const uint8_t *data, size_t data_count, char const **argv,
                          bts_branch_t **bts_start, uint64_t *count);
+void    perf_monitor_api_image(uint64_t *image_start, uint64_t *image_end);
 
 #endif
@@ -0,0 +1,348 @@
+#define _GNU_SOURCE
+#include "sections.h"
+#include "log.h"
+#include <elf.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <assert.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#   define ELF_HOST_DATA ELFDATA2LSB
+#else
+#   define ELF_HOST_DATA ELFDATA2MSB
+#endif
+
+// a field of an ELF structure, whichever the class of the file
+#define ELF_GET(index, ptr, type, field)                                        \
+    ((index)->is64 ? (uint64_t) ((const Elf64_##type *) (ptr))->field          \
+                   : (uint64_t) ((const Elf32_##type *) (ptr))->field)
+#define ELF_SIZE(index, type) ((index)->is64 ? sizeof(Elf64_##type) : sizeof(Elf32_##type))
+
+
+struct elf_index_s {
+    const uint8_t *map;
+    size_t map_sz;
+    bool is64;
+    uint64_t type;
+    uint64_t vaddr_min;         // of the first PT_LOAD, page aligned
+    const uint8_t *shdrs;
+    size_t shnum;
+    size_t shentsize;
+    const char *shstr;
+    size_t shstr_sz;
+    elf_symbol_t *symbols;      // sorted by address
+    size_t symbols_n;
+    uint32_t *by_name;          // indices into symbols, sorted by name
+};
+
+
+static inline bool elf_range(const ElfIndex *index, uint64_t off, uint64_t len)
+{
+    return off <= index->map_sz && len <= index->map_sz - off;
+}
+
+
+static inline const uint8_t *elf_shdr(const ElfIndex *index, size_t i)
+{
+    return index->shdrs + i * index->shentsize;
+}
+
+
+// a section's contents, NULL if it has none in the file
+static const uint8_t *elf_section_data(const ElfIndex *index, size_t i, uint64_t *size)
+{
+    const uint8_t *sh = elf_shdr(index, i);
+    const uint64_t off = ELF_GET(index, sh, Shdr, sh_offset);
+    *size = ELF_GET(index, sh, Shdr, sh_size);
+    if (ELF_GET(index, sh, Shdr, sh_type) == SHT_NOBITS || !elf_range(index, off, *size))
+        return NULL;
+    return index->map + off;
+}
+
+
+// a string of a string table, NULL unless it ends within the table
+static const char *elf_string(const char *table, size_t table_sz, uint64_t off)
+{
+    if (table == NULL || off >= table_sz || memchr(table + off, '\0', table_sz - off) == NULL)
+        return NULL;
+    return table + off;
+}
+
+
+static int symbol_addr_cmp(const void *a, const void *b)
+{
+    const elf_symbol_t *sa = a, *sb = b;
+    return (sa->addr > sb->addr) - (sa->addr < sb->addr);
+}
+
+
+static int symbol_name_cmp(const void *a, const void *b, void *symbols)
+{
+    const elf_symbol_t *s = symbols;
+    return strcmp(s[*(const uint32_t *) a].name, s[*(const uint32_t *) b].name);
+}
+
+
+// functions and objects of .symtab, else of .dynsym for a stripped binary
+static bool elf_index_load_symbols(ElfIndex *index)
+{
+    size_t symtab = 0;
+    for (size_t i = 1; i < index->shnum && symtab == 0; i++)
+        if (ELF_GET(index, elf_shdr(index, i), Shdr, sh_type) == SHT_SYMTAB)
+            symtab = i;
+    for (size_t i = 1; i < index->shnum && symtab == 0; i++)
+        if (ELF_GET(index, elf_shdr(index, i), Shdr, sh_type) == SHT_DYNSYM)
+            symtab = i;
+    if (symtab == 0)
+        return true;
+
+    uint64_t syms_sz, strs_sz;
+    const uint8_t *syms = elf_section_data(index, symtab, &syms_sz);
+    const uint64_t strtab = ELF_GET(index, elf_shdr(index, symtab), Shdr, sh_link);
+    const uint64_t sym_sz = ELF_SIZE(index, Sym);
+    if (syms == NULL || strtab >= index->shnum)
+        return true;
+    const char *strs = (const char *) elf_section_data(index, strtab, &strs_sz);
+
+    const size_t n = syms_sz / sym_sz;
+    if (n == 0)
+        return true;
+    index->symbols = malloc(n * sizeof(elf_symbol_t));
+    if (index->symbols == NULL) {
+        LOG_F("failed to allocate %zu symbols", n);
+        return false;
+    }
+    for (size_t i = 0; i < n; i++) {
+        const uint8_t *sym = syms + i * sym_sz;
+        const uint8_t type = ELF_GET(index, sym, Sym, st_info) & 0xf;
+        const uint64_t addr = ELF_GET(index, sym, Sym, st_value);
+        const char *name = elf_string(strs, strs_sz, ELF_GET(index, sym, Sym, st_name));
+        if ((type != STT_FUNC && type != STT_OBJECT && type != STT_GNU_IFUNC)
+            || ELF_GET(index, sym, Sym, st_shndx) == SHN_UNDEF || addr == 0
+            || name == NULL || name[0] == '\0')
+            continue;
+        index->symbols[index->symbols_n++] = (elf_symbol_t) {
+            addr, ELF_GET(index, sym, Sym, st_size), name
+        };
+    }
+    qsort(index->symbols, index->symbols_n, sizeof(elf_symbol_t), symbol_addr_cmp);
+
+    index->by_name = malloc(n * sizeof(uint32_t));
+    if (index->by_name == NULL) {
+        LOG_F("failed to allocate %zu symbols", index->symbols_n);
+        return false;
+    }
+    for (size_t i = 0; i < index->symbols_n; i++)
+        index->by_name[i] = i;
+    qsort_r(index->by_name, index->symbols_n, sizeof(uint32_t), symbol_name_cmp, index->symbols);
+    LOG_D("indexed %zu symbols", index->symbols_n);
+    return true;
+}
+
+
+static bool elf_index_load(ElfIndex *index, const char *filename)
+{
+    const uint8_t *ident = index->map;
+    if (index->map_sz < EI_NIDENT || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        LOG_E("%s is not ELF", filename);
+        return false;
+    }
+    if ((ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64)
+        || ident[EI_DATA] != ELF_HOST_DATA) {
+        LOG_E("%s is ELF of an unsupported class or byte order", filename);
+        return false;
+    }
+    index->is64 = ident[EI_CLASS] == ELFCLASS64;
+    if (!elf_range(index, 0, ELF_SIZE(index, Ehdr))) {
+        LOG_E("%s is truncated", filename);
+        return false;
+    }
+
+    const uint8_t *eh = index->map;
+    index->type = ELF_GET(index, eh, Ehdr, e_type);
+
+    const uint64_t phoff = ELF_GET(index, eh, Ehdr, e_phoff);
+    const uint64_t phentsize = ELF_GET(index, eh, Ehdr, e_phentsize);
+    const uint64_t phnum = ELF_GET(index, eh, Ehdr, e_phnum);
+    index->vaddr_min = UINT64_MAX;
+    for (uint64_t i = 0; phentsize >= ELF_SIZE(index, Phdr) && i < phnum; i++) {
+        if (!elf_range(index, phoff + i * phentsize, phentsize))
+            break;
+        const uint8_t *ph = index->map + phoff + i * phentsize;
+        const uint64_t vaddr = ELF_GET(index, ph, Phdr, p_vaddr);
+        if (ELF_GET(index, ph, Phdr, p_type) == PT_LOAD && vaddr < index->vaddr_min)
+            index->vaddr_min = vaddr;
+    }
+    index->vaddr_min = index->vaddr_min == UINT64_MAX ? 0 : index->vaddr_min & ~(uint64_t) (getpagesize() - 1);
+
+    const uint64_t shoff = ELF_GET(index, eh, Ehdr, e_shoff);
+    index->shentsize = ELF_GET(index, eh, Ehdr, e_shentsize);
+    index->shnum = ELF_GET(index, eh, Ehdr, e_shnum);
+    uint64_t shstrndx = ELF_GET(index, eh, Ehdr, e_shstrndx);
+    if (shoff == 0 || index->shentsize < ELF_SIZE(index, Shdr) || !elf_range(index, shoff, index->shentsize)) {
+        LOG_E("%s has no section header table", filename);
+        return false;
+    }
+    index->shdrs = index->map + shoff;
+    // counts that don't fit the ELF header are in the first section header
+    if (index->shnum == 0)
+        index->shnum = ELF_GET(index, index->shdrs, Shdr, sh_size);
+    if (shstrndx == SHN_XINDEX)
+        shstrndx = ELF_GET(index, index->shdrs, Shdr, sh_link);
+    if (index->shnum > (index->map_sz - shoff) / index->shentsize) {
+        LOG_E("%s has a truncated section header table", filename);
+        return false;
+    }
+    LOG_D("found %zu sections", index->shnum);
+
+    uint64_t shstr_sz = 0;
+    if (shstrndx < index->shnum)
+        index->shstr = (const char *) elf_section_data(index, shstrndx, &shstr_sz);
+    index->shstr_sz = shstr_sz;
+
+    return elf_index_load_symbols(index);
+}
+
+
+ElfIndex *elf_index_open(const char *filename)
+{
+    int fd = open(filename, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        PLOG_F("failed to open %s", filename);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        PLOG_F("failed to stat %s", filename);
+        close(fd);
+        return NULL;
+    }
+
+    ElfIndex *index = calloc(1, sizeof(ElfIndex));
+    assert(index != NULL);
+    index->map_sz = st.st_size;
+    index->map = mmap(NULL, index->map_sz, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (index->map == MAP_FAILED) {
+        PLOG_F("failed mmap %s", filename);
+        free(index);
+        return NULL;
+    }
+
+    if (!elf_index_load(index, filename)) {
+        elf_index_close(index);
+        return NULL;
+    }
+    return index;
+}
+
+
+void elf_index_close(ElfIndex *index)
+{
+    munmap((void *) index->map, index->map_sz);
+    free(index->symbols);
+    free(index->by_name);
+    free(index);
+}
+
+
+bool elf_index_pie(ElfIndex *index)
+{
+    return index->type == ET_DYN;
+}
+
+
+// the section named sec_name, else the first whose name contains it
+bool elf_index_section(ElfIndex *index, const char *sec_name, section_bounds_t *bounds)
+{
+    size_t found = 0;
+    for (size_t i = 1; i < index->shnum; i++) {
+        const char *name = elf_string(index->shstr, index->shstr_sz,
+                                      ELF_GET(index, elf_shdr(index, i), Shdr, sh_name));
+        if (name == NULL)
+            continue;
+        if (strcmp(name, sec_name) == 0) {
+            found = i;
+            break;
+        }
+        if (found == 0 && strstr(name, sec_name) != NULL)
+            found = i;
+    }
+    if (found == 0)
+        return false;
+
+    const uint8_t *sh = elf_shdr(index, found);
+    bounds->sec_start = ELF_GET(index, sh, Shdr, sh_addr);
+    bounds->sec_end = bounds->sec_start + ELF_GET(index, sh, Shdr, sh_size);
+    return true;
+}
+
+
+size_t elf_index_symbols(ElfIndex *index, const elf_symbol_t **symbols)
+{
+    *symbols = index->symbols;
+    return index->symbols_n;
+}
+
+
+const elf_symbol_t *elf_index_symbol(ElfIndex *index, const char *name)
+{
+    size_t lo = 0, hi = index->symbols_n;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        const int cmp = strcmp(index->symbols[index->by_name[mid]].name, name);
+        if (cmp == 0)
+            return &index->symbols[index->by_name[mid]];
+        if (cmp < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return NULL;
+}
+
+
+// the symbol addr is in, a sizeless symbol only covers its own address
+const elf_symbol_t *elf_index_symbol_at(ElfIndex *index, uint64_t addr)
+{
+    size_t lo = 0, hi = index->symbols_n;
+    while (lo < hi) {
+        const size_t mid = lo + (hi - lo) / 2;
+        if (index->symbols[mid].addr <= addr)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    if (lo == 0)
+        return NULL;
+    const elf_symbol_t *sym = &index->symbols[lo - 1];
+    const uint64_t size = sym->size ? sym->size : 1;
+    return addr - sym->addr < size ? sym : NULL;
+}
+
+
+// the link-time address of the first mapped page: where a process maps the
+// start of the binary, less the load base
+uint64_t elf_index_base(ElfIndex *index)
+{
+    return index->vaddr_min;
+}
+
+
+// the bounds of sec_name in filename: its size, 0 if there is no such
+// section, -1 on error
+int64_t section_find(const char *filename, const char *sec_name, section_bounds_t *bounds)
+{
+    ElfIndex *index = elf_index_open(filename);
+    if (index == NULL)
+        return -1;
+    const bool found = elf_index_section(index, sec_name, bounds);
+    elf_index_close(index);
+    return found ? (int64_t) (bounds->sec_end - bounds->sec_start) : 0;
+}
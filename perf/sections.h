@@ -0,0 +1,38 @@
+#ifndef _H_SECTIONS_
+#define _H_SECTIONS_
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Sections and symbols of an ELF binary (32 or 64-bit, of the host's byte
+ * order), read from a private mapping of the file. Addresses are the
+ * link-time ones; a PIE binary runs them shifted by its load base.
+ */
+
+typedef struct section_bounds {
+    uint64_t sec_start;
+    uint64_t sec_end;
+} section_bounds_t;
+
+typedef struct elf_symbol {
+    uint64_t addr;
+    uint64_t size;
+    const char *name;           // into the mapping, valid until the index is closed
+} elf_symbol_t;
+
+typedef struct elf_index_s ElfIndex;
+
+ElfIndex *elf_index_open(const char *filename);
+void      elf_index_close(ElfIndex *index);
+bool      elf_index_pie(ElfIndex *index);
+bool      elf_index_section(ElfIndex *index, const char *sec_name, section_bounds_t *bounds);
+size_t    elf_index_symbols(ElfIndex *index, const elf_symbol_t **symbols);
+const elf_symbol_t *elf_index_symbol(ElfIndex *index, const char *name);
+const elf_symbol_t *elf_index_symbol_at(ElfIndex *index, uint64_t addr);
+uint64_t  elf_index_base(ElfIndex *index);
+
+int64_t section_find(const char *filename, const char *sec_name, section_bounds_t *bounds);
+
+#endif
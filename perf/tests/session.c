@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <perf/log.h>
+#include <perf/perf.h>
+#include <perf/sections.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/personality.h>
+#include <unistd.h>
+
+/*
+ * Sessions that start from nothing: the fork server comes up before any
+ * input exists and an empty input is traced like any other, in both modes;
+ * exec mode keeps its event from one input to the next. Where the SUT
+ * binary was mapped is known after every trace, and the children of the
+ * fork server are traced: their branches land in the SUT binary. A PIE
+ * SUT runs at a new base for every exec-mode input, and its branches,
+ * shifted back to link-time addresses as the front-ends do, are the same
+ * ones in .text whatever the base.
+ * Needs an Intel BTS PMU, skipped without one.
+ */
+
+#define BTS_PATH        "/sys/bus/event_source/devices/intel_bts"
+#define FORKSRV_PRELOAD "../preloads/forksrv.so"
+#define ASLR_PATH       "/proc/sys/kernel/randomize_va_space"
+#define ASLR_RUNS       8
+
+#define CHECK(cond) do {                                                        \
+    if (!(cond)) {                                                              \
+        fprintf(stderr, "%s:%d: failed: %s\n", __FILE__, __LINE__, #cond);      \
+        exit(EXIT_FAILURE);                                                     \
+    }                                                                           \
+} while (0)
+
+
+static void check_trace(perf_session_t *session, char const **argv, const char *input, size_t len)
+{
+    bts_branch_t *bts_start;
+    uint64_t count;
+    CHECK(perf_session_trace(session, (const uint8_t *) input, len, argv, &bts_start, &count) == PERF_SUCCESS);
+    CHECK(count == 0 || bts_start != NULL);
+    CHECK(session->image_start != 0 && session->image_start < session->image_end);
+}
+
+
+// the trace of the last input has branches into the SUT itself, not only
+// into libc or the shim
+static void check_traced(perf_session_t *session, char const **argv)
+{
+    bts_branch_t *bts_start;
+    uint64_t count;
+    CHECK(perf_session_trace(session, (const uint8_t *) "abc", 3, argv, &bts_start, &count) == PERF_SUCCESS);
+    CHECK(count > 0 && bts_start != NULL);
+    uint64_t in_image = 0;
+    for (uint64_t i = 0; i < count; i++)
+        in_image += bts_start[i].to >= session->image_start && bts_start[i].to < session->image_end;
+    CHECK(in_image > 0);
+}
+
+
+// traces the SUT at bases as ASLR picks them, marking in seen the .text
+// targets of its branches at their link-time addresses; returns how many
+// bases were different from the first
+static size_t check_relocated(perf_session_t *session, char const **argv, ElfIndex *elf,
+                              const section_bounds_t *text, uint8_t *seen)
+{
+    size_t moved = 0;
+    uint64_t first_base = 0;
+    for (size_t run = 0; run < ASLR_RUNS; run++) {
+        bts_branch_t *bts_start;
+        uint64_t count;
+        CHECK(perf_session_trace(session, (const uint8_t *) "abc", 3, argv, &bts_start, &count) == PERF_SUCCESS);
+        CHECK(session->image_start != 0 && session->image_start % getpagesize() == 0);
+        if (run == 0)
+            first_base = session->image_start;
+        moved += session->image_start != first_base;
+
+        uint64_t in_text = 0, known = 0;
+        for (uint64_t i = 0; i < count; i++) {
+            const uint64_t to = bts_start[i].to;
+            if (to < session->image_start || to >= session->image_end)
+                continue;
+            const uint64_t link = to - session->image_start + elf_index_base(elf);
+            if (link < text->sec_start || link >= text->sec_end)
+                continue;
+            in_text++;
+            known += seen[link - text->sec_start] || run == 0;
+            seen[link - text->sec_start] = 1;
+        }
+        // the same input takes the same branches in the SUT, wherever it runs
+        CHECK(in_text > 0 && known > 0);
+    }
+    return moved;
+}
+
+
+int main(void)
+{
+    log_level = WARNING;
+    if (access(BTS_PATH, F_OK) == -1) {
+        printf("session: skipped, no Intel BTS\n");
+        return EXIT_SUCCESS;
+    }
+    char const *argv[] = { "/bin/cat", NULL };
+
+    // exec mode, an empty input first; the event and its rings stay
+    perf_session_t session;
+    perf_session_init(&session);
+    check_trace(&session, argv, "", 0);
+    const int perf_fd = session.perf_fd;
+    void *mmap_aux = session.mmap_aux;
+    check_trace(&session, argv, "abc", 3);
+    check_trace(&session, argv, "", 0);
+    CHECK(session.perf_fd == perf_fd && session.mmap_aux == mmap_aux);
+    perf_session_destroy(&session);
+
+    bts_branch_t *bts_start;
+    uint64_t count;
+    CHECK(perf_monitor_api((const uint8_t *) "", 0, argv, &bts_start, &count) == PERF_SUCCESS);
+
+    // the fork server of a fresh session
+    CHECK(access(FORKSRV_PRELOAD, R_OK) == 0);
+    perf_session_init(&session);
+    CHECK(perf_session_forksrv(&session, argv, FORKSRV_PRELOAD) == PERF_SUCCESS);
+    check_trace(&session, argv, "", 0);
+    check_trace(&session, argv, "abc", 3);
+    check_traced(&session, argv);
+    check_traced(&session, argv);
+    perf_session_destroy(&session);
+
+    // a PIE SUT with ASLR on, even when this runs under setarch -R
+    ElfIndex *elf = elf_index_open(argv[0]);
+    CHECK(elf != NULL);
+    section_bounds_t text;
+    FILE *aslr = fopen(ASLR_PATH, "r");
+    int randomize = 0;
+    if (aslr != NULL) {
+        CHECK(fscanf(aslr, "%d", &randomize) == 1);
+        fclose(aslr);
+    }
+    if (!elf_index_pie(elf) || randomize == 0) {
+        printf("session: relocation skipped, %s is not a PIE or ASLR is off\n", argv[0]);
+    } else {
+        CHECK(elf_index_section(elf, ".text", &text) && text.sec_end > text.sec_start);
+        uint8_t *seen = calloc(text.sec_end - text.sec_start, 1);
+        CHECK(seen != NULL);
+        CHECK(personality(personality(0xffffffff) & ~ADDR_NO_RANDOMIZE) != -1);
+
+        perf_session_init(&session);
+        CHECK(check_relocated(&session, argv, elf, &text, seen) > 0);
+        perf_session_destroy(&session);
+
+        // every child of the fork server at its base, the same branches
+        perf_session_init(&session);
+        CHECK(perf_session_forksrv(&session, argv, FORKSRV_PRELOAD) == PERF_SUCCESS);
+        CHECK(check_relocated(&session, argv, elf, &text, seen) == 0);
+        perf_session_destroy(&session);
+        free(seen);
+    }
+    elf_index_close(elf);
+
+    printf("session: ok\n");
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,149 @@
+#define _GNU_SOURCE
+#include <perf/forksrv.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <dlfcn.h>
+#include <link.h>
+#include <ucontext.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+
+#define likely(x)       __builtin_expect((x),1)
+#define unlikely(x)     __builtin_expect((x),0)
+
+#if defined(__i386__)
+#   define REG_PC REG_EIP
+#elif defined(__x86_64)
+#   define REG_PC REG_RIP
+#endif
+
+typedef int (*main_fn_t)(int, char **, char **);
+typedef int (*libc_start_main_fn_t)(main_fn_t, int, char **, void (*)(void),
+                                    void (*)(void), void (*)(void), void *);
+
+static main_fn_t real_main;
+static uint8_t *park_addr;
+static uint8_t park_orig;
+
+
+static int forksrv_read(uint32_t *msg)
+{
+    return read(FORKSRV_CTL_FD, msg, sizeof(uint32_t)) == sizeof(uint32_t);
+}
+
+
+static int forksrv_write(uint32_t msg)
+{
+    return write(FORKSRV_ST_FD, &msg, sizeof(uint32_t)) == sizeof(uint32_t);
+}
+
+
+// returns only in the forked children, the server itself never leaves
+static void forksrv_loop(void)
+{
+    if (!forksrv_write(FORKSRV_MSG_HELLO))
+        return;
+
+    uint32_t msg;
+    while (forksrv_read(&msg)) {
+        if (msg != FORKSRV_MSG_FORK)
+            _exit(EXIT_FAILURE);
+
+        pid_t child = fork();
+        if (child < 0)
+            _exit(EXIT_FAILURE);
+
+        if (child == 0) {
+            // the monitor attaches perf before letting us go
+            if (!forksrv_read(&msg) || msg != FORKSRV_MSG_GO)
+                _exit(EXIT_FAILURE);
+            close(FORKSRV_CTL_FD);
+            close(FORKSRV_ST_FD);
+            lseek(STDIN_FILENO, 0, SEEK_SET);
+            return;
+        }
+
+        if (!forksrv_write((uint32_t) child))
+            _exit(EXIT_FAILURE);
+        int status;
+        if (waitpid(child, &status, 0) == -1)
+            _exit(EXIT_FAILURE);
+        if (!forksrv_write((uint32_t) status))
+            _exit(EXIT_FAILURE);
+    }
+
+    _exit(EXIT_SUCCESS);
+}
+
+
+static void park_sig_handler(int signum, siginfo_t *siginfo, void *context)
+{
+    ucontext_t *uc = (ucontext_t *) context;
+    if ((uint8_t *) uc->uc_mcontext.gregs[REG_PC] - 1 != park_addr)
+        return;
+
+    *park_addr = park_orig;
+    uc->uc_mcontext.gregs[REG_PC]--;
+    signal(SIGTRAP, SIG_DFL);
+    forksrv_loop();
+}
+
+
+static int load_bias_cb(struct dl_phdr_info *info, size_t size, void *data)
+{
+    // the first object is always the main executable
+    *(uintptr_t *) data = info->dlpi_addr;
+    return 1;
+}
+
+
+static int park_at(const char *addr_str)
+{
+    uintptr_t bias = 0;
+    dl_iterate_phdr(load_bias_cb, &bias);
+    park_addr = (uint8_t *) (strtoull(addr_str, NULL, 16) + bias);
+
+    const long pg_sz = sysconf(_SC_PAGESIZE);
+    void *pg = (void *) ((uintptr_t) park_addr & ~(pg_sz - 1));
+    if (mprotect(pg, pg_sz * 2, PROT_READ | PROT_WRITE | PROT_EXEC) == -1)
+        return 0;
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(struct sigaction));
+    sa.sa_sigaction = park_sig_handler;
+    sa.sa_flags = SA_SIGINFO | SA_NODEFER;
+    if (sigaction(SIGTRAP, &sa, NULL) == -1)
+        return 0;
+
+    park_orig = *park_addr;
+    *park_addr = 0xCC;
+    return 1;
+}
+
+
+static int forksrv_main(int argc, char **argv, char **envp)
+{
+    unsetenv("LD_PRELOAD");
+
+    const char *addr_str = getenv(FORKSRV_ADDR_ENV);
+    if (addr_str == NULL || !park_at(addr_str))
+        forksrv_loop();
+
+    return real_main(argc, argv, envp);
+}
+
+
+int __libc_start_main(main_fn_t main, int argc, char **argv, void (*init)(void),
+                      void (*fini)(void), void (*rtld_fini)(void), void *stack_end)
+{
+    libc_start_main_fn_t real_libc_start_main = dlsym(RTLD_NEXT, "__libc_start_main");
+    if (unlikely(!real_libc_start_main))
+        _exit(EXIT_FAILURE);
+
+    real_main = main;
+    return real_libc_start_main(forksrv_main, argc, argv, init, fini, rtld_fini, stack_end);
+}
@@ -8,6 +8,17 @@
 #include <math.h>
 #include <zmq.h>
 #include <unistd.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#if defined(AFL)
+#include <sys/shm.h>
+#endif
+#include <c_monitor/credits.h>
+#include <c_monitor/ring.h>
 
 
 #define likely(x)       __builtin_expect((x),1)
@@ -16,6 +27,7 @@
 
 #if defined(AFL)
 #   define PATH_NEEDLE "cur_input"
+#   define SHM_FUZZ_ENV "__AFL_SHM_FUZZ_ID"     // AFL++ test cases in shared memory
 #elif defined(HONGG)
 #   define PATH_NEEDLE "honggfuzz.input"
 #else
@@ -23,23 +35,84 @@
 #endif
 
 #define STR(s) #s
+#define REAL(fn)                                                                \
+    static __typeof__(fn) *real_##fn;                                           \
+    if (unlikely(!real_##fn))                                                   \
+        real_##fn = dlsym(RTLD_NEXT, STR(fn))
 #define _LOG_FILENAME(x) STR(x) ".log"
 #define LOG_FILENAME _LOG_FILENAME(FUZZ)
-#define SKIP_N 100
+#define SKIP_N 100                  // sampling while no monitor grants credits
+#define CREDITS_RETRY_MS 1000
+#define SIZES_N (64 * 1024)         // input sizes remembered, modulo
+// credits kept for inputs of a size not sent yet, 0 samples without bias
+#ifndef NOVELTY_RESERVE
+#   define NOVELTY_RESERVE 1
+#endif
+// inputs per message, a batch goes out as one multipart message
+#ifndef BATCH_N
+#   define BATCH_N 1
+#endif
+// shared memory ring to the monitor, inputs over a quarter of it go by zmq
+#ifndef RING_SZ
+#   define RING_SZ (4 * 1024 * 1024)
+#endif
+// longer test cases are cut
+#ifndef TESTCASE_MAX
+#   define TESTCASE_MAX (1024 * 1024)
+#endif
+#define TESTCASES_N 64              // input files open at once, one per fuzzer thread
+#define FDS_N 4096                  // input files on fds past it are not seen
 
 static pid_t pid;
-static int fuzzer_out_fd;
 static FILE *log_file;
 static long start_time_ms;
 static void *context;
 static void *sender;
+static pthread_mutex_t sender_lock = PTHREAD_MUTEX_INITIALIZER;
 static unsigned long counter = 0;
+static unsigned long batched = 0;
+static credits_t *credits;
+static pthread_mutex_t credits_lock = PTHREAD_MUTEX_INITIALIZER;
+static long credits_retry_ms;
+static uint8_t sizes_sent[SIZES_N / 8];
+static unsigned long zmq_dropped;
+
+// a ring to the monitor for every thread, each its only producer
+static __thread ring_t *ring;
+static __thread bool ring_failed;
+static pthread_key_t ring_key;      // closes the ring of a thread that exits
+static int bell_fd = -1;
+static struct sockaddr_un bell_addr;
+static socklen_t bell_addr_len;
+
+// an input file as the fuzzer wrote it, sent once the test case is complete;
+// fuzzers like honggfuzz write one from every thread
+typedef struct testcase {
+    pthread_mutex_t lock;       // held by the hooks for all of the below
+    int fd;                     // -1 once closed
+    pid_t tid;                  // of the thread that opened it last
+    uint8_t *data;              // TESTCASE_MAX bytes
+    size_t len;
+    size_t pos;                 // of the next write()
+    bool dirty;                 // changed since it was last sent
+    uint8_t *map;               // the input file mapped by the fuzzer, if it is
+    size_t map_len;
+} testcase_t;
+
+static testcase_t testcases[TESTCASES_N];
+static testcase_t *fd_testcases[FDS_N];     // of the input fds
+static pthread_mutex_t testcases_lock = PTHREAD_MUTEX_INITIALIZER;  // taking a test case
+
+#if defined(AFL)
+static const uint8_t *shm_input;    // u32 length, then the test case
+static size_t shm_input_sz;
+#endif
 
 static inline long get_time_ms(void)
 {
     struct timespec spec;
     clock_gettime(CLOCK_MONOTONIC, &spec);
-    return round(spec.tv_nsec / 1.0e6);
+    return spec.tv_sec * 1000 + round(spec.tv_nsec / 1.0e6);
 }
 
 static inline void log_action(char *str)
@@ -49,12 +122,345 @@ static inline void log_action(char *str)
 }
 
 
+static void credits_attach(void)
+{
+    __atomic_store_n(&credits_retry_ms, get_time_ms() + CREDITS_RETRY_MS, __ATOMIC_RELAXED);
+    int fd = shm_open(CREDITS_SHM, O_RDWR, 0);
+    if (fd == -1)
+        return;
+    credits_t *mapped = mmap(NULL, sizeof(credits_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return;
+    if (__atomic_load_n(&mapped->magic, __ATOMIC_ACQUIRE) != CREDITS_MAGIC) {
+        munmap(mapped, sizeof(credits_t));
+        return;
+    }
+    __atomic_store_n(&credits, mapped, __ATOMIC_RELEASE);
+    log_action("credits_attach");
+}
+
+
+// whether to send this input: as long as the monitor has credits left,
+// the last few only for sizes not sent before
+static bool sample(size_t count, credits_t **taken_from)
+{
+    *taken_from = NULL;
+    credits_t *granter = __atomic_load_n(&credits, __ATOMIC_ACQUIRE);
+    if (granter != NULL) {
+        const uint64_t granted = __atomic_load_n(&granter->granted, __ATOMIC_ACQUIRE);
+        const uint64_t taken = __atomic_load_n(&granter->taken, __ATOMIC_RELAXED);
+        if (likely(taken < granted)) {
+            const size_t size_i = count % SIZES_N;
+            const uint8_t bit = 1 << (size_i % 8);
+            const bool novel = !(__atomic_load_n(&sizes_sent[size_i / 8], __ATOMIC_RELAXED) & bit);
+            if (granted - taken <= NOVELTY_RESERVE && !novel)
+                return false;
+            __atomic_fetch_or(&sizes_sent[size_i / 8], bit, __ATOMIC_RELAXED);
+            __atomic_fetch_add(&granter->taken, 1, __ATOMIC_RELAXED);
+            *taken_from = granter;
+            return true;
+        }
+
+        // out of credits: the monitor is busy, unless it is gone; the
+        // mapping stays, other threads may still be reading it
+        const long alive_ms = __atomic_load_n(&granter->alive_ms, __ATOMIC_RELAXED);
+        if (get_time_ms() - alive_ms < CREDITS_STALE_MS)
+            return false;
+        if (__atomic_compare_exchange_n(&credits, &granter, NULL, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            log_action("credits_stale");
+    }
+
+    if (unlikely(get_time_ms() >= __atomic_load_n(&credits_retry_ms, __ATOMIC_RELAXED))
+        && pthread_mutex_trylock(&credits_lock) == 0) {
+        if (__atomic_load_n(&credits, __ATOMIC_RELAXED) == NULL)
+            credits_attach();
+        pthread_mutex_unlock(&credits_lock);
+        if (__atomic_load_n(&credits, __ATOMIC_RELAXED) != NULL)
+            return sample(count, taken_from);
+    }
+    if (unlikely(__atomic_add_fetch(&counter, 1, __ATOMIC_RELAXED) % (SKIP_N + 1) == 0))
+        return true;
+    return false;
+}
+
+static void ring_name(char *name, size_t size, pid_t ring_pid, pid_t tid)
+{
+    snprintf(name, size, "/" RING_SHM_PREFIX "%d.%d", ring_pid, tid);
+}
+
+
+static void ring_create(void)
+{
+    _Static_assert((RING_SZ & (RING_SZ - 1)) == 0, "RING_SZ must be a power of two");
+    char name[64];
+    const pid_t ring_pid = getpid();
+    const pid_t tid = gettid();
+    ring_name(name, sizeof(name), ring_pid, tid);
+    // left by a thread that had our tid and died
+    shm_unlink(name);
+    int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0600);
+    if (fd == -1) {
+        log_action("fail_ring");
+        ring_failed = true;
+        return;
+    }
+    if (ftruncate(fd, sizeof(ring_t) + RING_SZ) == -1) {
+        log_action("fail_ring");
+        close(fd);
+        shm_unlink(name);
+        ring_failed = true;
+        return;
+    }
+    ring = mmap(NULL, sizeof(ring_t) + RING_SZ, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (ring == MAP_FAILED) {
+        log_action("fail_ring");
+        ring = NULL;
+        shm_unlink(name);
+        ring_failed = true;
+        return;
+    }
+    ring->size = RING_SZ;
+    ring->pid = ring_pid;
+    ring->tid = tid;
+    __atomic_store_n(&ring->magic, RING_MAGIC, __ATOMIC_RELEASE);
+    pthread_setspecific(ring_key, ring);
+    log_action("open_ring");
+}
+
+
+// the monitor drains the ring, then drops it
+static void ring_close(void *arg)
+{
+    ring_t *closing = arg;
+    char name[64];
+    ring_name(name, sizeof(name), closing->pid, closing->tid);
+    fprintf(log_file, "ring %d: %" PRIu64 " inputs, %" PRIu64 " dropped\n", closing->tid,
+            closing->sent, closing->dropped);
+    __atomic_store_n(&closing->closed, 1, __ATOMIC_RELEASE);
+    munmap(closing, sizeof(ring_t) + RING_SZ);
+    shm_unlink(name);
+}
+
+
+// a child forked off a fuzzer thread makes rings of its own
+static void ring_forget(void)
+{
+    ring = NULL;
+    ring_failed = false;
+    pthread_setspecific(ring_key, NULL);
+}
+
+
+// copies the input into the ring of this thread unless it's full, never waits
+static bool ring_put(const void *buf, size_t count)
+{
+    const uint64_t need = RING_RECORD(count);
+    const uint64_t start = ring->head;
+    const uint64_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+    uint64_t head = start;
+    uint64_t off = head & (RING_SZ - 1);
+    const uint64_t pad = off + need > RING_SZ ? RING_SZ - off : 0;
+    if (unlikely(need + pad > RING_SZ - (head - tail))) {
+        __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+        return false;
+    }
+
+    uint8_t *data = ring_data(ring);
+    if (pad > 0) {
+        *(uint32_t *) (data + off) = RING_WRAP;
+        head += pad;
+        off = 0;
+    }
+    *(uint32_t *) (data + off) = count;
+    memcpy(data + off + sizeof(uint32_t), buf, count);
+    __atomic_store_n(&ring->head, head + need, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&ring->sent, ring->sent + 1, __ATOMIC_RELAXED);
+
+    // it was empty, the monitor may be asleep
+    if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == start && bell_fd != -1)
+        sendto(bell_fd, &ring->tid, sizeof(ring->tid), MSG_DONTWAIT | MSG_NOSIGNAL,
+               (struct sockaddr *) &bell_addr, bell_addr_len);
+    return true;
+}
+
+
+static bool send_input(const void *buf, size_t count)
+{
+    if (unlikely(ring == NULL) && !ring_failed)
+        ring_create();
+    if (likely(ring != NULL && RING_RECORD(count) <= RING_SZ / 4))
+        return ring_put(buf, count);
+
+    // the rest of a batch is never refused once its first part is queued
+    pthread_mutex_lock(&sender_lock);
+    bool sent = true;
+    batched++;
+    if (zmq_send(sender, buf, count, ZMQ_DONTWAIT | (batched < BATCH_N ? ZMQ_SNDMORE : 0)) == -1) {
+        zmq_dropped++;
+        batched--;
+        sent = false;
+    } else if (batched == BATCH_N) {
+        batched = 0;
+    }
+    pthread_mutex_unlock(&sender_lock);
+    return sent;
+}
+
+
+static void offer_input(const void *buf, size_t count)
+{
+    // a dropped input gives its credit back, the monitor never saw it
+    credits_t *taken_from;
+    if (sample(count, &taken_from) && !send_input(buf, count) && taken_from != NULL)
+        __atomic_fetch_sub(&taken_from->taken, 1, __ATOMIC_RELAXED);
+}
+
+
+// the test case written through fd, locked; NULL if fd is no input file
+static testcase_t *testcase_lock(int fd)
+{
+    if (fd < 0 || fd >= FDS_N)
+        return NULL;
+    testcase_t *tc = __atomic_load_n(&fd_testcases[fd], __ATOMIC_ACQUIRE);
+    if (likely(tc == NULL))
+        return NULL;
+    pthread_mutex_lock(&tc->lock);
+    // closed meanwhile, and maybe taken for another fd
+    if (tc->fd != fd) {
+        pthread_mutex_unlock(&tc->lock);
+        return NULL;
+    }
+    return tc;
+}
+
+
+// the test case mapped at addr, locked
+static testcase_t *testcase_lock_map(const void *addr, bool start)
+{
+    for (size_t i = 0; i < TESTCASES_N; i++) {
+        testcase_t *tc = &testcases[i];
+        uint8_t *map = __atomic_load_n(&tc->map, __ATOMIC_RELAXED);
+        if (likely(map == NULL))
+            continue;
+        pthread_mutex_lock(&tc->lock);
+        if (tc->map != NULL && (start ? (uint8_t *) addr == tc->map
+            : (uint8_t *) addr >= tc->map && (uint8_t *) addr < tc->map + tc->map_len))
+            return tc;
+        pthread_mutex_unlock(&tc->lock);
+    }
+    return NULL;
+}
+
+
+// one input per test case, however many syscalls wrote it
+static void testcase_flush(testcase_t *tc)
+{
+    if (!tc->dirty)
+        return;
+    tc->dirty = false;
+    offer_input(tc->data, tc->len);
+}
+
+
+// a test case for the input file the fuzzer opened as fd; a thread gets
+// the one it had, as long as it is not still open
+static void testcase_open(int fd, int flags)
+{
+    if (fd >= FDS_N)
+        return;
+    const pid_t tid = gettid();
+    pthread_mutex_lock(&testcases_lock);
+    testcase_t *tc = NULL;
+    for (int pass = 0; pass < 2 && tc == NULL; pass++) {
+        for (size_t i = 0; i < TESTCASES_N && tc == NULL; i++) {
+            pthread_mutex_lock(&testcases[i].lock);
+            if (testcases[i].fd == -1 && testcases[i].map == NULL
+                && (pass == 1 || testcases[i].tid == tid))
+                tc = &testcases[i];
+            else
+                pthread_mutex_unlock(&testcases[i].lock);
+        }
+    }
+    pthread_mutex_unlock(&testcases_lock);
+    if (tc == NULL) {
+        log_action("fail_testcase");
+        return;
+    }
+
+    if (tc->data == NULL && (tc->data = malloc(TESTCASE_MAX)) == NULL) {
+        log_action("fail_testcase");
+        pthread_mutex_unlock(&tc->lock);
+        return;
+    }
+    // what the slot holds goes out before the slot is reused
+    testcase_flush(tc);
+    if (tc->tid != tid)
+        tc->len = 0;
+    tc->fd = fd;
+    tc->tid = tid;
+    if (flags & O_TRUNC)
+        tc->len = 0;
+    tc->pos = flags & O_APPEND ? tc->len : 0;
+    __atomic_store_n(&fd_testcases[fd], tc, __ATOMIC_RELEASE);
+    pthread_mutex_unlock(&tc->lock);
+}
+
+
+static void testcase_close(testcase_t *tc)
+{
+    testcase_flush(tc);
+    __atomic_store_n(&fd_testcases[tc->fd], NULL, __ATOMIC_RELAXED);
+    tc->fd = -1;
+}
+
+
+static void testcase_write(testcase_t *tc, size_t off, const void *buf, size_t count)
+{
+    // writing from the start again, the last test case is complete
+    if (off == 0 && tc->dirty)
+        testcase_flush(tc);
+    tc->dirty = true;
+    if (off >= TESTCASE_MAX)
+        return;
+
+    const size_t end = off + count < TESTCASE_MAX ? off + count : TESTCASE_MAX;
+    if (off > tc->len)
+        memset(tc->data + tc->len, 0, off - tc->len);
+    memcpy(tc->data + off, buf, end - off);
+    if (end > tc->len)
+        tc->len = end;
+}
+
+
+static void testcase_truncate(testcase_t *tc, size_t len)
+{
+    if (len > TESTCASE_MAX)
+        len = TESTCASE_MAX;
+    if (len > tc->len)
+        memset(tc->data + tc->len, 0, len - tc->len);
+    tc->len = len;
+    tc->dirty = true;
+}
+
+
+// takes the test case from the mapping, the file is as long as the fuzzer made it
+static void testcase_sync_map(testcase_t *tc)
+{
+    size_t len = tc->len > 0 && tc->len < tc->map_len ? tc->len : tc->map_len;
+    if (len > TESTCASE_MAX)
+        len = TESTCASE_MAX;
+    memcpy(tc->data, tc->map, len);
+    tc->len = len;
+    tc->dirty = true;
+}
+
+
 #define MAKE_OPEN(open)                                                         \
 int open(const char *path, int flags, ...)                                      \
 {                                                                               \
-    static int (*real_##open)(const char *, int, ...);                          \
-    if (unlikely(!real_##open))                                                 \
-        real_##open = dlsym(RTLD_NEXT, STR(open));                              \
+    REAL(open);                                                                 \
                                                                                 \
     va_list args;                                                               \
     va_start(args, flags);                                                      \
@@ -67,9 +473,8 @@ int open(const char *path, int flags, ...)
     }                                                                           \
     va_end(args);                                                               \
                                                                                 \
-    if (strstr(path, PATH_NEEDLE)) {                                            \
-        fuzzer_out_fd = ret;                                                    \
-    }                                                                           \
+    if (ret != -1 && strstr(path, PATH_NEEDLE))                                 \
+        testcase_open(ret, flags);                                              \
                                                                                 \
     return ret;                                                                 \
 }
@@ -77,22 +482,195 @@ int open(const char *path, int flags, ...)
 MAKE_OPEN(open);
 MAKE_OPEN(open64);
 
+
 ssize_t write(int fd, const void *buf, size_t count)
 {
-    static ssize_t (*real_write)(int, const void *, size_t);
-    if (unlikely(!real_write))
-        real_write = dlsym(RTLD_NEXT, "write");
+    REAL(write);
 
-    if (fd == fuzzer_out_fd) {
-        counter++;
-        if (unlikely(counter > SKIP_N)) {
-          zmq_send(sender, buf, count, 0);
-          counter = 0;
-        }
+    ssize_t ret = real_write(fd, buf, count);
+    testcase_t *tc;
+    if (ret > 0 && (tc = testcase_lock(fd)) != NULL) {
+        testcase_write(tc, tc->pos, buf, ret);
+        tc->pos += ret;
+        pthread_mutex_unlock(&tc->lock);
+    }
+#if defined(AFL)
+    // the fuzzer tells its fork server to run what is in shared memory
+    struct stat st;
+    if (unlikely(shm_input != NULL) && count == 4 && ret == 4
+        && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+        size_t len = *(const volatile uint32_t *) shm_input;
+        if (len > shm_input_sz - sizeof(uint32_t))
+            len = shm_input_sz - sizeof(uint32_t);
+        if (len > 0)
+            offer_input(shm_input + sizeof(uint32_t), len);
+    }
+#endif
+
+    return ret;
+}
+
+
+#define MAKE_PWRITE(pwrite, off_t)                                              \
+ssize_t pwrite(int fd, const void *buf, size_t count, off_t offset)             \
+{                                                                               \
+    REAL(pwrite);                                                               \
+                                                                                \
+    ssize_t ret = real_##pwrite(fd, buf, count, offset);                        \
+    testcase_t *tc;                                                             \
+    if (ret > 0 && (tc = testcase_lock(fd)) != NULL) {                          \
+        testcase_write(tc, offset, buf, ret);                                   \
+        pthread_mutex_unlock(&tc->lock);                                        \
+    }                                                                           \
+    return ret;                                                                 \
+}
+
+MAKE_PWRITE(pwrite, off_t);
+MAKE_PWRITE(pwrite64, off64_t);
+
+
+ssize_t writev(int fd, const struct iovec *iov, int iovcnt)
+{
+    REAL(writev);
+
+    ssize_t ret = real_writev(fd, iov, iovcnt);
+    testcase_t *tc;
+    if (ret <= 0 || (tc = testcase_lock(fd)) == NULL)
+        return ret;
+    size_t left = ret;
+    for (int i = 0; left > 0 && i < iovcnt; i++) {
+        const size_t len = left < iov[i].iov_len ? left : iov[i].iov_len;
+        testcase_write(tc, tc->pos, iov[i].iov_base, len);
+        tc->pos += len;
+        left -= len;
+    }
+    pthread_mutex_unlock(&tc->lock);
+    return ret;
+}
+
+
+#define MAKE_LSEEK(lseek, off_t)                                                \
+off_t lseek(int fd, off_t offset, int whence)                                   \
+{                                                                               \
+    REAL(lseek);                                                                \
+                                                                                \
+    off_t ret = real_##lseek(fd, offset, whence);                               \
+    testcase_t *tc;                                                             \
+    if (ret != -1 && (tc = testcase_lock(fd)) != NULL) {                        \
+        /* back at the start, the last test case is complete */                 \
+        if (ret == 0)                                                           \
+            testcase_flush(tc);                                                 \
+        tc->pos = ret;                                                          \
+        pthread_mutex_unlock(&tc->lock);                                        \
+    }                                                                           \
+    return ret;                                                                 \
+}
+
+MAKE_LSEEK(lseek, off_t);
+MAKE_LSEEK(lseek64, off64_t);
+
+
+// AFL++ writes a test case, then truncates the file to its length
+#define MAKE_FTRUNCATE(ftruncate, off_t)                                        \
+int ftruncate(int fd, off_t length)                                             \
+{                                                                               \
+    REAL(ftruncate);                                                            \
+                                                                                \
+    int ret = real_##ftruncate(fd, length);                                     \
+    testcase_t *tc;                                                             \
+    if (ret == 0 && (tc = testcase_lock(fd)) != NULL) {                         \
+        testcase_truncate(tc, length);                                          \
+        if (tc->map == NULL)                                                    \
+            testcase_flush(tc);                                                 \
+        pthread_mutex_unlock(&tc->lock);                                        \
+    }                                                                           \
+    return ret;                                                                 \
+}
+
+MAKE_FTRUNCATE(ftruncate, off_t);
+MAKE_FTRUNCATE(ftruncate64, off64_t);
+
+
+int close(int fd)
+{
+    REAL(close);
+
+    testcase_t *tc = testcase_lock(fd);
+    if (tc != NULL) {
+        testcase_close(tc);
+        pthread_mutex_unlock(&tc->lock);
+    }
+    return real_close(fd);
+}
+
+
+#define MAKE_MMAP(mmap, off_t)                                                  \
+void *mmap(void *addr, size_t length, int prot, int flags, int fd, off_t offset) \
+{                                                                               \
+    REAL(mmap);                                                                 \
+                                                                                \
+    void *ret = real_##mmap(addr, length, prot, flags, fd, offset);             \
+    testcase_t *tc;                                                             \
+    if (ret != MAP_FAILED && offset == 0 && (prot & PROT_WRITE)                 \
+        && (flags & MAP_SHARED) && (tc = testcase_lock(fd)) != NULL) {          \
+        tc->map_len = length;                                                   \
+        __atomic_store_n(&tc->map, ret, __ATOMIC_RELAXED);                      \
+        pthread_mutex_unlock(&tc->lock);                                        \
+    }                                                                           \
+    return ret;                                                                 \
+}
+
+MAKE_MMAP(mmap, off_t);
+MAKE_MMAP(mmap64, off64_t);
+
+
+// a test case written through a mapping is complete once synced or unmapped
+int msync(void *addr, size_t length, int flags)
+{
+    REAL(msync);
+
+    testcase_t *tc = testcase_lock_map(addr, false);
+    if (tc != NULL) {
+        testcase_sync_map(tc);
+        testcase_flush(tc);
+        pthread_mutex_unlock(&tc->lock);
+    }
+    return real_msync(addr, length, flags);
+}
+
+
+int munmap(void *addr, size_t length)
+{
+    REAL(munmap);
+
+    testcase_t *tc = testcase_lock_map(addr, true);
+    if (tc != NULL) {
+        testcase_sync_map(tc);
+        testcase_flush(tc);
+        __atomic_store_n(&tc->map, NULL, __ATOMIC_RELAXED);
+        pthread_mutex_unlock(&tc->lock);
     }
+    return real_munmap(addr, length);
+}
+
+
+#if defined(AFL)
+void *shmat(int shmid, const void *shmaddr, int shmflg)
+{
+    REAL(shmat);
 
-    return real_write(fd, buf, count);
+    void *ret = real_shmat(shmid, shmaddr, shmflg);
+    const char *fuzz_id = getenv(SHM_FUZZ_ENV);
+    struct shmid_ds ds;
+    if (ret != (void *) -1 && fuzz_id != NULL && atoi(fuzz_id) == shmid
+        && shmctl(shmid, IPC_STAT, &ds) == 0 && ds.shm_segsz > sizeof(uint32_t)) {
+        shm_input = ret;
+        shm_input_sz = ds.shm_segsz;
+        log_action("shm_input");
+    }
+    return ret;
 }
+#endif
 
 __attribute__((constructor)) static void before_main(void)
 {
@@ -106,6 +684,11 @@ __attribute__((constructor)) static void before_main(void)
     }
     log_action("open_log");
 
+    for (size_t i = 0; i < TESTCASES_N; i++) {
+        pthread_mutex_init(&testcases[i].lock, NULL);
+        testcases[i].fd = -1;
+    }
+
     context = zmq_ctx_new();
     sender = zmq_socket(context, ZMQ_PUSH);
     if (!sender) {
@@ -117,6 +700,11 @@ __attribute__((constructor)) static void before_main(void)
         exit(EXIT_FAILURE);
     }
     log_action("open_zmq");
+    pthread_key_create(&ring_key, ring_close);
+    pthread_atfork(NULL, NULL, ring_forget);
+    bell_addr_len = ring_bell_addr(&bell_addr);
+    bell_fd = socket(AF_UNIX, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    credits_attach();
 
     setenv("LD_PRELOAD", "", 1);
 }
@@ -125,8 +713,25 @@ __attribute__((constructor)) static void before_main(void)
 __attribute__((destructor)) static void after_main(void)
 {
     if (pid == getpid()) {
+        for (size_t i = 0; i < TESTCASES_N; i++) {
+            pthread_mutex_lock(&testcases[i].lock);
+            testcase_flush(&testcases[i]);
+            pthread_mutex_unlock(&testcases[i].lock);
+        }
+        // those of the threads still running go when the monitor sees us gone
+        if (ring != NULL) {
+            pthread_setspecific(ring_key, NULL);
+            ring_close(ring);
+            ring = NULL;
+        }
+        fprintf(log_file, "zmq: %lu dropped\n", zmq_dropped);
+        // an empty frame closes the batch, the monitor drops it
+        if (batched > 0)
+          zmq_send(sender, "", 0, ZMQ_DONTWAIT);
         zmq_close(sender);
         zmq_ctx_destroy(context);
+        if (credits != NULL)
+            munmap(credits, sizeof(credits_t));
         log_action("close_zmq");
         fclose(log_file);
     }
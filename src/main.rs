@@ -3,14 +3,15 @@ extern crate zmq;
 use std::time::Instant;
 use std::env::args;
 use std::fmt;
-use std::process::Command;
 
 mod qemu;
 mod perf;
 mod myperf;
+mod sections;
 
 
 const ZMQ_BIND: &str = "tcp://*:5558";
+const TRACE_FAILURES_MAX: usize = 16; // in a row, as the C monitor's workers
 
 trait AsMillis {
     fn as_millis(self) -> u64;
@@ -37,7 +38,9 @@ impl fmt::Display for MonitoringTool {
 struct FuzzMonitor {
     tool: MonitoringTool,
     sut: Vec<String>,
-    branch_store: myperf::BranchStore
+    branch_store: myperf::BranchStore,
+    tracer: Option<myperf::Tracer>,
+    failures: usize
 }
 
 impl fmt::Display for FuzzMonitor {
@@ -51,7 +54,9 @@ impl std::default::Default for FuzzMonitor {
         FuzzMonitor {
             tool: MonitoringTool::Perf,
             sut: vec![],
-            branch_store: myperf::BranchStore::empty()
+            branch_store: myperf::BranchStore::empty(),
+            tracer: None,
+            failures: 0
         }
     }
 }
@@ -91,6 +96,10 @@ impl FuzzMonitor {
         let sut_clone = self.sut.clone();
         let sut_s = sut_clone.iter().map(|s| s.as_str()).collect::<Vec<&str>>();
         let sut = &sut_s.as_slice();
+        myperf::quiet();
+        if let MonitoringTool::CPerf = self.tool {
+            self.tracer = Some(myperf::Tracer::new(sut));
+        }
 
         let (sec_start, sec_end) = self.get_section_address(".text").unwrap();
         println!("[+] .text section bounds: 0x{:x} - 0x{:x}", sec_start, sec_end);
@@ -99,7 +108,14 @@ impl FuzzMonitor {
             let bytes = receiver.recv_bytes(0).unwrap();
             let bytes_len = bytes.len();
 
-            let (coverage, ms, new_branches) = self.trace(bytes, sut, sec_start, sec_end);
+            let (coverage, ms, new_branches) = match self.trace(bytes, sut, sec_start, sec_end) {
+                Some(traced) => traced,
+                None if self.failures >= TRACE_FAILURES_MAX => {
+                    println!("[-] {} traces failed in a row, giving up", self.failures);
+                    std::process::exit(1);
+                }
+                None => continue
+            };
 
             let mut new_max = false;
             if coverage > max_coverage {
@@ -129,51 +145,36 @@ impl FuzzMonitor {
     }
 
     fn get_section_address(&self, section: &str) -> Option<(u64, u64)> {
-        let sut = self.sut.get(0).unwrap();
-        let out = Command::new("./section_address.sh").arg(sut).arg(section)
-            .output().expect("failed to run section_address.sh");
-
-        if !out.status.success() {
-            return None;
-        }
-
-        let out_str = String::from_utf8_lossy(out.stdout.as_slice()).into_owned();
-        let line = out_str.lines().nth(0).unwrap();
-        let mut line_split = line.split(" ");
-        let splitted_fst = line_split.nth(1).unwrap();
-        let splitted_snd = line_split.nth(0).unwrap();
-        Some((
-            u64::from_str_radix(splitted_fst, 10).expect("failed parsing start address"),
-            u64::from_str_radix(splitted_snd, 10).expect("failed parsing end address")
-        ))
+        sections::ElfIndex::open(self.sut.first()?)?.section(section)
     }
 
     fn trace(&mut self, bytes: Vec<u8>, sut: &[&str], sec_start: u64, sec_end: u64)
-        -> (u64, u64, Option<usize>) {
+        -> Option<(u64, u64, Option<usize>)> {
         let now = Instant::now();
         let mut new_branches = None;
         let coverage = match self.tool {
             MonitoringTool::Qemu => qemu::trace(bytes, sut).len() as u64,
             MonitoringTool::Perf => perf::trace(bytes, sut),
             MonitoringTool::CPerf => {
-                // let mut bts_start: *mut BTSBranch = &mut BTSBranch { from: 0, to: 0, misc: 0 };
-                // let mut count: u64 = 0;
-                // let ret = myperf::trace(bytes, sut, &mut bts_start, &mut count).unwrap();
-                // if ret == 0 {
-                //     panic!("child ends");
-                // } else {
-                //     println!("[?] parent");
-                // }
-                // count
-                let mut trace = myperf::trace2(bytes, sut);
-                trace.retain(|bts|
+                let tracer = self.tracer.as_mut().expect("no tracer");
+                let trace = match tracer.trace(bytes.as_slice()) {
+                    Ok(trace) => trace,
+                    Err(ret) => {
+                        // one input the SUT could not be traced on, the next may do
+                        self.failures += 1;
+                        println!("[-] failed perf monitoring ({}), input of {}b skipped", ret, bytes.len());
+                        return None;
+                    }
+                };
+                self.failures = 0;
+                let covered = trace.filter(|bts|
                     (bts.from >= sec_start && bts.from <= sec_end) ||
                     (bts.to >= sec_start && bts.to <= sec_end));
-                new_branches = Some(self.branch_store.add(trace.as_slice()));
-                trace.len() as u64
+                new_branches = Some(self.branch_store.add(covered.clone()));
+                covered.count() as u64
             }
         };
-        (coverage, now.elapsed().as_millis(), new_branches)
+        Some((coverage, now.elapsed().as_millis(), new_branches))
     }
 }
 
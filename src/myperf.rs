@@ -1,11 +1,13 @@
 extern crate libc;
 
 use std::ffi::CString;
-use std::process::{Command, Stdio};
-use std::io::Write;
+use std::ptr;
+use std::slice;
 
 use std::collections::HashMap;
 
+use sections::ElfIndex;
+
 
 #[repr(C)]
 #[derive(Eq, PartialEq, Hash, Clone)]
@@ -31,54 +33,64 @@ extern "C" {
     static mut log_level: llevel_t;
     fn perf_monitor_api(data: *const u8, data_count: libc::size_t, argv: *const *const libc::c_char,
                         bts_start: *mut *mut BTSBranch, count: *mut u64) -> i32;
+    fn perf_monitor_api_image(image_start: *mut u64, image_end: *mut u64);
 }
 
 
-#[allow(dead_code)]
-pub fn trace(bytes: Vec<u8>, argv: &[&str], bts_start: *mut *mut BTSBranch, count: *mut u64)
-    -> Result<i32, i32> {
-    let args: Vec<*const libc::c_char> = argv.iter().map(|arg|
-        CString::new(arg.to_string()).unwrap().as_ptr()
-    ).collect();
-
-    let ret = unsafe {
-        log_level = llevel_t::MACHINE;
-        perf_monitor_api(bytes.as_slice().as_ptr(), bytes.len(), args.as_slice().as_ptr(), bts_start, count)
-    };
-
-    if ret < 0 { Err(ret) }
-    else { Ok(ret) }
+/// Keeps libperf from logging anything but machine output.
+pub fn quiet() {
+    unsafe { log_level = llevel_t::MACHINE; }
 }
 
-#[allow(dead_code)]
-pub fn trace2(bytes: Vec<u8>, sut: &[&str]) -> Vec<BTSBranch> {
-    let mut perf_proc = Command::new("./perf/perf").args(&["x"]).args(sut)
-        .stdin(Stdio::piped()).stdout(Stdio::piped()).stderr(Stdio::null())
-        .spawn().expect("failed to start perf");
-
-    {
-        let stdin = perf_proc.stdin.as_mut().expect("failed to get stdin");
-        stdin.write_all(bytes.as_slice()).expect("failed to write to stdin");
+
+/// Traces inputs in process through libperf. The branches are read from the
+/// library's trace buffer, so they are only good until the next trace, and
+/// come at link-time addresses, wherever ASLR put the SUT.
+pub struct Tracer {
+    _sut: Vec<CString>,
+    argv: Vec<*const libc::c_char>,
+    image_vaddr: u64
+}
+
+impl Tracer {
+    pub fn new(sut: &[&str]) -> Tracer {
+        let sut: Vec<CString> = sut.iter().map(|arg|
+            CString::new(*arg).expect("nul byte in SUT argument")
+        ).collect();
+        let mut argv: Vec<*const libc::c_char> = sut.iter().map(|arg| arg.as_ptr()).collect();
+        argv.push(ptr::null());
+        quiet();
+        let image_vaddr = sut.first()
+            .and_then(|path| ElfIndex::open(path.to_str().unwrap_or("")))
+            .map_or(0, |index| index.base());
+        Tracer { _sut: sut, argv: argv, image_vaddr: image_vaddr }
     }
 
-    let perf_out = perf_proc.wait_with_output().expect("failed to wait for perf");
-    let mut branches: Vec<BTSBranch> = vec![];
-    let perf_out_str = String::from_utf8_lossy(perf_out.stdout.as_slice()).into_owned();
-
-    for line in perf_out_str.lines() {
-        if line.starts_with("branch") {
-            let mut splitted = line.split(",");
-            let splitted_fst = splitted.nth(1).expect("no second element");
-            let splitted_snd = splitted.nth(0).expect("no third element");
-            branches.push(BTSBranch {
-                from: u64::from_str_radix(splitted_fst, 10).expect("failed parsing from"),
-                to: u64::from_str_radix(splitted_snd, 10).expect("failed parsing to"),
-                misc: 0
-            });
+    pub fn trace(&mut self, bytes: &[u8]) -> Result<impl Iterator<Item = BTSBranch> + Clone + '_, i32> {
+        let mut bts_start: *mut BTSBranch = ptr::null_mut();
+        let mut count: u64 = 0;
+        let ret = unsafe {
+            perf_monitor_api(bytes.as_ptr(), bytes.len(), self.argv.as_ptr(), &mut bts_start, &mut count)
+        };
+        if ret < 0 {
+            return Err(ret);
         }
-    }
 
-    branches
+        let branches: &[BTSBranch] = if count == 0 { &[] }
+            else { unsafe { slice::from_raw_parts(bts_start, count as usize) } };
+        let (mut image_start, mut image_end) = (0, 0);
+        unsafe { perf_monitor_api_image(&mut image_start, &mut image_end) };
+        let image_vaddr = self.image_vaddr;
+        let link = move |addr: u64| {
+            if addr >= image_start && addr < image_end { addr - image_start + image_vaddr }
+            else { addr }
+        };
+        Ok(branches.iter().map(move |branch| BTSBranch {
+            from: link(branch.from),
+            to: link(branch.to),
+            misc: branch.misc
+        }))
+    }
 }
 
 
@@ -91,15 +103,14 @@ impl BranchStore {
         BranchStore { hits: HashMap::new() }
     }
 
-    pub fn add(&mut self, branches: &[BTSBranch]) -> usize {
+    pub fn add<I: IntoIterator<Item = BTSBranch>>(&mut self, branches: I) -> usize {
         let mut new = 0;
         for branch in branches {
-            if let Some(entry) = self.hits.get_mut(branch) {
-                *entry += 1;
-                continue;
+            let hits = self.hits.entry(branch).or_insert(0);
+            if *hits == 0 {
+                new += 1;
             }
-            self.hits.insert(branch.clone(), 1);
-            new += 1;
+            *hits += 1;
         }
         new
     }
@@ -0,0 +1,91 @@
+extern crate libc;
+
+use std::ffi::{CStr, CString};
+
+
+#[repr(C)]
+#[derive(Default)]
+pub struct SectionBounds {
+    pub sec_start: u64,
+    pub sec_end: u64
+}
+
+#[repr(C)]
+pub struct ElfSymbol {
+    pub addr: u64,
+    pub size: u64,
+    name: *const libc::c_char
+}
+
+enum ElfIndexC {}
+
+#[link(name="perf", kind="static")]
+extern "C" {
+    fn elf_index_open(filename: *const libc::c_char) -> *mut ElfIndexC;
+    fn elf_index_close(index: *mut ElfIndexC);
+    fn elf_index_pie(index: *mut ElfIndexC) -> bool;
+    fn elf_index_base(index: *mut ElfIndexC) -> u64;
+    fn elf_index_section(index: *mut ElfIndexC, sec_name: *const libc::c_char,
+                         bounds: *mut SectionBounds) -> bool;
+    fn elf_index_symbol(index: *mut ElfIndexC, name: *const libc::c_char) -> *const ElfSymbol;
+    fn elf_index_symbol_at(index: *mut ElfIndexC, addr: u64) -> *const ElfSymbol;
+}
+
+
+#[allow(dead_code)]
+impl ElfSymbol {
+    pub fn name(&self) -> &str {
+        unsafe { CStr::from_ptr(self.name) }.to_str().unwrap_or("")
+    }
+}
+
+
+/// Sections and symbols of an ELF binary, through libperf's index of the
+/// mapped file. Addresses are link-time ones.
+pub struct ElfIndex {
+    index: *mut ElfIndexC
+}
+
+#[allow(dead_code)]
+impl ElfIndex {
+    pub fn open(filename: &str) -> Option<ElfIndex> {
+        let filename = CString::new(filename).ok()?;
+        let index = unsafe { elf_index_open(filename.as_ptr()) };
+        if index.is_null() { None }
+        else { Some(ElfIndex { index: index }) }
+    }
+
+    pub fn pie(&self) -> bool {
+        unsafe { elf_index_pie(self.index) }
+    }
+
+    /// The link-time address of the first mapped page of the binary.
+    pub fn base(&self) -> u64 {
+        unsafe { elf_index_base(self.index) }
+    }
+
+    pub fn section(&self, section: &str) -> Option<(u64, u64)> {
+        let section = CString::new(section).ok()?;
+        let mut bounds = SectionBounds::default();
+        if unsafe { elf_index_section(self.index, section.as_ptr(), &mut bounds) } {
+            Some((bounds.sec_start, bounds.sec_end))
+        } else {
+            None
+        }
+    }
+
+    pub fn symbol(&self, name: &str) -> Option<&ElfSymbol> {
+        let name = CString::new(name).ok()?;
+        unsafe { elf_index_symbol(self.index, name.as_ptr()).as_ref() }
+    }
+
+    pub fn symbol_at(&self, addr: u64) -> Option<&ElfSymbol> {
+        unsafe { elf_index_symbol_at(self.index, addr).as_ref() }
+    }
+}
+
+impl Drop for ElfIndex {
+    fn drop(&mut self) {
+        unsafe { elf_index_close(self.index) }
+    }
+}